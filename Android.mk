@@ -6,10 +6,21 @@ common_src_files := \
 	VoldCommand.cpp \
 	NetlinkManager.cpp \
 	NetlinkHandler.cpp \
+	BlockUevent.cpp \
+	UeventCoalescer.cpp \
 	Volume.cpp \
 	DirectVolume.cpp \
-	logwrapper.c \
+	DevpathIndex.cpp \
+	Filesystems.cpp \
+	FsProbe.cpp \
+	ProbeCache.cpp \
+	MediaCache.cpp \
+	CheckScheduler.cpp \
+	MountTable.cpp \
+	ToolRunner.cpp \
 	Process.cpp \
+	OpenFileScanner.cpp \
+	UnmountPolicy.cpp \
 	Ext4.cpp \
 	Fat.cpp \
 	Loop.cpp \
@@ -37,7 +48,7 @@ common_src_files += \
 
 #+NATIVE_PLATFORM [FUNCTION_STORAGE_TUXERA_PATCH]
 common_src_files += \
-	Filesystems.cpp ExFat.cpp HfsPlus.cpp 
+	ExFat.cpp HfsPlus.cpp 
 #-NATIVE_PLATFORM
 
 common_c_includes := \
@@ -56,7 +67,6 @@ common_shared_libraries := \
 	liblog \
 	libdiskconfig \
 	libhardware_legacy \
-	liblogwrap \
 	libcrypto \
 	libsqlite \
 	libext4_utils \
@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define LOG_TAG "Vold"
+
+#include <cutils/log.h>
+
+#include "BlockUevent.h"
+
+static int parseNumber(const char *s, int def) {
+    return s ? atoi(s) : def;
+}
+
+int BlockUevent::parse(NetlinkEvent *evt) {
+    const char *dp = evt->findParam("DEVPATH");
+    const char *maj = evt->findParam("MAJOR");
+    const char *min = evt->findParam("MINOR");
+    const char *type = evt->findParam("DEVTYPE");
+    const char *name = evt->findParam("DEVNAME");
+
+    if (!dp || !maj || !min) {
+        SLOGW("Block uevent without DEVPATH/MAJOR/MINOR ignored");
+        errno = EINVAL;
+        return -1;
+    }
+    if (strlen(dp) >= sizeof(devpath)) {
+        SLOGW("Block uevent DEVPATH too long (%d)", (int) strlen(dp));
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    action = evt->getAction();
+    if (type && !strcmp(type, "disk")) {
+        devtype = DevType_Disk;
+    } else if (type && !strcmp(type, "partition")) {
+        devtype = DevType_Partition;
+    } else {
+        devtype = DevType_Unknown;
+    }
+    major = atoi(maj);
+    minor = atoi(min);
+    partn = parseNumber(evt->findParam("PARTN"), -1);
+    nparts = parseNumber(evt->findParam("NPARTS"), -1);
+    strcpy(devpath, dp);
+    if (name) {
+        strlcpy(devname, name, sizeof(devname));
+    } else {
+        devname[0] = '\0';
+    }
+    return 0;
+}
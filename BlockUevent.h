@@ -0,0 +1,47 @@
+#ifndef _BLOCK_UEVENT_H
+#define _BLOCK_UEVENT_H
+
+#include <sysutils/NetlinkEvent.h>
+
+/*
+ * Typed view of a "block" subsystem uevent.
+ *
+ * NetlinkEvent keeps its parameters as "KEY=value" strings, and every
+ * findParam() is a linear search followed by an atoi(). The block handlers
+ * look at the same handful of keys many times per event, so
+ * NetlinkHandler::onEvent() parses them once into this struct and passes it
+ * down the Volume::handleBlockEvent() chain. It owns copies of its strings,
+ * so it stays valid after the NetlinkEvent is gone.
+ */
+struct BlockUevent {
+    static const int DEVPATH_MAX = 512;
+    static const int DEVNAME_MAX = 64;
+
+    enum {
+        DevType_Unknown,
+        DevType_Disk,
+        DevType_Partition,
+    };
+
+    int  action;        // NetlinkEvent::NlAction*
+    int  devtype;       // DevType_*
+    int  major;
+    int  minor;
+    int  partn;         // PARTN, or -1 if the kernel did not send it
+    int  nparts;        // NPARTS, or -1 if the kernel did not send it
+    char devpath[DEVPATH_MAX];
+    char devname[DEVNAME_MAX];
+
+    /*
+     * Fills in the fields from 'evt'.
+     * Returns 0 on success, -1 (errno set) if DEVPATH, MAJOR or MINOR is
+     * missing or DEVPATH does not fit.
+     */
+    int parse(NetlinkEvent *evt);
+
+    bool isDisk() const { return devtype == DevType_Disk; }
+    bool hasNumParts() const { return nparts >= 0; }
+    bool hasPartNum() const { return partn >= 0; }
+};
+
+#endif
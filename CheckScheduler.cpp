@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+
+#define LOG_TAG "Vold"
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "CheckScheduler.h"
+#include "ToolRunner.h"
+
+CheckScheduler::CheckScheduler() {
+    pthread_mutex_init(&mLock, NULL);
+    pthread_cond_init(&mCond, NULL);
+    mNextSeq = 0;
+    mForeground[0] = '\0';
+    mNumChecks = 0;
+    mNumQueued = 0;
+    mNumPromoted = 0;
+    mNumBusy = 0;
+}
+
+CheckScheduler::~CheckScheduler() {
+    HostCollection::iterator it;
+    for (it = mHosts.begin(); it != mHosts.end(); ++it) {
+        delete *it;
+    }
+    mHosts.clear();
+    pthread_cond_destroy(&mCond);
+    pthread_mutex_destroy(&mLock);
+}
+
+/* "usb1", "mmc0" - but not "usb1:1.0", "mmc_host" or "mmc0:0001" */
+static bool isHostComponent(const char *name, size_t len) {
+    size_t prefix;
+
+    if (len > 3 && (!strncmp(name, "usb", 3) || !strncmp(name, "mmc", 3))) {
+        for (prefix = 3; prefix < len; prefix++) {
+            if (!isdigit((unsigned char) name[prefix]))
+                return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+void CheckScheduler::hostKeyFromSysPath(const char *sysPath, char *key, size_t size) {
+    const char *p = sysPath;
+    const char *end = NULL;
+
+    while (*p) {
+        const char *name = p + strspn(p, "/");
+        size_t len = strcspn(name, "/");
+
+        if (!len)
+            break;
+        if (isHostComponent(name, len)) {
+            end = name + len;
+            break;
+        }
+        p = name + len;
+    }
+
+    if (!end) {
+        /* Neither USB nor MMC: one host per disk */
+        const char *block = strstr(sysPath, "/block/");
+        if (block) {
+            end = block + strlen("/block/");
+            end += strcspn(end, "/");
+        } else {
+            end = sysPath + strlen(sysPath);
+        }
+    }
+
+    size_t len = end - sysPath;
+    if (len >= size)
+        len = size - 1;
+    memcpy(key, sysPath, len);
+    key[len] = '\0';
+}
+
+void CheckScheduler::hostKey(const char *devicePath, char *key, size_t size) {
+    char link[PATH_MAX];
+    char sysPath[PATH_MAX];
+    struct stat st;
+
+    if (stat(devicePath, &st) || !S_ISBLK(st.st_mode)) {
+        strlcpy(key, devicePath, size);
+        return;
+    }
+    snprintf(link, sizeof(link), "/sys/dev/block/%u:%u", major(st.st_rdev), minor(st.st_rdev));
+    if (!realpath(link, sysPath)) {
+        strlcpy(key, devicePath, size);
+        return;
+    }
+    hostKeyFromSysPath(sysPath, key, size);
+}
+
+int CheckScheduler::getLimit() {
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get("tcc.vold.fsck.per_host", value, "");
+    int limit = atoi(value);
+    return limit > 0 ? limit : DEFAULT_PER_HOST;
+}
+
+CheckScheduler::Host *CheckScheduler::lookupHost_l(const char *key) {
+    HostCollection::iterator it;
+    for (it = mHosts.begin(); it != mHosts.end(); ++it) {
+        if (!strcmp((*it)->key, key))
+            return *it;
+    }
+
+    /* A handful of buses on any board; never freed */
+    Host *h = new Host();
+    strlcpy(h->key, key, sizeof(h->key));
+    h->running = 0;
+    mHosts.push_back(h);
+    return h;
+}
+
+bool CheckScheduler::isForeground_l(const Waiter *w) {
+    return mForeground[0] && w->label && !strcmp(w->label, mForeground);
+}
+
+/* Whether 'w' is the first to go on its host; 'promoted' if it jumps someone */
+bool CheckScheduler::isNext_l(const Waiter *w, bool *promoted) {
+    bool fg = isForeground_l(w);
+    WaiterCollection::iterator it;
+
+    *promoted = false;
+    for (it = mWaiters.begin(); it != mWaiters.end(); ++it) {
+        const Waiter *o = *it;
+        if (o == w || strcmp(o->key, w->key))
+            continue;
+        bool ofg = isForeground_l(o);
+        if (ofg && !fg)
+            return false;
+        if (ofg == fg && o->seq < w->seq)
+            return false;
+        if (fg && !ofg && o->seq < w->seq)
+            *promoted = true;
+    }
+    return true;
+}
+
+int CheckScheduler::check(FSType fsType, const char *devicePath, const char *label,
+                          ToolRunner *runner, bool *modified, int maxWaitMs) {
+    char key[PATH_MAX];
+    int limit = getLimit();
+    bool queued = false;
+    bool promoted = false;
+    bool busy = false;
+    struct timespec until;
+    Waiter w;
+
+    hostKey(devicePath, key, sizeof(key));
+    if (maxWaitMs >= 0) {
+        /* The wall clock gets stepped from RTC/GPS just as media come up */
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        until.tv_sec += maxWaitMs / 1000;
+        until.tv_nsec += (maxWaitMs % 1000) * 1000000;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+    }
+
+    pthread_mutex_lock(&mLock);
+    Host *h = lookupHost_l(key);
+    w.key = key;
+    w.label = label;
+    w.seq = mNextSeq++;
+    mWaiters.push_back(&w);
+    while (h->running >= limit || !isNext_l(&w, &promoted)) {
+        if (runner && runner->isCancelled())
+            break;
+        if (!queued) {
+            SLOGI("Check of %s waits for %s (%d running)", devicePath, key, h->running);
+            queued = true;
+        }
+        if (maxWaitMs < 0) {
+            pthread_cond_wait(&mCond, &mLock);
+        } else if (pthread_cond_timedwait_monotonic_np(&mCond, &mLock, &until) == ETIMEDOUT &&
+                (h->running >= limit || !isNext_l(&w, &promoted))) {
+            busy = true;
+            break;
+        }
+    }
+    WaiterCollection::iterator it;
+    for (it = mWaiters.begin(); it != mWaiters.end(); ++it) {
+        if (*it == &w) {
+            mWaiters.erase(it);
+            break;
+        }
+    }
+    /* Cancelled while queued; whoever was behind it may go now */
+    if (runner && runner->isCancelled()) {
+        SLOGW("Check of %s cancelled before it started", devicePath);
+        pthread_cond_broadcast(&mCond);
+        pthread_mutex_unlock(&mLock);
+        errno = ECANCELED;
+        return -1;
+    }
+    if (busy) {
+        SLOGW("No checker slot on %s for %s within %d ms", key, devicePath, maxWaitMs);
+        mNumBusy++;
+        pthread_cond_broadcast(&mCond);
+        pthread_mutex_unlock(&mLock);
+        errno = EBUSY;
+        return -1;
+    }
+    h->running++;
+    mNumChecks++;
+    if (queued)
+        mNumQueued++;
+    if (promoted) {
+        mNumPromoted++;
+        SLOGI("Check of %s (foreground %s) goes ahead of the queue", devicePath, label);
+    }
+    pthread_mutex_unlock(&mLock);
+
+    int rc = Filesystems::check(fsType, devicePath, runner, modified);
+    int err = errno;
+
+    pthread_mutex_lock(&mLock);
+    h->running--;
+    pthread_cond_broadcast(&mCond);
+    pthread_mutex_unlock(&mLock);
+
+    errno = err;
+    return rc;
+}
+
+void CheckScheduler::cancel(ToolRunner *runner) {
+    runner->cancel();
+
+    /* Wake it up if it is still queued */
+    pthread_mutex_lock(&mLock);
+    pthread_cond_broadcast(&mCond);
+    pthread_mutex_unlock(&mLock);
+}
+
+void CheckScheduler::setForeground(const char *label) {
+    pthread_mutex_lock(&mLock);
+    strlcpy(mForeground, label ? label : "", sizeof(mForeground));
+    /* Queued checks re-sort */
+    pthread_cond_broadcast(&mCond);
+    pthread_mutex_unlock(&mLock);
+}
+
+int CheckScheduler::getNumRunning() {
+    int n = 0;
+
+    pthread_mutex_lock(&mLock);
+    HostCollection::iterator it;
+    for (it = mHosts.begin(); it != mHosts.end(); ++it) {
+        n += (*it)->running;
+    }
+    pthread_mutex_unlock(&mLock);
+    return n;
+}
@@ -0,0 +1,105 @@
+#ifndef _CHECK_SCHEDULER_H
+#define _CHECK_SCHEDULER_H
+
+#include <pthread.h>
+#include <limits.h>
+
+#include <utils/List.h>
+
+#include "Filesystems.h"
+
+class ToolRunner;
+
+/*
+ * Runs the forked filesystem checkers, at most tcc.vold.fsck.per_host
+ * (default DEFAULT_PER_HOST) at a time on one physical host: the USB bus
+ * or MMC host the disk hangs off, taken from its sysfs devpath. Checkers
+ * on different hosts do not wait for each other.
+ *
+ * Waiting checks start in arrival order, except that the foreground
+ * volume - the one the user is waiting on, set with "volume foreground
+ * <label>" - goes ahead of every other check queued on its host.
+ */
+class CheckScheduler {
+public:
+    static const int DEFAULT_PER_HOST = 1;
+    /*
+     * How long a mount waits for a slot before it gives up on checking
+     * first: vold takes no commands, eject included, while it waits.
+     */
+    static const int MAX_SYNC_WAIT_MS = 2000;
+
+    CheckScheduler();
+    ~CheckScheduler();
+
+    /*
+     * Same contract as Filesystems::check(), errno included; blocks until
+     * the host of 'devicePath' has a free slot, for at most 'maxWaitMs'
+     * (-1 for as long as it takes). 'label' is the volume the partition
+     * belongs to. The deadline in 'runner' starts once the check does, not
+     * while it is queued. Fails without running anything with EBUSY if no
+     * slot came free in time, or ECANCELED if 'runner' is cancelled while
+     * the check waits.
+     */
+    int check(FSType fsType, const char *devicePath, const char *label,
+              ToolRunner *runner = NULL, bool *modified = NULL, int maxWaitMs = -1);
+
+    /* Cancels the check going through 'runner', queued or running */
+    void cancel(ToolRunner *runner);
+
+    /* NULL or "" for none */
+    void setForeground(const char *label);
+
+    /*
+     * Resolves the device node to its sysfs devpath and returns the host
+     * part of it (see hostKeyFromSysPath()), or the node itself if sysfs
+     * does not know it.
+     */
+    static void hostKey(const char *devicePath, char *key, size_t size);
+
+    /*
+     * The devpath up to its usbN or mmcN component, e.g.
+     * /sys/devices/platform/tcc-ehci/usb1 for every disk on that bus; up
+     * to the disk itself if there is neither.
+     */
+    static void hostKeyFromSysPath(const char *sysPath, char *key, size_t size);
+
+    int getNumRunning();
+    unsigned int getNumChecks() { return mNumChecks; }
+    unsigned int getNumQueued() { return mNumQueued; }
+    unsigned int getNumPromoted() { return mNumPromoted; }
+    unsigned int getNumBusy() { return mNumBusy; }
+
+private:
+    struct Host {
+        char key[PATH_MAX];
+        int  running;
+    };
+    typedef android::List<Host *> HostCollection;
+
+    struct Waiter {
+        const char   *key;
+        const char   *label;
+        unsigned int  seq;
+    };
+    typedef android::List<Waiter *> WaiterCollection;
+
+    pthread_mutex_t   mLock;
+    pthread_cond_t    mCond;
+    HostCollection    mHosts;
+    WaiterCollection  mWaiters;
+    unsigned int      mNextSeq;
+    char              mForeground[64];
+
+    unsigned int      mNumChecks;
+    unsigned int      mNumQueued;
+    unsigned int      mNumPromoted;
+    unsigned int      mNumBusy;
+
+    static int getLimit();
+    Host *lookupHost_l(const char *key);
+    bool isForeground_l(const Waiter *w);
+    bool isNext_l(const Waiter *w, bool *promoted);
+};
+
+#endif
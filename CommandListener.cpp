@@ -23,6 +23,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
+#include <time.h>
 
 #define LOG_TAG "VoldCmdListener"
 #include <cutils/log.h>
@@ -108,6 +109,8 @@ int CommandListener::DumpCmd::runCommand(SocketClient *cli,
         }
         fclose(fp);
     }
+    cli->sendMsg(0, "Dumping volume manager stats", false);
+    VolumeManager::Instance()->dumpStats(cli);
 
     cli->sendMsg(ResponseCode::CommandOkay, "dump complete", false);
     return 0;
@@ -161,6 +164,29 @@ int CommandListener::VolumeCmd::runCommand(SocketClient *cli,
             revert = true;
         }
         rc = vm->unmountVolume(argv[2], force, revert);
+    } else if (!strcmp(argv[1], "unmount_all")) {
+        if (argc != 3 || atoi(argv[2]) <= 0) {
+            cli->sendMsg(ResponseCode::CommandSyntaxError, "Usage: volume unmount_all <timeout_ms>", false);
+            return 0;
+        }
+
+        struct timespec ts;
+        char missed[255];
+        char msg[255 + 32];
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        if (vm->unmountAll((int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000 + atoi(argv[2]),
+                missed, sizeof(missed))) {
+            snprintf(msg, sizeof(msg), "Missed deadline: %s", missed);
+            cli->sendMsg(ResponseCode::OpFailedStorageBusy, msg, false);
+            return 0;
+        }
+    } else if (!strcmp(argv[1], "foreground")) {
+        if (argc != 3) {
+            cli->sendMsg(ResponseCode::CommandSyntaxError, "Usage: volume foreground <path|none>", false);
+            return 0;
+        }
+        rc = vm->setForegroundVolume(argv[2]);
     } else if (!strcmp(argv[1], "format")) {
         //===========================
         // For telechips
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define LOG_TAG "Vold"
+
+#include <cutils/log.h>
+
+#include "DevpathIndex.h"
+
+DevpathIndex::DevpathIndex() {
+    pthread_mutex_init(&mLock, NULL);
+    mRoot = new Node();
+    mRoot->c = '\0';
+    mRoot->child = NULL;
+    mRoot->sibling = NULL;
+    mRoot->entries = NULL;
+    mOwners = NULL;
+    mNumPaths = 0;
+    mNumNodes = 0;
+}
+
+DevpathIndex::~DevpathIndex() {
+    freeNode(mRoot);
+    while (mOwners) {
+        Owner *next = mOwners->next;
+        delete mOwners;
+        mOwners = next;
+    }
+    pthread_mutex_destroy(&mLock);
+}
+
+void DevpathIndex::freeNode(Node *node) {
+    while (node) {
+        Node *sibling = node->sibling;
+        Entry *e = node->entries;
+        while (e) {
+            Entry *next = e->next;
+            delete e;
+            e = next;
+        }
+        freeNode(node->child);
+        delete node;
+        node = sibling;
+    }
+}
+
+DevpathIndex::Owner *DevpathIndex::findOwner(Volume *v, bool create) {
+    Owner *o;
+
+    for (o = mOwners; o; o = o->next) {
+        if (o->volume == v)
+            return o;
+    }
+    if (!create)
+        return NULL;
+
+    o = new Owner();
+    o->volume = v;
+    o->order = -1;
+    o->next = mOwners;
+    mOwners = o;
+    return o;
+}
+
+DevpathIndex::Node *DevpathIndex::findChild(Node *parent, char c, bool create) {
+    Node *n;
+
+    for (n = parent->child; n; n = n->sibling) {
+        if (n->c == c)
+            return n;
+    }
+    if (!create)
+        return NULL;
+
+    n = new Node();
+    n->c = c;
+    n->child = NULL;
+    n->entries = NULL;
+    n->sibling = parent->child;
+    parent->child = n;
+    mNumNodes++;
+    return n;
+}
+
+int DevpathIndex::add(const char *prefix, Volume *v, int pathIndex) {
+    if (!prefix || !*prefix) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&mLock);
+    Node *node = mRoot;
+    for (const char *p = prefix; *p; p++) {
+        node = findChild(node, *p, true);
+    }
+
+    Entry *e = new Entry();
+    e->owner = findOwner(v, true);
+    e->pathIndex = pathIndex;
+    e->next = node->entries;
+    node->entries = e;
+    mNumPaths++;
+    pthread_mutex_unlock(&mLock);
+    return 0;
+}
+
+int DevpathIndex::remove(const char *prefix, Volume *v) {
+    int rc = -1;
+
+    pthread_mutex_lock(&mLock);
+    Owner *owner = findOwner(v, false);
+    Node *node = mRoot;
+    for (const char *p = prefix; node && *p; p++) {
+        node = findChild(node, *p, false);
+    }
+
+    if (owner && node && node != mRoot) {
+        Entry **pe = &node->entries;
+        while (*pe) {
+            if ((*pe)->owner == owner) {
+                Entry *e = *pe;
+                *pe = e->next;
+                delete e;
+                mNumPaths--;
+                rc = 0;
+                break;
+            }
+            pe = &(*pe)->next;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+
+    if (rc)
+        errno = ENOENT;
+    return rc;
+}
+
+void DevpathIndex::removeEntries(Node *node, Owner *owner) {
+    for (; node; node = node->sibling) {
+        Entry **pe = &node->entries;
+        while (*pe) {
+            if ((*pe)->owner == owner) {
+                Entry *e = *pe;
+                *pe = e->next;
+                delete e;
+                mNumPaths--;
+            } else {
+                pe = &(*pe)->next;
+            }
+        }
+        removeEntries(node->child, owner);
+    }
+}
+
+void DevpathIndex::removeVolume(Volume *v) {
+    pthread_mutex_lock(&mLock);
+    Owner **po = &mOwners;
+    while (*po) {
+        if ((*po)->volume == v) {
+            Owner *o = *po;
+            removeEntries(mRoot->child, o);
+            *po = o->next;
+            delete o;
+            break;
+        }
+        po = &(*po)->next;
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+void DevpathIndex::setOrder(Volume *v, int order) {
+    pthread_mutex_lock(&mLock);
+    findOwner(v, true)->order = order;
+    pthread_mutex_unlock(&mLock);
+}
+
+int DevpathIndex::lookup(const char *devpath, Match *matches, int max) {
+    int count = 0;
+
+    if (!devpath)
+        return 0;
+
+    pthread_mutex_lock(&mLock);
+    Node *node = mRoot;
+    for (const char *p = devpath; *p; p++) {
+        node = findChild(node, *p, false);
+        if (!node)
+            break;
+
+        for (Entry *e = node->entries; e; e = e->next) {
+            Owner *o = e->owner;
+            if (o->order < 0)
+                continue;
+
+            int i;
+            for (i = 0; i < count; i++) {
+                if (matches[i].volume == o->volume)
+                    break;
+            }
+            if (i < count) {
+                /* Same volume via another alias; keep its first listed path */
+                if (e->pathIndex < matches[i].pathIndex)
+                    matches[i].pathIndex = e->pathIndex;
+                continue;
+            }
+            /* Full: keep the first 'max' by volume order */
+            if (count == max && (!max || matches[max - 1].order < o->order)) {
+                SLOGW("Too many volumes claim '%s', ignoring %p", devpath, o->volume);
+                continue;
+            }
+            if (count == max) {
+                SLOGW("Too many volumes claim '%s', ignoring %p", devpath,
+                        matches[max - 1].volume);
+                count--;
+            }
+
+            /* Insert sorted by volume order */
+            for (i = count; i > 0 && matches[i - 1].order > o->order; i--) {
+                matches[i] = matches[i - 1];
+            }
+            matches[i].volume = o->volume;
+            matches[i].order = o->order;
+            matches[i].pathIndex = e->pathIndex;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+    return count;
+}
@@ -0,0 +1,78 @@
+#ifndef _DEVPATH_INDEX_H
+#define _DEVPATH_INDEX_H
+
+#include <pthread.h>
+
+class Volume;
+
+/*
+ * Prefix index from a sysfs DEVPATH to the volumes which claim it.
+ *
+ * Every path handed to DirectVolume::addPath() (fstab blk_device and the
+ * blk_device2 aliases) is stored in a character trie, so a block uevent
+ * finds all of its candidate volumes with a single walk over its DEVPATH
+ * instead of a strncmp() against every path of every volume.
+ */
+class DevpathIndex {
+public:
+    static const int MAX_MATCHES = 16;
+
+    struct Match {
+        Volume *volume;
+        int     order;      // position of the volume in VolumeManager's list
+        int     pathIndex;  // 1-based index of the matching path in the volume
+    };
+
+    DevpathIndex();
+    ~DevpathIndex();
+
+    int add(const char *prefix, Volume *v, int pathIndex);
+    int remove(const char *prefix, Volume *v);
+    void removeVolume(Volume *v);
+    void setOrder(Volume *v, int order);
+
+    /*
+     * Fills 'matches' with the volumes owning a prefix of 'devpath', at most
+     * one entry per volume (its lowest path index), sorted by volume order;
+     * the first 'max' of them if there are more. Volumes which have not
+     * been added to VolumeManager yet are skipped.
+     * Returns the number of matches.
+     */
+    int lookup(const char *devpath, Match *matches, int max);
+
+    int getNumPaths() { return mNumPaths; }
+    int getNumNodes() { return mNumNodes; }
+
+private:
+    struct Owner {
+        Volume *volume;
+        int     order;
+        Owner  *next;
+    };
+
+    struct Entry {
+        Owner *owner;
+        int    pathIndex;
+        Entry *next;
+    };
+
+    struct Node {
+        char   c;
+        Node  *child;
+        Node  *sibling;
+        Entry *entries;
+    };
+
+    pthread_mutex_t mLock;
+    Node           *mRoot;
+    Owner          *mOwners;
+    int             mNumPaths;
+    int             mNumNodes;
+
+    Owner *findOwner(Volume *v, bool create);
+    Node *findChild(Node *parent, char c, bool create);
+    void removeEntries(Node *node, Owner *owner);
+    void freeNode(Node *node);
+};
+
+#endif
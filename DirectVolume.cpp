@@ -28,6 +28,7 @@
 #include <sysutils/NetlinkEvent.h>
 
 #include "DirectVolume.h"
+#include "BlockUevent.h"
 #include "VolumeManager.h"
 #include "ResponseCode.h"
 #include "cryptfs.h"
@@ -83,6 +84,7 @@ DirectVolume::DirectVolume(VolumeManager *vm, const fstab_rec* rec, int flags) :
 DirectVolume::~DirectVolume() {
     PathCollection::iterator it;
 
+    mVm->getDevpathIndex()->removeVolume(this);
     for (it = mPaths->begin(); it != mPaths->end(); ++it)
         free(*it);
     delete mPaths;
@@ -90,7 +92,7 @@ DirectVolume::~DirectVolume() {
 
 int DirectVolume::addPath(const char *path) {
     mPaths->push_back(strdup(path));
-    return 0;
+    return mVm->getDevpathIndex()->add(path, this, mPaths->size());
 }
 
 dev_t DirectVolume::getDiskDevice() {
@@ -221,8 +223,8 @@ void DirectVolume::initMountpoint(const char *devpath) {
 #endif
 //-NATIVE_PLATFORM
 
-int DirectVolume::handleBlockEvent(NetlinkEvent *evt) {
-    const char *dp = evt->findParam("DEVPATH");
+int DirectVolume::handleBlockEvent(const BlockUevent *evt) {
+    const char *dp = evt->devpath;
 
     int connectedType = 0; // For telechips
     PathCollection::iterator  it;
@@ -230,108 +232,123 @@ int DirectVolume::handleBlockEvent(NetlinkEvent *evt) {
         connectedType++; // For telechips
         if (!strncmp(dp, *it, strlen(*it))) {
             /* We can handle this disk */
-            int action = evt->getAction();
-            const char *devtype = evt->findParam("DEVTYPE");
-            int major = atoi(evt->findParam("MAJOR")); // For telechips 
-            int minor = atoi(evt->findParam("MINOR")); // For telechips 
-
-            if (action == NetlinkEvent::NlActionAdd) {
-                // For telechips int major = atoi(evt->findParam("MAJOR"));
-                // For telechips int minor = atoi(evt->findParam("MINOR"));
-                char nodepath[255];
-
-                snprintf(nodepath,
-                         sizeof(nodepath), "/dev/block/vold/%d:%d",
-                         major, minor);
-                if (createDeviceNode(nodepath, major, minor)) {
-                    SLOGE("Error making device node '%s' (%s)", nodepath,
-                                                               strerror(errno));
-                }
-                if (!strcmp(devtype, "disk")) {
-                    //===========================
-                    // For telechips
-                    const char *tmp = evt->findParam("NPARTS");
-                    if ((mDiskMajor != -1) ||
-                           (major == 240 && (tmp==NULL || atoi(tmp)==0))) {
-                        break;
-                    }
-                    setStorageType(connectedType);
-                    //===========================
-                    handleDiskAdded(dp, evt);
-                } else {
-                    //===========================
-                    // For telechips
-                    if ((mDiskMajor != major) || (mDiskMinor > minor) || (mDiskMinor+15 < minor)) {
-                        break;
-                    }
-                    //===========================
-                    handlePartitionAdded(dp, evt);
-                }
-                /* Send notification iff disk is ready (ie all partitions found) */
-                if (getState() == Volume::State_Idle) {
-                    char msg[255];
-
-                    //+NATIVE_PLATFORM Removal of VoldResponseCode.VolumeDiskPrepared
-                    #ifdef PATCH_STORAGE_REMOVE_PREPARED_STAGE
-                    snprintf(msg, sizeof(msg), "Volume %s %s disk prepared (%d:%d) %s %s %d",
-                            getLabel(), getFuseMountpoint(), mDiskMajor, mDiskMinor, mDevType, mVolumeLabel, mVolumeId); // <- changed from mMountpoint for Kitkat              
-                    #else
-                    snprintf(msg, sizeof(msg), "Volume %s %s disk inserted (%d:%d)", 
-                            getLabel(), getFuseMountpoint(), mDiskMajor, mDiskMinor); // <- changed from mMountpoint for Kitkat
-                    #endif
-                    //-NATIVE_PLATFORM
-                    mVm->getBroadcaster()->sendBroadcast(ResponseCode::VolumeDiskInserted,
-                                                         msg, false);
-                }
-            } else if (action == NetlinkEvent::NlActionRemove) {
-                if (!strcmp(devtype, "disk")) {
-                    //===========================
-                    // For telechips
-                    if ((mDiskMajor != major) || (mDiskMinor != minor)) {
-                        break;
-                    }
-                    setStorageType(NULL);
-                    //===========================
-                    handleDiskRemoved(dp, evt);
-                } else {
-                    //===========================
-                    // For telechips
-                    if ((mDiskMajor != major) || (mDiskMinor > minor) || (mDiskMinor+15 < minor)) {
-                        break;
-                    }
-                    //===========================
-                    handlePartitionRemoved(dp, evt);
-                }
-            } else if (action == NetlinkEvent::NlActionChange) {
-                if (!strcmp(devtype, "disk")) {
-                    //===========================
-                    // For telechips
-                    if ((mDiskMajor != major) || (mDiskMinor != minor)) {
-                        break;
-                    }
-                    //===========================
-                    handleDiskChanged(dp, evt);
-                } else {
-                    //===========================
-                    // For telechips
-                    if ((mDiskMajor != major) || (mDiskMinor > minor) || (mDiskMinor+15 < minor)) {
-                        break;
-                    }
-                    //===========================
-                    handlePartitionChanged(dp, evt);
-                }
-            } else {
-                    SLOGW("Ignoring non add/remove/change event");
-            }
-
-            return 0;
+            return handleBlockEvent(evt, connectedType);
         }
     }
     errno = ENODEV;
     return -1;
 }
 
-void DirectVolume::handleDiskAdded(const char *devpath, NetlinkEvent *evt) {
+/*
+ * Handles an event whose DEVPATH starts with our pathIndex'th path
+ * (1-based, as routed by VolumeManager's DevpathIndex).
+ */
+int DirectVolume::handleBlockEvent(const BlockUevent *evt, int pathIndex) {
+    const char *dp = evt->devpath;
+    int connectedType = pathIndex; // For telechips
+
+    int action = evt->action;
+    int major = evt->major; // For telechips
+    int minor = evt->minor; // For telechips
+
+    if (action == NetlinkEvent::NlActionAdd) {
+        // For telechips int major = atoi(evt->findParam("MAJOR"));
+        // For telechips int minor = atoi(evt->findParam("MINOR"));
+        char nodepath[255];
+
+        snprintf(nodepath,
+                 sizeof(nodepath), "/dev/block/vold/%d:%d",
+                 major, minor);
+        if (createDeviceNode(nodepath, major, minor)) {
+            SLOGE("Error making device node '%s' (%s)", nodepath,
+                                                       strerror(errno));
+        }
+        if (evt->isDisk()) {
+            //===========================
+            // For telechips
+            if ((mDiskMajor != -1) ||
+                   (major == 240 && evt->nparts <= 0)) {
+                errno = ENODEV;
+                return -1;
+            }
+            setStorageType(connectedType);
+            //===========================
+            handleDiskAdded(dp, evt);
+        } else {
+            //===========================
+            // For telechips
+            if ((mDiskMajor != major) || (mDiskMinor > minor) || (mDiskMinor+15 < minor)) {
+                errno = ENODEV;
+                return -1;
+            }
+            //===========================
+            handlePartitionAdded(dp, evt);
+        }
+        /* Send notification iff disk is ready (ie all partitions found) */
+        if (getState() == Volume::State_Idle) {
+            char msg[255];
+
+            //+NATIVE_PLATFORM Removal of VoldResponseCode.VolumeDiskPrepared
+            #ifdef PATCH_STORAGE_REMOVE_PREPARED_STAGE
+            snprintf(msg, sizeof(msg), "Volume %s %s disk prepared (%d:%d) %s %s %d",
+                    getLabel(), getFuseMountpoint(), mDiskMajor, mDiskMinor, mDevType, mVolumeLabel, mVolumeId); // <- changed from mMountpoint for Kitkat              
+            #else
+            snprintf(msg, sizeof(msg), "Volume %s %s disk inserted (%d:%d)", 
+                    getLabel(), getFuseMountpoint(), mDiskMajor, mDiskMinor); // <- changed from mMountpoint for Kitkat
+            #endif
+            //-NATIVE_PLATFORM
+            mVm->getBroadcaster()->sendBroadcast(ResponseCode::VolumeDiskInserted,
+                                                 msg, false);
+        }
+    } else if (action == NetlinkEvent::NlActionRemove) {
+        if (evt->isDisk()) {
+            //===========================
+            // For telechips
+            if ((mDiskMajor != major) || (mDiskMinor != minor)) {
+                errno = ENODEV;
+                return -1;
+            }
+            setStorageType(NULL);
+            //===========================
+            handleDiskRemoved(dp, evt);
+        } else {
+            //===========================
+            // For telechips
+            if ((mDiskMajor != major) || (mDiskMinor > minor) || (mDiskMinor+15 < minor)) {
+                errno = ENODEV;
+                return -1;
+            }
+            //===========================
+            handlePartitionRemoved(dp, evt);
+        }
+    } else if (action == NetlinkEvent::NlActionChange) {
+        if (evt->isDisk()) {
+            //===========================
+            // For telechips
+            if ((mDiskMajor != major) || (mDiskMinor != minor)) {
+                errno = ENODEV;
+                return -1;
+            }
+            //===========================
+            handleDiskChanged(dp, evt);
+        } else {
+            //===========================
+            // For telechips
+            if ((mDiskMajor != major) || (mDiskMinor > minor) || (mDiskMinor+15 < minor)) {
+                errno = ENODEV;
+                return -1;
+            }
+            //===========================
+            handlePartitionChanged(dp, evt);
+        }
+    } else {
+            SLOGW("Ignoring non add/remove/change event");
+    }
+
+    return 0;
+}
+
+void DirectVolume::handleDiskAdded(const char *devpath, const BlockUevent *evt) {
     //+NATIVE_PLATFORM
     /* duplicated (already checked "mDiskMajor!=-1" before calling this method, so meaningless code)
     if ((mDiskMajor != -1) && (mDiskMinor != -1)) {
@@ -341,8 +358,8 @@ void DirectVolume::handleDiskAdded(const char *devpath, NetlinkEvent *evt) {
     */
     //-NATIVE_PLATFORM
 
-    mDiskMajor = atoi(evt->findParam("MAJOR"));
-    mDiskMinor = atoi(evt->findParam("MINOR"));
+    mDiskMajor = evt->major;
+    mDiskMinor = evt->minor;
 
     //+NATIVE_PLATFORM
     #ifdef FUNCTION_STORAGE_SUPPORT_CDROM
@@ -364,9 +381,8 @@ void DirectVolume::handleDiskAdded(const char *devpath, NetlinkEvent *evt) {
     #endif
     //-NATIVE_PLATFORM
 
-    const char *tmp = evt->findParam("NPARTS");
-    if (tmp) {
-        mDiskNumParts = atoi(tmp);
+    if (evt->hasNumParts()) {
+        mDiskNumParts = evt->nparts;
     } else {
         SLOGW("Kernel block uevent missing 'NPARTS'");
         mDiskNumParts = 1;
@@ -420,8 +436,7 @@ void DirectVolume::handleDiskAdded(const char *devpath, NetlinkEvent *evt) {
 #endif
         //===========================
         // For telechips
-        const char *devname = evt->findParam("DEVNAME");
-        if(devname && !strcmp(devname, "ndda")) {
+        if(!strcmp(evt->devname, "ndda")) {
             return;
 	    }
         //===========================
@@ -443,16 +458,14 @@ void DirectVolume::handleDiskAdded(const char *devpath, NetlinkEvent *evt) {
     }
 }
 
-void DirectVolume::handlePartitionAdded(const char *devpath, NetlinkEvent *evt) {
-    int major = atoi(evt->findParam("MAJOR"));
-    int minor = atoi(evt->findParam("MINOR"));
+void DirectVolume::handlePartitionAdded(const char *devpath, const BlockUevent *evt) {
+    int major = evt->major;
+    int minor = evt->minor;
 
     int part_num;
 
-    const char *tmp = evt->findParam("PARTN");
-
-    if (tmp) {
-        part_num = atoi(tmp);
+    if (evt->hasPartNum()) {
+        part_num = evt->partn;
     } else {
         SLOGW("Kernel block uevent missing 'PARTN'");
         part_num = 1;
@@ -526,18 +539,17 @@ void DirectVolume::handlePartitionAdded(const char *devpath, NetlinkEvent *evt)
     }
 }
 
-void DirectVolume::handleDiskChanged(const char *devpath, NetlinkEvent *evt) {
-    int major = atoi(evt->findParam("MAJOR"));
-    int minor = atoi(evt->findParam("MINOR"));
+void DirectVolume::handleDiskChanged(const char *devpath, const BlockUevent *evt) {
+    int major = evt->major;
+    int minor = evt->minor;
 
     if ((major != mDiskMajor) || (minor != mDiskMinor)) {
         return;
     }
 
     SLOGI("Volume %s disk has changed", getLabel());
-    const char *tmp = evt->findParam("NPARTS");
-    if (tmp) {
-        mDiskNumParts = atoi(tmp);
+    if (evt->hasNumParts()) {
+        mDiskNumParts = evt->nparts;
     } else {
         SLOGW("Kernel block uevent missing 'NPARTS'");
         mDiskNumParts = 1;
@@ -599,15 +611,15 @@ void DirectVolume::handleDiskChanged(const char *devpath, NetlinkEvent *evt) {
     }
 }
 
-void DirectVolume::handlePartitionChanged(const char *devpath, NetlinkEvent *evt) {
-    int major = atoi(evt->findParam("MAJOR"));
-    int minor = atoi(evt->findParam("MINOR"));
+void DirectVolume::handlePartitionChanged(const char *devpath, const BlockUevent *evt) {
+    int major = evt->major;
+    int minor = evt->minor;
     SLOGD("Volume %s %s partition %d:%d changed\n", getLabel(), getMountpoint(), major, minor);
 }
 
-void DirectVolume::handleDiskRemoved(const char *devpath, NetlinkEvent *evt) {
-    int major = atoi(evt->findParam("MAJOR"));
-    int minor = atoi(evt->findParam("MINOR"));
+void DirectVolume::handleDiskRemoved(const char *devpath, const BlockUevent *evt) {
+    int major = evt->major;
+    int minor = evt->minor;
     char msg[255];
     bool enabled;
 
@@ -697,9 +709,9 @@ void DirectVolume::handleDiskRemoved(const char *devpath, NetlinkEvent *evt) {
     //===========================
 }
 
-void DirectVolume::handlePartitionRemoved(const char *devpath, NetlinkEvent *evt) {
-    int major = atoi(evt->findParam("MAJOR"));
-    int minor = atoi(evt->findParam("MINOR"));
+void DirectVolume::handlePartitionRemoved(const char *devpath, const BlockUevent *evt) {
+    int major = evt->major;
+    int minor = evt->minor;
 //+NATIVE_PLATFORM
 #ifdef FUNCTION_STORAGE_FOR_AUTOMOTIVE
     SLOGD("Volume %s %s partition %d:%d removed\n", getLabel(), getMountpoint(), major, minor);
@@ -850,6 +862,7 @@ int DirectVolume::updateDeviceInfo(char *new_path, int new_major, int new_minor)
     }
 
     it = mPaths->begin();
+    mVm->getDevpathIndex()->remove(*it, this);
     free(*it); /* Free the string storage */
     mPaths->erase(it); /* Remove it from the list */
     addPath(new_path); /* Put the new path on the list */
@@ -963,13 +976,24 @@ int DirectVolume::getLargestPartitionIndex() {
     uint64_t maxSize = 0;
     //SLOGD("checking partition sizes...");
     //SLOGD("mDiskNumParts=%d", mDiskNumParts);
-    char nodepath[255];
+    char nodepaths[MAX_PARTITIONS][255];
+    const char *probePaths[MAX_PARTITIONS];
+    int numProbes = 0;
     for (i=0; i<MAX_PARTITIONS; i++) {
-        int minor = mPartMinors[i];
-        if (minor < 0) {
+        if (mPartMinors[i] < 0) {
             continue;
         }
-        snprintf(nodepath, sizeof(nodepath), VOLD_NODE_FORMAT, mDiskMajor, minor);
+        snprintf(nodepaths[i], sizeof(nodepaths[i]), VOLD_NODE_FORMAT, mDiskMajor, mPartMinors[i]);
+        probePaths[numProbes++] = nodepaths[i];
+    }
+    /* Read every partition at once; getVolumeSize() below hits the cache */
+    mVm->getProbeCache()->prefetch(probePaths, numProbes);
+
+    for (i=0; i<MAX_PARTITIONS; i++) {
+        if (mPartMinors[i] < 0) {
+            continue;
+        }
+        const char *nodepath = nodepaths[i];
         size = getVolumeSize(mFuseMountpoint, nodepath); // <- changed from mMountpoint for Kitkat
         if (size == 0) {
             continue;
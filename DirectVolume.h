@@ -62,7 +62,8 @@ public:
     const char *getMountpoint() { return mMountpoint; }
     const char *getFuseMountpoint() { return mFuseMountpoint; }
 
-    int handleBlockEvent(NetlinkEvent *evt);
+    int handleBlockEvent(const BlockUevent *evt);
+    int handleBlockEvent(const BlockUevent *evt, int pathIndex);
     dev_t getDiskDevice();
     dev_t getShareDevice();
     void handleVolumeShared();
@@ -82,12 +83,12 @@ protected:
     int isDecrypted() { return mIsDecrypted; }
 
 private:
-    void handleDiskAdded(const char *devpath, NetlinkEvent *evt);
-    void handleDiskRemoved(const char *devpath, NetlinkEvent *evt);
-    void handleDiskChanged(const char *devpath, NetlinkEvent *evt);
-    void handlePartitionAdded(const char *devpath, NetlinkEvent *evt);
-    void handlePartitionRemoved(const char *devpath, NetlinkEvent *evt);
-    void handlePartitionChanged(const char *devpath, NetlinkEvent *evt);
+    void handleDiskAdded(const char *devpath, const BlockUevent *evt);
+    void handleDiskRemoved(const char *devpath, const BlockUevent *evt);
+    void handleDiskChanged(const char *devpath, const BlockUevent *evt);
+    void handlePartitionAdded(const char *devpath, const BlockUevent *evt);
+    void handlePartitionRemoved(const char *devpath, const BlockUevent *evt);
+    void handlePartitionChanged(const char *devpath, const BlockUevent *evt);
 
     int doMountVfat(const char *deviceNode, const char *mountPoint);
 
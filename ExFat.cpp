@@ -39,18 +39,14 @@
 #include <cutils/properties.h>
 
 #include "ExFat.h"
+#include "FsProbe.h"
+#include "ToolRunner.h"
 
 static char MKEXFAT_PATH[] = "/system/bin/mkexfat";
 static char EXFATCK_PATH[] = "/system/bin/exfatck";
-static char EXFATINFO_PATH[] = "/sbin/exfatinfo";
-extern "C" int logwrap(int argc, const char **argv, int background);
 extern "C" int mount(const char *, const char *, const char *, unsigned long, const void *);
 
-#if !defined(min)
-#define min(a, b) (((a) < (b)) ? (a) : (b))
-#endif /* !defined(min) */
-
-static int runExfatck(const char *const fsPath)
+static int runExfatck(const char *const fsPath, ToolRunner *runner, bool *modified)
 {
     bool rw = true;
     if (access(EXFATCK_PATH, X_OK)) {
@@ -62,12 +58,24 @@ static int runExfatck(const char *const fsPath)
     int rc = 0;
     do {
         const char *args[4];
+        int status;
         args[0] = EXFATCK_PATH;
         args[1] = "-r";
         args[2] = fsPath;
         args[3] = NULL;
 
-        rc = logwrap(3, args, 1);
+        ToolRunner local;
+        if (!runner)
+            runner = &local;
+        runner->setBackground(true);
+        rc = runner->run(3, args, &status);
+        if (rc && errno == ETIMEDOUT)
+            return -1;
+        /* exfatck -r does not say whether it repaired anything */
+        if (rc == 0 && modified)
+            *modified = true;
+        if (rc == 0)
+            rc = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
 
         switch(rc) {
         case 0:
@@ -90,50 +98,25 @@ static int runExfatck(const char *const fsPath)
 }
 
 int ExFat::detect(const char *fsPath, bool *outResult) {
-    int retval = -1;
-
-    int fd = open(fsPath, O_RDONLY);
-    if (fd != -1) {
-        loff_t seek_res = lseek64(fd, 0, SEEK_SET);
-        if (seek_res == 0) {
-            char boot_sector[512];
-            ssize_t read_res = read(fd, boot_sector, 512);
-            if (read_res == 512) {
-                if (!memcmp(&boot_sector[3], "EXFAT   ", 8)) {
-                    SLOGI("exFAT filesystem detected.");
-                    *outResult = true;
-                }
-                else if (!memcmp(&boot_sector[0], "RRaAXFAT   ", 11)) {
-                    SLOGI("Corrupted exFAT filesystem detected. Fixing.");
-                    *outResult = true;
-                }
-                else {
-                    SLOGV("Filesystem detection failed (not an exFAT "
-                          "filesystem).");
-                    *outResult = false;
-                }
-
-                retval = 0;
-            }
-            else if (read_res != -1)
-                errno = EIO;
-        }
-        else if (seek_res != -1)
-            errno = EIO;
+    FsProbeResult probe;
 
-        close(fd);
-    }
+    if (FsProbe::probe(fsPath, &probe))
+        return -1;
 
-    return retval;
+    *outResult = (probe.type == FSTYPE_EXFAT);
+    return 0;
 }
 
-int ExFat::check(const char *fsPath) {
-    if(runExfatck(fsPath) != 0) {
-        /* Ignore return/errno value. We know it's exFAT, so any file system
-         * check/repair results should be considered a bonus. The driver should
-         * be able to mount the volume in any case and deal with inconsistencies
-         * appropriately. */
-        errno = 0;
+int ExFat::check(const char *fsPath, ToolRunner *runner, bool *modified) {
+    if(runExfatck(fsPath, runner, modified) != 0) {
+        /* A checker that ran out of time may have left it half repaired */
+        if (errno == ETIMEDOUT)
+            return -1;
+        /* We know it's exFAT, so the driver should be able to mount the
+         * volume in any case and deal with inconsistencies appropriately;
+         * but it did not pass, and must not be remembered as checked. */
+        errno = EUCLEAN;
+        return -1;
     }
 
     return 0;
@@ -224,7 +207,10 @@ int ExFat::format(const char *fsPath, unsigned int numSectors,
                   bool wholeDevice) {
     const char *args[6];
     int rc;
+    int status;
+    ToolRunner runner;
 
+    runner.setBackground(true);
     SLOGI("Formatting SDXC exFAT file system at \"%s\" as %s...", fsPath,
           wholeDevice ? "whole device" : "single partition");
 
@@ -256,13 +242,15 @@ int ExFat::format(const char *fsPath, unsigned int numSectors,
         args[3] = (const char*) tmp;
         args[4] = fsPath;
         args[5] = NULL;
-        rc = logwrap(6, args, 1);
+        rc = runner.run(5, args, &status);
     }
     else {
         args[2] = fsPath;
         args[3] = NULL;
-        rc = logwrap(4, args, 1);
+        rc = runner.run(3, args, &status);
     }
+    if (rc == 0)
+        rc = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
 
     if (rc == 0) {
         SLOGI("Filesystem formatted OK");
@@ -339,160 +327,32 @@ int ExFat::getInfo(const char *const fsPath, char *const label,
                    const size_t labelSize, int32_t *const id,
                    uint64_t *const fsSize)
 {
-    int err = 0;
-    bool needLabel = label != NULL;
-    bool needId = id != NULL;
-    bool needFsSize = fsSize != NULL;
-
-    size_t cmd_size = 0;
-    char *cmd = NULL;
-    FILE *fp = NULL;
-
-    cmd_size = 1 + strlen(EXFATINFO_PATH) + 3 + strlen(fsPath) + 2;
-    cmd = (char*) malloc(cmd_size);
-    if(!cmd) {
-        err = errno ? errno : ENOMEM;
-        SLOGE("Error while allocating %zu bytes for 'cmd' buffer: %d (%s)",
-              cmd_size, errno, strerror(errno));
-	goto out;
-    }
-
-    snprintf(cmd, cmd_size, "\"%s\" \"%s\"", EXFATINFO_PATH, fsPath);
+    FsProbeResult probe;
 
-    fp = popen(cmd, "r");
-    if (!fp) {
-        err = errno ? errno : EIO;
-        SLOGE("Error while invoking command '%s': %s (%d)",
-              cmd, strerror(errno), errno);
-        goto out;
+    if (FsProbe::probeExFatVolume(fsPath, &probe)) {
+        int err = errno ? errno : EIO;
+        SLOGE("Could not read exFAT boot region of %s: %s", fsPath,
+              strerror(err));
+        return err;
     }
 
-    char line[2048];
-    while (fgets(line, sizeof(line), fp) != NULL &&
-           (needLabel || needId || needFsSize))
-    {
-        static const char labelPrefix[] = "\tVolume name: \"";
-        static const char serialPrefix[] = "\tVolume serial number: ";
-        static const char volumeLengthPrefix[] = "\tVolume length: ";
-
-        const size_t lineLength = strlen(line) - 1;
-
-        if (needLabel && !strncmp(line, labelPrefix, sizeof(labelPrefix) - 1))
-        {
-            if (line[lineLength - 1] != '\"') {
-                SLOGE("Unexpected! Non-terminated volume name string: %.*s",
-                      (int) lineLength, line);
-                err = EINVAL;
-                goto out;
-            }
-
-            if (labelSize < (lineLength - 1) - (sizeof(labelPrefix) - 1) + 1)
-            {
-                SLOGE("Supplied label buffer is too small (%zu < %zu).",
-                      labelSize,
-                      (lineLength - 1) - (sizeof(labelPrefix) - 1) + 1);
-                err = ERANGE;
-                goto out;
-            }
-
-            /* Copy all except terminating '"' to label. */
-            strncpy(label, &line[sizeof(labelPrefix) - 1],
-                    min((lineLength - 1) - (sizeof(labelPrefix) - 1),
-                    labelSize - 1));
-            
-            if((lineLength - 1) - (sizeof(labelPrefix) - 1) < labelSize -1) // trim garbage string with chaging position of null
-                label[(lineLength - 1) - (sizeof(labelPrefix) - 1)] = '\0';
-            else
-                label[labelSize - 1] = '\0';
-
-            __replace(label, ' ', '_'); // replace space to '_' like vfat
-            needLabel = false;
-        }
-        else if (needId && !strncmp(line, serialPrefix,
-            sizeof(serialPrefix) - 1))
-        {
-            int serialHead = 0;
-            int serialTail = 0;
-
-            if (lineLength - (sizeof(serialPrefix) - 1) != 9) {
-                SLOGE("Unexpected serial number length: %zu (line: \"%.*s\")",
-                      lineLength - (sizeof(serialPrefix) - 1), (int) lineLength,
-                      line);
-                err = EINVAL;
-                goto out;
-            }
-
-            if (sscanf(&line[sizeof(serialPrefix) - 1], "%04X-%04X",
-                &serialHead, &serialTail) != 2)
-            {
-                SLOGE("Malformed serial number: %.*s",
-                      (int) (lineLength - (sizeof(serialPrefix) - 1)),
-                      &line[sizeof(serialPrefix) - 1]);
-                err = EINVAL;
-                goto out;
-            }
-
-            *id = (serialHead << 16) | serialTail;
-            needId = false;
-        }
-        else if (needFsSize && !strncmp(line, volumeLengthPrefix,
-            sizeof(volumeLengthPrefix) - 1))
-        {
-            unsigned long long value = 0;
-            if (sscanf(&line[sizeof(volumeLengthPrefix) - 1], "%*u sectors "
-                "(%llu bytes)", &value) != 1)
-            {
-                SLOGE("Malformed volume length string: %.*s",
-                      (int) (lineLength - (sizeof(volumeLengthPrefix) - 1)),
-                      &line[sizeof(volumeLengthPrefix) - 1]);
-                err = EINVAL;
-                goto out;
-            }
-
-            *fsSize = value;
-            needFsSize = false;
+    if (label != NULL) {
+        size_t labelLength = strlen(probe.label);
+        if (labelSize < labelLength + 1) {
+            SLOGE("Supplied label buffer is too small (%zu < %zu).",
+                  labelSize, labelLength + 1);
+            return ERANGE;
         }
+        memcpy(label, probe.label, labelLength + 1);
+        __replace(label, ' ', '_'); // replace space to '_' like vfat
     }
-
-    if (needLabel || needId || needFsSize) {
-        SLOGE("Could not parse the following information from exfatinfo "
-              "output:%s%s%s",
-              needLabel ? " 'volume name'" : "",
-              needId ? " 'volume serial number'" : "",
-              needFsSize ? " 'volume length'" : "");
-        err = EIO;
-        goto out;
+    if (id != NULL) {
+        *id = probe.id;
     }
-out:
-    int retval;
-    if (fp != NULL && (retval = pclose(fp)) != 0) {
-        if (retval == -1) {
-            err = err ? err : (errno ? errno : EIO);
-            SLOGE("Error while closing popen stream: %d (%s)", errno,
-                  strerror(errno));
-        }
-        else if (WIFEXITED(retval)) {
-            SLOGE("exfatinfo utility returned error code %d.",
-                  WEXITSTATUS(retval));
-            err = err ? err : EIO;
-        }
-        else if (WIFSIGNALED(retval)) {
-            SLOGE("exfatinfo utility exited abnormally due to signal %d.",
-                  WTERMSIG(retval));
-            err = err ? err : EIO;
-        }
-        else {
-            SLOGE("exfatinfo utility exited abnormally for an unknown reason "
-                  "(status: 0x%08X).", retval);
-            err = err ? err : EIO;
-        }
+    if (fsSize != NULL) {
+        *fsSize = probe.size;
     }
-
-    if (cmd) {
-        free(cmd);
-    }
-
-    return err;
+    return 0;
 }
 
 int getExFatInfo(const char *fsPath, char *label, size_t labelSize,
@@ -21,10 +21,12 @@
 #include <unistd.h>
 
 #if defined(__cplusplus)
+class ToolRunner;
+
 class ExFat {
 public:
     static int detect(const char *fsPath, bool *outResult);
-    static int check(const char *fsPath);
+    static int check(const char *fsPath, ToolRunner *runner = NULL, bool *modified = NULL);
     static int doMount(const char *fsPath, const char *mountPoint, bool ro,
                        bool remount, bool executable, int ownerUid,
                        int ownerGid, int permMask);
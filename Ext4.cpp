@@ -38,10 +38,10 @@
 #include <cutils/log.h>
 #include <cutils/properties.h>
 
-#include <logwrap/logwrap.h>
 
 #include "Ext4.h"
 #include "VoldUtil.h"
+#include "ToolRunner.h"
 
 #define MKEXT4FS_PATH "/system/bin/make_ext4fs";
 
@@ -78,10 +78,10 @@ int Ext4::format(const char *fsPath, const char *mountpoint) {
     args[2] = "-a";
     args[3] = mountpoint;
     args[4] = fsPath;
-    rc = android_fork_execvp(ARRAY_SIZE(args), (char **)args, &status, false,
-            true);
+    ToolRunner runner;
+    rc = runner.run(ARRAY_SIZE(args), args, &status);
     if (rc != 0) {
-        SLOGE("Filesystem (ext4) format failed due to logwrap error");
+        SLOGE("Filesystem (ext4) format could not run (%s)", strerror(errno));
         errno = EIO;
         return -1;
     }
@@ -40,10 +40,11 @@
 #include <cutils/log.h>
 #include <cutils/properties.h>
 
-#include <logwrap/logwrap.h>
 
 #include "Fat.h"
 #include "VoldUtil.h"
+#include "ToolRunner.h"
+#include "Filesystems.h"
 
 static char FSCK_MSDOS_PATH[] = "/system/bin/fsck_msdos";
 //+NATIVE_PLATFORM
@@ -56,28 +57,37 @@ static char MKDOSFS_PATH[] = "/system/bin/newfs_msdos";
 
 extern "C" int mount(const char *, const char *, const char *, unsigned long, const void *);
 
-int Fat::check(const char *fsPath) {
-    bool rw = true;
-    if (access(FSCK_MSDOS_PATH, X_OK)) {
+int Fat::check(const char *fsPath, ToolRunner *runner, bool *modified) {
+    return runCheck(FSCK_MSDOS_PATH, fsPath, runner, modified);
+}
+
+int Fat::runCheck(const char *fsckPath, const char *fsPath, ToolRunner *runner,
+                  bool *modified) {
+    if (access(fsckPath, X_OK)) {
         SLOGW("FAT: Skipping fs checks\n");
         return 0;
     }
 
+    /* One runner for every pass, so they share its deadline */
+    ToolRunner local;
+    if (!runner)
+        runner = &local;
+
     int pass = 1;
     int rc = 0;
-    do {
+    for (;;) {
         const char *args[4];
         int status;
-        args[0] = FSCK_MSDOS_PATH;
+        args[0] = fsckPath;
         args[1] = "-p";
         args[2] = "-f";
         args[3] = fsPath;
 
-        rc = android_fork_execvp(ARRAY_SIZE(args), (char **)args, &status,
-                false, true);
+        rc = runner->run(ARRAY_SIZE(args), args, &status);
         if (rc != 0) {
-            SLOGE("Filesystem check failed due to logwrap error");
-            errno = EIO;
+            SLOGE("Filesystem check could not run (%s)", strerror(errno));
+            if (errno != ETIMEDOUT)
+                errno = EIO;
             return -1;
         }
 
@@ -100,7 +110,9 @@ int Fat::check(const char *fsPath) {
             return -1;
 
         case 4:
-            if (pass++ <= 3) {
+            if (modified)
+                *modified = true;
+            if (pass++ <= MAX_RECHECKS) {
                 SLOGW("FAT: Filesystem modified - rechecking (pass %d)",
                         pass);
                 continue;
@@ -114,9 +126,18 @@ int Fat::check(const char *fsPath) {
             errno = EIO;
             return -1;
         }
-    } while (0);
+    }
+}
 
-    return 0;
+/* fsck_msdos prints no percentages, only "** Phase N - ..." of four */
+#define FSCK_MSDOS_PHASES 4
+
+int Fat::checkProgress(const char *line) {
+    int phase;
+
+    if (sscanf(line, "** Phase %d", &phase) == 1 && phase >= 1 && phase <= FSCK_MSDOS_PHASES)
+        return (phase - 1) * 100 / FSCK_MSDOS_PHASES;
+    return Filesystems::parsePercent(line);
 }
 
 int Fat::doMount(const char *fsPath, const char *mountPoint,
@@ -204,6 +225,7 @@ int Fat::format(const char *fsPath, unsigned int numSectors, bool wipe) {
     //-NATIVE_PLATFORM           
     int rc;
     int status;
+    ToolRunner runner;
 
     if (wipe) {
         Fat::wipe(fsPath, numSectors);
@@ -240,23 +262,20 @@ int Fat::format(const char *fsPath, unsigned int numSectors, bool wipe) {
         args[9] = fsPath;
         #endif
         //-NATIVE_PLATFORM        
-        rc = android_fork_execvp(ARRAY_SIZE(args), (char **)args, &status,
-                false, true);
+        rc = runner.run(ARRAY_SIZE(args), args, &status);
     } else {
         //+NATIVE_PLATFORM
         #ifdef FUNCTION_STORAGE_TUXERA_PATCH       
-        rc = android_fork_execvp(2, (char **)args, &status, false,
-                true);
+        rc = runner.run(2, args, &status);
         #else
         args[7] = fsPath;
+        rc = runner.run(8, args, &status);
         #endif
         //-NATIVE_PLATFORM        
-        rc = android_fork_execvp(8, (char **)args, &status, false,
-                true);
     }
 
     if (rc != 0) {
-        SLOGE("Filesystem format failed due to logwrap error");
+        SLOGE("Filesystem format could not run (%s)", strerror(errno));
         errno = EIO;
         return -1;
     }
@@ -19,9 +19,24 @@
 
 #include <unistd.h>
 
+class ToolRunner;
+
 class Fat {
 public:
-    static int check(const char *fsPath);
+    /* fsck_msdos passes after the first one that still modify the volume */
+    static const int MAX_RECHECKS = 3;
+
+    /*
+     * 'runner' carries the deadline and progress callback; NULL for none.
+     * A pass that repaired something is followed by another one, and
+     * sets 'modified'.
+     */
+    static int check(const char *fsPath, ToolRunner *runner = NULL, bool *modified = NULL);
+    /* check() with another fsck_msdos binary */
+    static int runCheck(const char *fsckPath, const char *fsPath, ToolRunner *runner,
+                        bool *modified = NULL);
+    /* Percentage done from a line of fsck_msdos output, or -1 */
+    static int checkProgress(const char *line);
     static int doMount(const char *fsPath, const char *mountPoint,
                        bool ro, bool remount, bool executable,
                        int ownerUid, int ownerGid, int permMask,
@@ -20,63 +20,242 @@
 #include "Ntfs.h"
 #include "ExFat.h"
 #include "Fat.h"
+#include "FsProbe.h"
+#include "VolumeManager.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 #include <errno.h>
 
-int Filesystems::detect(const char *fsPath, FSType *outFsType)
+#include <cutils/properties.h>
+
+/*
+ * Handlers with the registry signatures. Everything that differs between
+ * the filesystem classes (and between builds) is absorbed here.
+ */
+static int fatMount(const char *fsPath, const char *mountPoint, bool ro,
+                    bool remount, bool executable, int ownerUid,
+                    int ownerGid, int permMask, bool createLost)
+{
+    return Fat::doMount(fsPath, mountPoint, ro, remount, executable,
+                        ownerUid, ownerGid, permMask, createLost);
+}
+
+static int fatFormat(const char *fsPath, unsigned int numSectors, bool wipe)
 {
-    int err;
-    bool result = false;
+    return Fat::format(fsPath, numSectors, wipe);
+}
 
-    if ((err = HfsPlus::detect(fsPath, &result)) == 0 && result) {
-        *outFsType = FSTYPE_HFSPLUS;
-    }
-    else if ((err = Ntfs::detect(fsPath, &result)) == 0 && result) {
-        *outFsType = FSTYPE_NTFS;
-    }
-    else if ((err = ExFat::detect(fsPath, &result)) == 0 && result) {
-        *outFsType = FSTYPE_EXFAT;
+//+NATIVE_PLATFORM
+#ifdef FUNCTION_STORAGE_SUPPORT_NTFS
+static int ntfsMount(const char *fsPath, const char *mountPoint, bool ro,
+                     bool remount, bool executable, int ownerUid,
+                     int ownerGid, int permMask, bool createLost)
+{
+#ifdef FUNCTION_STORAGE_TUXERA_PATCH
+    return Ntfs::doMount(fsPath, mountPoint, ro, remount, executable,
+                         ownerUid, ownerGid, permMask);
+#else
+    return Ntfs::doMount(fsPath, mountPoint, ro, remount, executable,
+                         ownerUid, ownerGid, permMask, createLost);
+#endif
+}
+
+static int ntfsFormat(const char *fsPath, unsigned int numSectors, bool wipe)
+{
+    return Ntfs::format(fsPath, numSectors);
+}
+#define NTFS_CHECK  Ntfs::check
+#define NTFS_MOUNT  ntfsMount
+#define NTFS_FORMAT ntfsFormat
+#else
+#define NTFS_CHECK  NULL
+#define NTFS_MOUNT  NULL
+#define NTFS_FORMAT NULL
+#endif
+//-NATIVE_PLATFORM
+
+//+NATIVE_PLATFORM
+#ifdef FUNCTION_STORAGE_TUXERA_PATCH
+static int exfatMount(const char *fsPath, const char *mountPoint, bool ro,
+                      bool remount, bool executable, int ownerUid,
+                      int ownerGid, int permMask, bool createLost)
+{
+    return ExFat::doMount(fsPath, mountPoint, ro, remount, executable,
+                          ownerUid, ownerGid, permMask);
+}
+
+static int exfatFormat(const char *fsPath, unsigned int numSectors, bool wipe)
+{
+    return ExFat::format(fsPath, numSectors, false);
+}
+#define EXFAT_CHECK  ExFat::check
+#define EXFAT_MOUNT  exfatMount
+#define EXFAT_FORMAT exfatFormat
+#else
+#define EXFAT_CHECK  NULL
+#define EXFAT_MOUNT  NULL
+#define EXFAT_FORMAT NULL
+#endif
+//-NATIVE_PLATFORM
+
+// added exfat, ntfs to writable (2017.09.04)
+#ifdef FEATURE_ENABLE_NTFS_EXFAT_READWRITE
+#define NTFS_EXFAT_WRITABLE true
+#else
+#define NTFS_EXFAT_WRITABLE false
+#endif
+
+/*
+ * Probe order matters: FAT has no magic and is only validated through its
+ * BPB, so it goes last. HFS+ is recognised to be reported, never mounted.
+ * ISO9660 media are mounted through FuseFS on the cdrom mount point.
+ */
+static const FsDescriptor sFilesystems[] = {
+    { FSTYPE_HFSPLUS, "HFS+",    1024,  "H",       1, 1024 + 512,
+      FsProbe::probeHfsPlus, NULL, NULL, 0, NULL, NULL, false },
+    { FSTYPE_NTFS,    "NTFS",    3,     "NTFS    ", 8, 512,
+      FsProbe::probeNtfs, NTFS_CHECK, NULL, 300, NTFS_MOUNT, NTFS_FORMAT,
+      NTFS_EXFAT_WRITABLE },
+    { FSTYPE_EXFAT,   "EXFAT",   4,     "XFAT   ",  7, 512,
+      FsProbe::probeExFat, EXFAT_CHECK, NULL, 180, EXFAT_MOUNT, EXFAT_FORMAT,
+      NTFS_EXFAT_WRITABLE },
+    { FSTYPE_EXT4,    "EXT4",    1080,  "\x53\xef", 2, 2048,
+      FsProbe::probeExt4, NULL, NULL, 0, NULL, NULL, false },
+    { FSTYPE_ISO9660, "ISO9660", 32769, "CD001",    5, 64 * 1024,
+      FsProbe::probeIso9660, NULL, NULL, 0, NULL, NULL, false },
+    { FSTYPE_FAT,     "VFAT",    0,     NULL,       0, 512,
+      FsProbe::probeFat, Fat::check, Fat::checkProgress, 180, fatMount, fatFormat, true },
+};
+
+static const int sNumFilesystems = sizeof(sFilesystems) / sizeof(sFilesystems[0]);
+
+const FsDescriptor *Filesystems::getDescriptors(int *count)
+{
+    *count = sNumFilesystems;
+    return sFilesystems;
+}
+
+const FsDescriptor *Filesystems::lookup(FSType fsType)
+{
+    for (int i = 0; i < sNumFilesystems; i++) {
+        if (sFilesystems[i].type == fsType)
+            return &sFilesystems[i];
     }
-    else {
-        /* Until we implement reliable FAT detection code. */
-        *outFsType = FSTYPE_FAT;
+    return NULL;
+}
+
+size_t Filesystems::getProbeWindow()
+{
+    size_t window = 0;
+
+    for (int i = 0; i < sNumFilesystems; i++) {
+        if (sFilesystems[i].window > window)
+            window = sFilesystems[i].window;
     }
+    return window;
+}
+
+int Filesystems::detect(const char *fsPath, FSType *outFsType)
+{
+    FsProbeResult probe;
 
-    return 0; /* Always succeed since FAT is the default fallback. */
+    if (VolumeManager::Instance()->getProbeCache()->get(fsPath, &probe))
+        return -1;
+
+    *outFsType = probe.type;
+    return 0;
 }
 
 bool Filesystems::isSupported(FSType fsType)
 {
-    switch (fsType) {
-    case FSTYPE_HFSPLUS:
-        return false;
-    case FSTYPE_NTFS:
-        return true;
-    case FSTYPE_EXFAT:
-        return true;
-    case FSTYPE_FAT:
-        return true;
-    default:
-        return false;
-    }
+    const FsDescriptor *fs = lookup(fsType);
+
+    return fs && fs->doMount;
 }
 
-int Filesystems::check(FSType fsType, const char *fsPath)
+bool Filesystems::isWritable(FSType fsType)
 {
-    switch (fsType) {
-    case FSTYPE_HFSPLUS:
-        errno = ENODATA;
-        return -1;
-    case FSTYPE_NTFS:
-        return Ntfs::check(fsPath);
-    case FSTYPE_EXFAT:
-        return ExFat::check(fsPath);
-    case FSTYPE_FAT:
-        return Fat::check(fsPath);
-    default:
+    const FsDescriptor *fs = lookup(fsType);
+
+    return fs && fs->writable;
+}
+
+int Filesystems::check(FSType fsType, const char *fsPath, ToolRunner *runner,
+                       bool *modified)
+{
+    const FsDescriptor *fs = lookup(fsType);
+
+    if (!fs || !fs->check) {
         errno = ENODATA;
         return -1;
     }
+    return fs->check(fsPath, runner, modified);
+}
+
+int Filesystems::checkProgress(FSType fsType, const char *line)
+{
+    const FsDescriptor *fs = lookup(fsType);
+
+    if (fs && fs->checkProgress)
+        return fs->checkProgress(line);
+    return parsePercent(line);
+}
+
+int Filesystems::checkDeadline(FSType fsType)
+{
+    const FsDescriptor *fs = lookup(fsType);
+    char key[PROPERTY_KEY_MAX];
+    char value[PROPERTY_VALUE_MAX];
+    int i;
+
+    if (!fs)
+        return 0;
+
+    i = snprintf(key, sizeof(key), "tcc.vold.fsck.deadline.");
+    for (const char *p = fs->name; *p && i < (int) sizeof(key) - 1; p++)
+        key[i++] = tolower((unsigned char) *p);
+    key[i] = '\0';
+
+    property_get(key, value, "");
+    if (!value[0])
+        property_get("tcc.vold.fsck.deadline", value, "");
+    if (!value[0])
+        return fs->checkDeadline * 1000;
+    return atoi(value) > 0 ? atoi(value) * 1000 : 0;
+}
+
+int Filesystems::parsePercent(const char *line)
+{
+    const char *pct = strrchr(line, '%');
+
+    while (pct) {
+        const char *p = pct;
+        /* Skip a fraction */
+        while (p > line && isdigit((unsigned char) p[-1]))
+            p--;
+        if (p > line && p[-1] == '.' && p < pct) {
+            pct = p - 1;
+            p = pct;
+            while (p > line && isdigit((unsigned char) p[-1]))
+                p--;
+        }
+        if (p < pct) {
+            int percent = atoi(p);
+            return percent <= 100 ? percent : -1;
+        }
+
+        /* Not a number: an earlier '%' then */
+        const char *prev = NULL;
+        for (const char *q = line; q < pct; q++) {
+            if (*q == '%')
+                prev = q;
+        }
+        pct = prev;
+    }
+    return -1;
 }
 
 int Filesystems::doMount(FSType fsType, const char *fsPath,
@@ -84,37 +263,31 @@ int Filesystems::doMount(FSType fsType, const char *fsPath,
                          bool executable, int ownerUid, int ownerGid,
                          int permMask, bool createLost)
 {
-    switch (fsType) {
-    case FSTYPE_HFSPLUS:
+    const FsDescriptor *fs = lookup(fsType);
+
+    if (!fs || !fs->doMount) {
         errno = ENOTSUP;
         return -1;
-    case FSTYPE_NTFS:
-        return Ntfs::doMount(fsPath, mountPoint, ro, remount, executable,
-                             ownerUid, ownerGid, permMask);
-    case FSTYPE_EXFAT:
-        return ExFat::doMount(fsPath, mountPoint, ro, remount, executable,
-                              ownerUid, ownerGid, permMask);
-    case FSTYPE_FAT:
-        return Fat::doMount(fsPath, mountPoint, ro, remount, executable,
-                            ownerUid, ownerGid, permMask, createLost);
-    default:
+    }
+    return fs->doMount(fsPath, mountPoint, ro, remount, executable,
+                       ownerUid, ownerGid, permMask, createLost);
+}
+
+int Filesystems::format(FSType fsType, const char *fsPath,
+                        unsigned int numSectors, bool wipe)
+{
+    const FsDescriptor *fs = lookup(fsType);
+
+    if (!fs || !fs->format) {
         errno = ENOTSUP;
         return -1;
     }
+    return fs->format(fsPath, numSectors, wipe);
 }
 
 const char* Filesystems::fsName(FSType fsType)
 {
-    switch (fsType) {
-    case FSTYPE_FAT:
-        return "VFAT";
-    case FSTYPE_EXFAT:
-        return "EXFAT";
-    case FSTYPE_NTFS:
-        return "NTFS";
-    case FSTYPE_HFSPLUS:
-        return "HFS+";
-    default:
-        return "<unknown filesystem>";
-    }
+    const FsDescriptor *fs = lookup(fsType);
+
+    return fs ? fs->name : "<unknown filesystem>";
 }
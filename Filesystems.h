@@ -23,22 +23,93 @@ typedef enum {
     FSTYPE_EXFAT,
     FSTYPE_NTFS,
     FSTYPE_HFSPLUS,
+    FSTYPE_ISO9660,
+    FSTYPE_EXT4,
 } FSType;
 
+#if defined(__cplusplus)
+#include <stddef.h>
+#include <stdint.h>
+
+struct FsProbeResult;
+class ToolRunner;
+
+/*
+ * One entry of the filesystem registry. The probe engine scans the table
+ * in order: an entry whose magic does not match is skipped without calling
+ * its probe function (magicLen 0 means no fixed magic, always probe).
+ * Handlers are NULL for filesystems vold recognises but cannot check,
+ * mount or format in this build.
+ *
+ * checkProgress turns a line of checker output into a percentage (-1 if
+ * the line has none); NULL takes any "NN%" in the line. checkDeadline is
+ * how many seconds the checker gets before it is killed and the volume
+ * mounted read-only, 0 for no limit.
+ */
+struct FsDescriptor {
+    FSType       type;
+    const char  *name;
+    uint32_t     magicOffset;
+    const char  *magic;
+    uint32_t     magicLen;
+    /* Bytes from the start of the device the probe function looks at */
+    size_t       window;
+    bool       (*probe)(const uint8_t *buf, size_t len, FsProbeResult *result);
+    int        (*check)(const char *fsPath, ToolRunner *runner, bool *modified);
+    int        (*checkProgress)(const char *line);
+    int          checkDeadline;
+    int        (*doMount)(const char *fsPath, const char *mountPoint, bool ro,
+                          bool remount, bool executable, int ownerUid,
+                          int ownerGid, int permMask, bool createLost);
+    int        (*format)(const char *fsPath, unsigned int numSectors, bool wipe);
+    /* May be mounted read-write on removable media */
+    bool         writable;
+};
+
 class Filesystems {
 public:
     static int detect(const char *fsPath, FSType *outFsType);
 
     static bool isSupported(FSType fsType);
 
-    static int check(FSType fsType, const char *fsPath);
+    static bool isWritable(FSType fsType);
+
+    /*
+     * 0 if the filesystem passed. Otherwise -1 with errno ETIMEDOUT (killed
+     * at its deadline), ENODATA (not this filesystem after all), EUCLEAN
+     * (damage left behind, but safe to mount anyway) or EIO. 'modified' is
+     * set if the checker may have written to the volume, whatever it returns.
+     */
+    static int check(FSType fsType, const char *fsPath, ToolRunner *runner = NULL,
+                     bool *modified = NULL);
+
+    static int checkProgress(FSType fsType, const char *line);
+
+    /*
+     * In ms, 0 for none: tcc.vold.fsck.deadline.<name> (e.g. .vfat), else
+     * tcc.vold.fsck.deadline, in seconds; else the registry default.
+     */
+    static int checkDeadline(FSType fsType);
+
+    /* The last "NN%" or "NN.N%" in 'line', or -1 */
+    static int parsePercent(const char *line);
 
     static int doMount(FSType fsType, const char *fsPath,
                        const char *mountPoint, bool ro, bool remount,
                        bool executable, int ownerUid, int ownerGid,
                        int permMask, bool createLost);
 
+    static int format(FSType fsType, const char *fsPath,
+                      unsigned int numSectors, bool wipe);
+
     static const char* fsName(FSType fsType);
+
+    /* The registry, in probe order */
+    static const FsDescriptor *getDescriptors(int *count);
+    static const FsDescriptor *lookup(FSType fsType);
+    /* Largest window any probe needs, i.e. how much one probe reads */
+    static size_t getProbeWindow();
 };
+#endif /* defined(__cplusplus) */
 
 #endif
@@ -0,0 +1,904 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define LOG_TAG "Vold"
+
+#include <cutils/log.h>
+#include <openssl/md5.h>
+
+#include "FsProbe.h"
+
+static inline uint16_t le16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint64_t le64(const uint8_t *p) {
+    return le32(p) | ((uint64_t) le32(p + 4) << 32);
+}
+
+static inline uint16_t be16(const uint8_t *p) {
+    return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t be32(const uint8_t *p) {
+    return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* Copies a space/NUL padded on-disk string and strips the padding */
+static void copyPadded(char *dst, size_t dstSize, const uint8_t *src, size_t len) {
+    size_t n = len < dstSize - 1 ? len : dstSize - 1;
+
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+    while (n > 0 && (dst[n - 1] == ' ' || dst[n - 1] == '\0')) {
+        dst[--n] = '\0';
+    }
+}
+
+/* UCS-2/UTF-16 on-disk names to NUL terminated UTF-8, truncated to fit */
+static void utf16ToUtf8(char *dst, size_t dstSize, const uint8_t *src, size_t count,
+        bool bigEndian) {
+    size_t o = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        uint32_t c = bigEndian ? be16(src + 2 * i) : le16(src + 2 * i);
+        if (c == 0)
+            break;
+        if (c >= 0xd800 && c < 0xdc00 && i + 1 < count) {
+            uint32_t lo = bigEndian ? be16(src + 2 * i + 2) : le16(src + 2 * i + 2);
+            if (lo >= 0xdc00 && lo < 0xe000) {
+                c = 0x10000 + ((c - 0xd800) << 10) + (lo - 0xdc00);
+                i++;
+            }
+        }
+
+        char tmp[4];
+        size_t n;
+        if (c < 0x80) {
+            tmp[0] = c;
+            n = 1;
+        } else if (c < 0x800) {
+            tmp[0] = 0xc0 | (c >> 6);
+            tmp[1] = 0x80 | (c & 0x3f);
+            n = 2;
+        } else if (c < 0x10000) {
+            tmp[0] = 0xe0 | (c >> 12);
+            tmp[1] = 0x80 | ((c >> 6) & 0x3f);
+            tmp[2] = 0x80 | (c & 0x3f);
+            n = 3;
+        } else {
+            tmp[0] = 0xf0 | (c >> 18);
+            tmp[1] = 0x80 | ((c >> 12) & 0x3f);
+            tmp[2] = 0x80 | ((c >> 6) & 0x3f);
+            tmp[3] = 0x80 | (c & 0x3f);
+            n = 4;
+        }
+        if (o + n >= dstSize)
+            break;
+        memcpy(dst + o, tmp, n);
+        o += n;
+    }
+    dst[o] = '\0';
+}
+
+static bool readFully(int fd, void *buf, size_t len, off64_t offset) {
+    return pread64(fd, buf, len, offset) == (ssize_t) len;
+}
+
+/*
+ * HFS+/HFSX volume header at 1024. The UUID is derived from the 64 bit
+ * finder info id the same way blkid and Mac OS do (MD5 name based UUID).
+ */
+bool FsProbe::probeHfsPlus(const uint8_t *buf, size_t len, FsProbeResult *result) {
+    static const uint8_t hfsNamespace[16] = {
+        0xb3, 0xe2, 0x0f, 0x39, 0xf2, 0x92, 0x11, 0xd6,
+        0x97, 0xa4, 0x00, 0x30, 0x65, 0x43, 0xec, 0xac
+    };
+
+    if (len < 1024 + 512)
+        return false;
+
+    const uint8_t *vh = buf + 1024;
+    if (memcmp(vh, "H+\x00\x04", 4) && memcmp(vh, "HX\x00\x05", 4))
+        return false;
+
+    result->type = FSTYPE_HFSPLUS;
+    result->size = (uint64_t) be32(vh + 40) * be32(vh + 44);
+
+    const uint8_t *finderId = vh + 80 + 24;
+    if (memcmp(finderId, "\0\0\0\0\0\0\0\0", 8)) {
+        MD5_CTX ctx;
+        uint8_t md5[MD5_DIGEST_LENGTH];
+
+        MD5_Init(&ctx);
+        MD5_Update(&ctx, hfsNamespace, sizeof(hfsNamespace));
+        MD5_Update(&ctx, finderId, 8);
+        MD5_Final(md5, &ctx);
+        md5[6] = (md5[6] & 0x0f) | 0x30;
+        md5[8] = (md5[8] & 0x3f) | 0x80;
+        snprintf(result->uuid, sizeof(result->uuid),
+                "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+                md5[0], md5[1], md5[2], md5[3], md5[4], md5[5], md5[6], md5[7],
+                md5[8], md5[9], md5[10], md5[11], md5[12], md5[13], md5[14], md5[15]);
+        result->id = be32(finderId + 4);
+    }
+    return true;
+}
+
+/*
+ * Cluster and MFT record size of an NTFS boot sector, or false if the
+ * sector size, cluster size or record size is not one NTFS can have.
+ */
+static bool ntfsGeometry(const uint8_t *boot, uint32_t *clusterSize, uint32_t *recordSize) {
+    uint32_t bps = le16(boot + 0x0b);
+    uint32_t spc = boot[0x0d];
+    int8_t recordShift = (int8_t) boot[0x40];
+
+    if (bps < 256 || bps > 4096 || (bps & (bps - 1)))
+        return false;
+
+    /* Values above 0x80 encode a power of two for large clusters */
+    if (spc == 0 || (spc <= 0x80 && (spc & (spc - 1))) || (spc > 0x80 && 256 - spc > 16))
+        return false;
+    *clusterSize = spc <= 0x80 ? bps * spc : bps << (256 - spc);
+
+    /* Positive: clusters per record, negative: log2 of the size in bytes */
+    if (recordShift > 0)
+        *recordSize = recordShift * *clusterSize;
+    else if (recordShift >= -31)
+        *recordSize = 1U << -recordShift;
+    else
+        return false;
+    return *recordSize >= 256 && *recordSize <= 65536 && !(*recordSize & (*recordSize - 1));
+}
+
+bool FsProbe::probeNtfs(const uint8_t *buf, size_t len, FsProbeResult *result) {
+    uint32_t clusterSize, recordSize;
+
+    if (len < 512 || memcmp(buf + 3, "NTFS    ", 8))
+        return false;
+    if (!ntfsGeometry(buf, &clusterSize, &recordSize)) {
+        SLOGW("NTFS boot sector with invalid geometry");
+        return false;
+    }
+
+    uint64_t serial = le64(buf + 0x48);
+
+    result->type = FSTYPE_NTFS;
+    result->size = le64(buf + 0x28) * le16(buf + 0x0b);
+    /* vold has always reported the upper half of the serial */
+    result->id = (int32_t) (serial >> 32);
+    snprintf(result->uuid, sizeof(result->uuid), "%016llX", (unsigned long long) serial);
+    return true;
+}
+
+bool FsProbe::probeExFat(const uint8_t *buf, size_t len, FsProbeResult *result) {
+    if (len < 512)
+        return false;
+
+    if (memcmp(buf + 3, "EXFAT   ", 8)) {
+        if (memcmp(buf, "RRaAXFAT   ", 11))
+            return false;
+        SLOGI("Corrupted exFAT filesystem detected.");
+    }
+
+    uint32_t serial = le32(buf + 0x64);
+
+    result->type = FSTYPE_EXFAT;
+    /* VolumeFlags: VolumeDirty or MediaFailure */
+    result->state = (le16(buf + 0x6a) & 0x0006) ? FSSTATE_DIRTY : FSSTATE_CLEAN;
+    if (buf[0x6c] < 32)
+        result->size = le64(buf + 0x48) << buf[0x6c];
+    result->id = (int32_t) serial;
+    snprintf(result->uuid, sizeof(result->uuid), "%04X-%04X",
+            serial >> 16, serial & 0xffff);
+    return true;
+}
+
+/* ext2/3/4 superblock at 1024; vold only cares that it is an ext filesystem */
+bool FsProbe::probeExt4(const uint8_t *buf, size_t len, FsProbeResult *result) {
+    if (len < 1024 + 1024)
+        return false;
+
+    const uint8_t *sb = buf + 1024;
+    if (le16(sb + 0x38) != 0xef53)
+        return false;
+
+    uint64_t blocks = le32(sb + 0x04);
+    uint32_t logBlockSize = le32(sb + 0x18);
+    /* INCOMPAT_64BIT: blocks_count_hi is valid */
+    if (le32(sb + 0x60) & 0x80)
+        blocks |= (uint64_t) le32(sb + 0x150) << 32;
+
+    const uint8_t *u = sb + 0x68;
+    result->type = FSTYPE_EXT4;
+    if (logBlockSize < 22)
+        result->size = blocks * ((uint64_t) 1024 << logBlockSize);
+    result->id = (int32_t) be32(u);
+    snprintf(result->uuid, sizeof(result->uuid),
+            "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+            u[0], u[1], u[2], u[3], u[4], u[5], u[6], u[7],
+            u[8], u[9], u[10], u[11], u[12], u[13], u[14], u[15]);
+    copyPadded(result->label, sizeof(result->label), sb + 0x78, 16);
+    return true;
+}
+
+/* Primary volume descriptor in logical sector 16 (2048 byte sectors) */
+bool FsProbe::probeIso9660(const uint8_t *buf, size_t len, FsProbeResult *result) {
+    const size_t pvdOffset = 16 * 2048;
+
+    if (len < pvdOffset + 2048)
+        return false;
+
+    const uint8_t *pvd = buf + pvdOffset;
+    if (pvd[0] != 1 || memcmp(pvd + 1, "CD001", 5) || pvd[6] != 1)
+        return false;
+
+    result->type = FSTYPE_ISO9660;
+    result->size = (uint64_t) le32(pvd + 80) * le16(pvd + 128);
+    copyPadded(result->label, sizeof(result->label), pvd + 40, 32);
+
+    /* A Joliet supplementary descriptor carries the untruncated UCS-2 label */
+    for (size_t off = pvdOffset + 2048; off + 2048 <= len; off += 2048) {
+        const uint8_t *vd = buf + off;
+        if (memcmp(vd + 1, "CD001", 5) || vd[0] == 255)
+            break;
+        if (vd[0] == 2 && vd[88] == '%' && vd[89] == '/' &&
+                (vd[90] == '@' || vd[90] == 'C' || vd[90] == 'E')) {
+            char joliet[FSPROBE_LABEL_SIZE];
+            utf16ToUtf8(joliet, sizeof(joliet), vd + 40, 16, true);
+            size_t n = strlen(joliet);
+            while (n > 0 && joliet[n - 1] == ' ')
+                joliet[--n] = '\0';
+            if (n)
+                strcpy(result->label, joliet);
+            break;
+        }
+    }
+
+    /* Same checksum getIsoInfo() has always used as the id */
+    union {
+        uint8_t bytes[4];
+        uint32_t id;
+    } checksum;
+    const uint8_t *data = pvd;
+    size_t count = 2048;
+    checksum.id = 0;
+    while (count--) {
+        checksum.bytes[count & 0x03] += *data++;
+    }
+    result->id = (int32_t) checksum.id;
+
+    /* Creation date, "YYYYMMDDHHMMSScc" */
+    const uint8_t *d = pvd + 813;
+    if (d[0] >= '0' && d[0] <= '9') {
+        snprintf(result->uuid, sizeof(result->uuid),
+                "%.4s-%.2s-%.2s-%.2s-%.2s-%.2s-%.2s",
+                d, d + 4, d + 6, d + 8, d + 10, d + 12, d + 14);
+    }
+    return true;
+}
+
+/*
+ * Recognises FAT12/16/32 by validating the BIOS parameter block rather
+ * than trusting the (optional) type string, so random data, partition
+ * tables and unformatted media are turned away without running fsck.
+ */
+bool FsProbe::probeFat(const uint8_t *buf, size_t len, FsProbeResult *result) {
+    if (len < 512)
+        return false;
+
+    /* Short or near jump to the boot code */
+    if (buf[0] != 0xeb && buf[0] != 0xe9)
+        return false;
+
+    uint32_t bps = le16(buf + 0x0b);
+    uint32_t spc = buf[0x0d];
+    uint32_t reserved = le16(buf + 0x0e);
+    uint32_t fats = buf[0x10];
+    uint32_t rootEntries = le16(buf + 0x11);
+    uint32_t media = buf[0x15];
+    uint32_t fatLength = le16(buf + 0x16);
+
+    if (bps < 512 || bps > 4096 || (bps & (bps - 1)))
+        return false;
+    if (spc == 0 || (spc & (spc - 1)))
+        return false;
+    if (reserved == 0 || fats == 0 || fats > 2)
+        return false;
+    if (media != 0xf0 && media < 0xf8)
+        return false;
+
+    uint32_t sectors = le16(buf + 0x13);
+    if (sectors == 0)
+        sectors = le32(buf + 0x20);
+    if (sectors == 0)
+        return false;
+
+    bool fat32 = (fatLength == 0);
+    const uint8_t *ext;
+    if (fat32) {
+        fatLength = le32(buf + 0x24);
+        if (fatLength == 0 || rootEntries != 0 || le32(buf + 0x2c) < 2)
+            return false;
+        ext = buf + 0x40;
+        if (ext[2] != 0x29 && ext[2] != 0x28 && memcmp(buf + 0x52, "FAT32   ", 8))
+            return false;
+    } else {
+        if (rootEntries == 0 || (rootEntries * 32) % bps)
+            return false;
+        ext = buf + 0x24;
+        if (ext[2] != 0x29 && ext[2] != 0x28 && memcmp(buf + 0x36, "FAT", 3))
+            return false;
+    }
+
+    /* The metadata has to leave room for at least one cluster */
+    uint64_t meta = reserved + (uint64_t) fats * fatLength + rootEntries * 32 / bps;
+    if (meta + spc > sectors)
+        return false;
+
+    result->type = FSTYPE_FAT;
+    result->size = (uint64_t) sectors * bps;
+
+    /* Serial (0x28) and label (0x29) come with the extended boot signature */
+    if (ext[2] == 0x28 || ext[2] == 0x29) {
+        uint32_t serial = le32(ext + 0x03);
+
+        result->id = (int32_t) serial;
+        snprintf(result->uuid, sizeof(result->uuid), "%04X-%04X",
+                serial >> 16, serial & 0xffff);
+    }
+    if (ext[2] == 0x29) {
+        copyPadded(result->label, sizeof(result->label), ext + 0x07, 11);
+        if (!strcmp(result->label, "NO NAME"))
+            result->label[0] = '\0';
+    }
+    return true;
+}
+
+int FsProbe::probeBuffer(const uint8_t *buf, size_t len, FsProbeResult *result) {
+    int count;
+    const FsDescriptor *fs = Filesystems::getDescriptors(&count);
+
+    memset(result, 0, sizeof(*result));
+    result->type = FSTYPE_UNRECOGNIZED;
+    result->id = -1;
+
+    for (int i = 0; i < count; i++, fs++) {
+        if (fs->magicLen && (fs->magicOffset + fs->magicLen > len ||
+                memcmp(buf + fs->magicOffset, fs->magic, fs->magicLen)))
+            continue;
+        if (fs->probe(buf, len, result)) {
+            SLOGD("Probe: %s size=%llu id=%08x uuid=%s label=%s", fs->name,
+                    result->size, result->id, result->uuid, result->label);
+            break;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Follows a FAT32/exFAT cluster chain. The FAT is read FAT_WINDOW bytes at
+ * a time and kept, so a chain of neighbouring clusters (the normal case
+ * for a root directory) costs one read per 1024 clusters rather than one
+ * per cluster.
+ */
+class FatChain {
+public:
+    static const size_t FAT_WINDOW = 4096;
+
+    FatChain(int fd, off64_t fatStart) {
+        mFd = fd;
+        mFatStart = fatStart;
+        mCached = -1;
+    }
+
+    /* Next cluster, or 0 if the FAT could not be read */
+    uint32_t next(uint32_t cluster) {
+        off64_t pos = (off64_t) cluster * 4;
+        off64_t window = pos & ~((off64_t) FAT_WINDOW - 1);
+
+        if (window != mCached) {
+            if (!readFully(mFd, mBuf, FAT_WINDOW, mFatStart + window))
+                return 0;
+            mCached = window;
+        }
+        return le32(mBuf + (pos - window));
+    }
+
+private:
+    int     mFd;
+    off64_t mFatStart;
+    off64_t mCached;
+    uint8_t mBuf[FAT_WINDOW];
+};
+
+int FsProbe::findFatRootLabel(int fd, const uint8_t *boot, char *label, size_t size) {
+    uint32_t bps = le16(boot + 0x0b);
+    uint32_t spc = boot[0x0d];
+    uint32_t reserved = le16(boot + 0x0e);
+    uint32_t fats = boot[0x10];
+    uint32_t rootEntries = le16(boot + 0x11);
+    uint32_t fatLength = le16(boot + 0x16);
+
+    if (fatLength == 0)
+        fatLength = le32(boot + 0x24);
+    if (bps < 512 || bps > 4096 || (bps & (bps - 1)) || spc == 0 || spc > 128)
+        return -1;
+
+    uint64_t rootStart = ((uint64_t) reserved + (uint64_t) fats * fatLength) * bps;
+    size_t chunk = rootEntries ? rootEntries * 32 : bps * spc;
+    uint8_t *dir = (uint8_t *) malloc(chunk);
+    if (!dir)
+        return -1;
+
+    FatChain chain(fd, (off64_t) reserved * bps);
+    uint32_t cluster = rootEntries ? 0 : le32(boot + 0x2c);
+    size_t scanned = 0;
+    int rc = -1;
+
+    while (scanned < MAX_ROOT_DIR_SIZE) {
+        off64_t offset = rootStart;
+        if (cluster)
+            offset += (off64_t) (cluster - 2) * chunk;
+        if (!readFully(fd, dir, chunk, offset))
+            break;
+        scanned += chunk;
+
+        bool done = false;
+        for (size_t i = 0; i + 32 <= chunk; i += 32) {
+            const uint8_t *e = dir + i;
+            if (e[0] == 0x00) {
+                done = true;
+                break;
+            }
+            if (e[0] == 0xe5 || (e[11] & 0x3f) == 0x0f)
+                continue;
+            if ((e[11] & 0x18) == 0x08) {
+                copyPadded(label, size, e, 11);
+                rc = 0;
+                done = true;
+                break;
+            }
+        }
+        if (done || !cluster)
+            break;
+
+        cluster = chain.next(cluster) & 0x0fffffff;
+        if (cluster < 2 || cluster >= 0x0ffffff8)
+            break;
+    }
+    free(dir);
+    return rc;
+}
+
+/* FAT12/16/32 from the cluster count, as the spec defines it */
+static int fatBits(const uint8_t *boot) {
+    uint32_t bps = le16(boot + 0x0b);
+    uint32_t fatLength = le16(boot + 0x16);
+    uint32_t sectors = le16(boot + 0x13);
+
+    if (fatLength == 0)
+        return 32;
+    if (sectors == 0)
+        sectors = le32(boot + 0x20);
+
+    uint64_t meta = le16(boot + 0x0e) + (uint64_t) boot[0x10] * fatLength +
+            (le16(boot + 0x11) * 32 + bps - 1) / bps;
+    uint64_t clusters = (sectors - meta) / boot[0x0d];
+    return clusters < 4085 ? 12 : 16;
+}
+
+/*
+ * FAT16/32 keep "clean shutdown" and "no hard error" bits in FAT[1] which
+ * the driver clears while mounted; Linux and Windows also set bit 0 of the
+ * reserved byte after the drive number. FAT12 has neither.
+ */
+void FsProbe::readFatState(int fd, const uint8_t *boot, FsProbeResult *result) {
+    uint8_t fat[8];
+    int bits = fatBits(boot);
+    const uint8_t *ext = boot + (bits == 32 ? 0x40 : 0x24);
+
+    if (bits == 12)
+        return;
+    if (!readFully(fd, fat, sizeof(fat), (off64_t) le16(boot + 0x0e) * le16(boot + 0x0b)))
+        return;
+
+    bool clean;
+    if (bits == 32) {
+        uint32_t flags = le32(fat + 4);
+        clean = (flags & 0x08000000) && (flags & 0x04000000);
+    } else {
+        uint32_t flags = le16(fat + 2);
+        clean = (flags & 0x8000) && (flags & 0x4000);
+    }
+    if (ext[1] & 0x01)
+        clean = false;
+    result->state = clean ? FSSTATE_CLEAN : FSSTATE_DIRTY;
+}
+
+/*
+ * The volume label is a root directory entry with the volume id attribute;
+ * blkid prefers it over the copy in the boot sector.
+ */
+void FsProbe::readFatLabel(int fd, const uint8_t *boot, FsProbeResult *result) {
+    char label[12];
+
+    if (!findFatRootLabel(fd, boot, label, sizeof(label)))
+        strcpy(result->label, strcmp(label, "NO NAME") ? label : "");
+}
+
+static inline uint32_t exFatSum(uint32_t sum, uint8_t b) {
+    return ((sum << 31) | (sum >> 1)) + b;
+}
+
+/*
+ * The sum is a rotate-and-add chain, so it cannot be split across lanes;
+ * what can go is the per-byte test for the excluded fields. Those
+ * (VolumeFlags at 106-107 and PercentInUse at 112, which change at run
+ * time) only exist in sector 0, so that sector is done in three runs and
+ * sectors 1-10 in an unrolled loop with no branches.
+ */
+uint32_t FsProbe::exFatBootChecksum(const uint8_t *region, size_t sectorSize) {
+    uint32_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < 106; i++)
+        sum = exFatSum(sum, region[i]);
+    for (i = 108; i < 112; i++)
+        sum = exFatSum(sum, region[i]);
+    for (i = 113; i < sectorSize; i++)
+        sum = exFatSum(sum, region[i]);
+
+    const uint8_t *p = region + sectorSize;
+    const uint8_t *end = region + 11 * sectorSize;
+    for (; p < end; p += 8) {
+        sum = exFatSum(sum, p[0]);
+        sum = exFatSum(sum, p[1]);
+        sum = exFatSum(sum, p[2]);
+        sum = exFatSum(sum, p[3]);
+        sum = exFatSum(sum, p[4]);
+        sum = exFatSum(sum, p[5]);
+        sum = exFatSum(sum, p[6]);
+        sum = exFatSum(sum, p[7]);
+    }
+    return sum;
+}
+
+/* Label is the 0x83 entry in the root directory, up to 11 UTF-16 chars */
+void FsProbe::readExFatLabel(int fd, const uint8_t *boot, FsProbeResult *result) {
+    uint32_t fatOffset = le32(boot + 0x50);
+    uint32_t heapOffset = le32(boot + 0x58);
+    uint32_t cluster = le32(boot + 0x60);
+    uint32_t sectorShift = boot[0x6c];
+    uint32_t clusterShift = sectorShift + boot[0x6d];
+
+    if (sectorShift < 9 || sectorShift > 12 || clusterShift > 25)
+        return;
+
+    size_t clusterSize = (size_t) 1 << clusterShift;
+    uint8_t *dir = (uint8_t *) malloc(clusterSize);
+    if (!dir)
+        return;
+
+    FatChain chain(fd, (off64_t) fatOffset << sectorShift);
+    for (size_t scanned = 0; scanned < MAX_ROOT_DIR_SIZE; scanned += clusterSize) {
+        if (cluster < 2 || cluster >= 0xfffffff7)
+            break;
+
+        off64_t offset = ((off64_t) heapOffset << sectorShift) +
+                ((off64_t) (cluster - 2) << clusterShift);
+        if (!readFully(fd, dir, clusterSize, offset))
+            break;
+
+        for (size_t i = 0; i + 32 <= clusterSize; i += 32) {
+            const uint8_t *e = dir + i;
+            if (e[0] == 0x00)
+                goto out;
+            if (e[0] == 0x83) {
+                utf16ToUtf8(result->label, sizeof(result->label), e + 2,
+                        e[1] < 11 ? e[1] : 11, false);
+                goto out;
+            }
+        }
+
+        cluster = chain.next(cluster);
+    }
+out:
+    free(dir);
+}
+
+/*
+ * Label is the $VOLUME_NAME attribute of MFT record 3 ($Volume), the clean
+ * state the dirty flag of its $VOLUME_INFORMATION.
+ */
+void FsProbe::readNtfsLabel(int fd, const uint8_t *boot, FsProbeResult *result) {
+    uint32_t clusterSize, recordSize;
+
+    if (!ntfsGeometry(boot, &clusterSize, &recordSize) || recordSize < 512)
+        return;
+
+    uint8_t *rec = (uint8_t *) malloc(recordSize);
+    if (!rec)
+        return;
+
+    off64_t offset = (off64_t) le64(boot + 0x30) * clusterSize + 3 * recordSize;
+    if (!readFully(fd, rec, recordSize, offset) || memcmp(rec, "FILE", 4))
+        goto out;
+
+    {
+        /* Undo the multi sector transfer protection fixups */
+        uint32_t usaOffset = le16(rec + 0x04);
+        uint32_t usaCount = le16(rec + 0x06);
+        if (usaOffset + usaCount * 2 > recordSize || (usaCount - 1) * 512 > recordSize)
+            goto out;
+        for (uint32_t i = 1; i < usaCount; i++) {
+            memcpy(rec + i * 512 - 2, rec + usaOffset + i * 2, 2);
+        }
+
+        uint32_t inUse = le32(rec + 0x18);
+        if (inUse > recordSize)
+            inUse = recordSize;
+
+        uint32_t off = le16(rec + 0x14);
+        while (off + 24 <= inUse) {
+            const uint8_t *attr = rec + off;
+            uint32_t type = le32(attr);
+            uint32_t len = le32(attr + 4);
+            if (type == 0xffffffff || len < 24 || off + len > inUse)
+                break;
+            if (type == 0x60 && attr[8] == 0) {
+                uint32_t valueLen = le32(attr + 0x10);
+                uint32_t valueOffset = le16(attr + 0x14);
+                if (valueOffset + valueLen <= len) {
+                    utf16ToUtf8(result->label, sizeof(result->label), attr + valueOffset,
+                            valueLen / 2, false);
+                }
+            }
+            /* $VOLUME_INFORMATION follows the name; flag 0x0001 is "dirty" */
+            if (type == 0x70 && attr[8] == 0) {
+                uint32_t valueLen = le32(attr + 0x10);
+                uint32_t valueOffset = le16(attr + 0x14);
+                if (valueLen >= 12 && valueOffset + valueLen <= len) {
+                    result->state = (le16(attr + valueOffset + 0x0a) & 0x0001) ?
+                            FSSTATE_DIRTY : FSSTATE_CLEAN;
+                }
+                break;
+            }
+            off += len;
+        }
+    }
+out:
+    free(rec);
+}
+
+/*
+ * The volume name is the name of the root folder, which is the key of the
+ * first record in the first leaf node of the catalog B-tree.
+ */
+void FsProbe::readHfsPlusLabel(int fd, const uint8_t *vh, FsProbeResult *result) {
+    uint32_t blockSize = be32(vh + 40);
+    const uint8_t *extent = vh + 0x110 + 16;
+    uint64_t catalogStart = (uint64_t) be32(extent) * blockSize;
+    uint64_t catalogLen = (uint64_t) be32(extent + 4) * blockSize;
+    uint8_t header[512];
+
+    if (blockSize < 512 || (blockSize & (blockSize - 1)))
+        return;
+    if (!readFully(fd, header, sizeof(header), catalogStart))
+        return;
+
+    uint32_t firstLeaf = be32(header + 14 + 10);
+    uint32_t nodeSize = be16(header + 14 + 18);
+    if (nodeSize < 512 || nodeSize > 32768 || (uint64_t) (firstLeaf + 1) * nodeSize > catalogLen)
+        return;
+
+    uint8_t *node = (uint8_t *) malloc(nodeSize);
+    if (!node)
+        return;
+    if (readFully(fd, node, nodeSize, catalogStart + (uint64_t) firstLeaf * nodeSize) &&
+            node[8] == 0xff && be16(node + 10) > 0) {
+        uint32_t recOffset = be16(node + nodeSize - 2);
+        if (recOffset + 8 <= nodeSize) {
+            const uint8_t *key = node + recOffset;
+            uint32_t nameLen = be16(key + 6);
+            if (be32(key + 2) == 1 && recOffset + 8 + nameLen * 2 <= nodeSize)
+                utf16ToUtf8(result->label, sizeof(result->label), key + 8, nameLen, true);
+        }
+    }
+    free(node);
+}
+
+int FsProbe::probeFd(int fd, bool deep, FsProbeResult *result,
+        ShallowCallback cb, void *cookie) {
+    void *buf;
+    int rc = -1;
+
+    size_t window = Filesystems::getProbeWindow();
+
+    if (posix_memalign(&buf, 4096, window)) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* Partitions smaller than the window just give a short read */
+    ssize_t n = pread64(fd, buf, window, 0);
+    if (n < 512) {
+        if (n >= 0)
+            errno = EIO;
+    } else {
+        const uint8_t *b = (const uint8_t *) buf;
+        rc = probeBuffer(b, n, result);
+        if (deep && !rc && cb && cb(cookie, fd, b, n, result))
+            deep = false;
+        if (deep) {
+            switch (result->type) {
+            case FSTYPE_FAT:
+                readFatLabel(fd, b, result);
+                readFatState(fd, b, result);
+                break;
+            case FSTYPE_EXFAT:
+                readExFatLabel(fd, b, result);
+                break;
+            case FSTYPE_NTFS:
+                readNtfsLabel(fd, b, result);
+                break;
+            case FSTYPE_HFSPLUS:
+                readHfsPlusLabel(fd, b + 1024, result);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    free(buf);
+    return rc;
+}
+
+int FsProbe::probe(const char *devPath, FsProbeResult *result) {
+    int fd = open(devPath, O_RDONLY);
+    if (fd < 0) {
+        SLOGE("Probe: cannot open %s (%s)", devPath, strerror(errno));
+        return -1;
+    }
+
+    int rc = probeFd(fd, false, result);
+    if (rc)
+        SLOGE("Probe: cannot read %s (%s)", devPath, strerror(errno));
+    close(fd);
+    return rc;
+}
+
+int FsProbe::probeExFatVolume(const char *devPath, FsProbeResult *result) {
+    uint8_t boot[512];
+
+    memset(result, 0, sizeof(*result));
+    result->type = FSTYPE_UNRECOGNIZED;
+    result->id = -1;
+
+    int fd = open(devPath, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (!readFully(fd, boot, sizeof(boot), 0)) {
+        close(fd);
+        return -1;
+    }
+    if (!probeExFat(boot, sizeof(boot), result) || boot[0x6c] < 9 || boot[0x6c] > 12) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Main boot region: 11 sectors covered by the checksum sector after them */
+    size_t sectorSize = (size_t) 1 << boot[0x6c];
+    uint8_t *region = (uint8_t *) malloc(12 * sectorSize);
+    if (!region) {
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    if (!readFully(fd, region, 12 * sectorSize, 0)) {
+        free(region);
+        close(fd);
+        return -1;
+    }
+
+    uint32_t sum = exFatBootChecksum(region, sectorSize);
+    const uint8_t *stored = region + 11 * sectorSize;
+    for (size_t i = 0; i < sectorSize; i += 4) {
+        if (le32(stored + i) != sum) {
+            SLOGW("exFAT boot checksum mismatch on %s (%08x != %08x)", devPath,
+                    le32(stored + i), sum);
+            free(region);
+            close(fd);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    readExFatLabel(fd, region, result);
+    free(region);
+    close(fd);
+    return 0;
+}
+
+int FsProbe::probeMetadata(const char *devPath, FsProbeResult *result,
+        ShallowCallback cb, void *cookie) {
+    int fd = open(devPath, O_RDONLY);
+    if (fd < 0) {
+        SLOGE("Probe: cannot open %s (%s)", devPath, strerror(errno));
+        return -1;
+    }
+
+    int rc = probeFd(fd, true, result, cb, cookie);
+    if (rc)
+        SLOGE("Probe: cannot read %s (%s)", devPath, strerror(errno));
+    close(fd);
+    return rc;
+}
+
+int fatRootLabel(const char *devPath, char *label, size_t size)
+{
+    uint8_t boot[512];
+    int rc = -1;
+
+    int fd = open(devPath, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (readFully(fd, boot, sizeof(boot), 0))
+        rc = FsProbe::findFatRootLabel(fd, boot, label, size);
+    close(fd);
+    return rc;
+}
+
+int readFatBootInfo(const char *devPath, FatBootInfo *info)
+{
+    uint8_t boot[512];
+    FsProbeResult r;
+
+    memset(info, 0, sizeof(*info));
+    info->id = -1;
+
+    int fd = open(devPath, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (!readFully(fd, boot, sizeof(boot), 0)) {
+        close(fd);
+        return -1;
+    }
+    /* probeFat() leaves id/label alone without an extended boot signature */
+    memset(&r, 0, sizeof(r));
+    r.id = -1;
+    if (!FsProbe::probeFat(boot, sizeof(boot), &r)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    info->fatBits = fatBits(boot);
+    info->size = r.size;
+    info->id = r.id;
+
+    /* Same preference as blkid: root directory entry, then boot sector */
+    if (FsProbe::findFatRootLabel(fd, boot, info->label, sizeof(info->label)))
+        strlcpy(info->label, r.label, sizeof(info->label));
+    close(fd);
+
+    SLOGD("FAT%d %s: size=%llu id=%08x label=%s", info->fatBits, devPath,
+            info->size, info->id, info->label);
+    return 0;
+}
+
+int probeFilesystem(const char *devPath, FsProbeResult *result)
+{
+    return FsProbe::probe(devPath, result);
+}
@@ -0,0 +1,130 @@
+#ifndef _FS_PROBE_H
+#define _FS_PROBE_H
+
+#include <unistd.h>
+#include <stdint.h>
+
+#include "Filesystems.h"
+
+#define FSPROBE_UUID_SIZE 40
+#define FSPROBE_LABEL_SIZE 128
+
+/* Clean shutdown state the filesystem records about itself */
+typedef enum {
+    FSSTATE_UNKNOWN,
+    FSSTATE_CLEAN,
+    FSSTATE_DIRTY,
+} FsState;
+
+/*
+ * What a single probe learned about a partition. Strings are empty when the
+ * filesystem has no such field (or it lies outside the probe window), size
+ * is 0 when unknown and id is the 32 bit serial vold reports to the
+ * framework (-1 when there is none). state is only filled in where the
+ * flags are cheap to reach: the exFAT boot sector always, FAT[1] and the
+ * NTFS $Volume flags by probeMetadata().
+ */
+typedef struct FsProbeResult {
+    FSType   type;
+    uint64_t size;
+    int32_t  id;
+    FsState  state;
+    char     uuid[FSPROBE_UUID_SIZE];
+    char     label[FSPROBE_LABEL_SIZE];
+} FsProbeResult;
+
+/*
+ * What vold reports for a FAT volume, from a single read of the boot
+ * sector plus the root directory scan for the label. fatBits is 12, 16 or
+ * 32; id is -1 if the boot sector carries no serial.
+ */
+typedef struct FatBootInfo {
+    int      fatBits;
+    uint64_t size;
+    int32_t  id;
+    char     label[12];
+} FatBootInfo;
+
+#if defined(__cplusplus)
+/*
+ * Superblock probe engine: reads the start of a partition once (as much as
+ * the largest window in the Filesystems registry) and runs the registered
+ * detectors against that buffer, in registry order.
+ */
+class FsProbe {
+public:
+    /*
+     * How much root directory is scanned for a FAT/exFAT label; 2 MB is
+     * the 65536 entries FAT allows in a directory.
+     */
+    static const size_t MAX_ROOT_DIR_SIZE = 2 * 1024 * 1024;
+
+    /*
+     * Returns 0 and fills 'result' (type FSTYPE_UNRECOGNIZED if nothing
+     * matched), or -1 with errno set if the device could not be read.
+     */
+    static int probe(const char *devPath, FsProbeResult *result);
+    static int probeBuffer(const uint8_t *buf, size_t len, FsProbeResult *result);
+
+    /*
+     * Handed the superblock window ('len' bytes from the start of 'fd')
+     * once the superblock probe has filled in 'result'. Returning true ends
+     * probeMetadata() there, with 'result' as the callback left it.
+     */
+    typedef bool (*ShallowCallback)(void *cookie, int fd, const uint8_t *buf, size_t len,
+            FsProbeResult *result);
+
+    /*
+     * Like probe(), but also follows the on-disk structures for labels
+     * which do not live in the superblock (FAT/exFAT root directory, NTFS
+     * $Volume, HFS+ catalog). Gives the same UUID/LABEL as blkid.
+     */
+    static int probeMetadata(const char *devPath, FsProbeResult *result,
+            ShallowCallback cb = NULL, void *cookie = NULL);
+
+    /*
+     * Looks for the volume id entry in the root directory of the FAT
+     * volume whose boot sector is 'boot'. Returns 0 and the trimmed label,
+     * or -1 if there is none.
+     */
+    static int findFatRootLabel(int fd, const uint8_t *boot, char *label, size_t size);
+
+    /*
+     * Reads the main boot region and the root directory label entry of an
+     * exFAT volume. Returns 0, or -1 with errno set (EINVAL if it is not
+     * exFAT or the boot region fails its checksum).
+     */
+    static int probeExFatVolume(const char *devPath, FsProbeResult *result);
+
+    /* exFAT boot region checksum over sectors 0-10 of 'region' */
+    static uint32_t exFatBootChecksum(const uint8_t *region, size_t sectorSize);
+
+    /* Superblock detectors, referenced from the Filesystems registry */
+    static bool probeHfsPlus(const uint8_t *buf, size_t len, FsProbeResult *result);
+    static bool probeNtfs(const uint8_t *buf, size_t len, FsProbeResult *result);
+    static bool probeExFat(const uint8_t *buf, size_t len, FsProbeResult *result);
+    static bool probeExt4(const uint8_t *buf, size_t len, FsProbeResult *result);
+    static bool probeIso9660(const uint8_t *buf, size_t len, FsProbeResult *result);
+    static bool probeFat(const uint8_t *buf, size_t len, FsProbeResult *result);
+
+private:
+    static int probeFd(int fd, bool deep, FsProbeResult *result,
+            ShallowCallback cb = NULL, void *cookie = NULL);
+    static void readFatLabel(int fd, const uint8_t *boot, FsProbeResult *result);
+    static void readFatState(int fd, const uint8_t *boot, FsProbeResult *result);
+    static void readExFatLabel(int fd, const uint8_t *boot, FsProbeResult *result);
+    static void readNtfsLabel(int fd, const uint8_t *boot, FsProbeResult *result);
+    static void readHfsPlusLabel(int fd, const uint8_t *vh, FsProbeResult *result);
+};
+
+extern "C" {
+#endif /* defined(__cplusplus) */
+
+int probeFilesystem(const char *devPath, FsProbeResult *result);
+int fatRootLabel(const char *devPath, char *label, size_t size);
+int readFatBootInfo(const char *devPath, FatBootInfo *info);
+
+#if defined(__cplusplus)
+}
+#endif /* defined(__cplusplus) */
+#endif
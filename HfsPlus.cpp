@@ -38,44 +38,16 @@
 #include <cutils/properties.h>
 
 #include "HfsPlus.h"
+#include "FsProbe.h"
 
-extern "C" int logwrap(int argc, const char **argv, int background);
 extern "C" int mount(const char *, const char *, const char *, unsigned long, const void *);
 
 int HfsPlus::detect(const char *fsPath, bool *outResult) {
-    int retval = -1;
+    FsProbeResult probe;
 
-    int fd = open(fsPath, O_RDONLY);
-    if(fd != -1) {
-        loff_t seek_res = lseek64(fd, 1024, SEEK_SET);
-        if(seek_res == 1024) {
-            char signature[4];
-            ssize_t read_res = read(fd, signature, 4);
-            if(read_res == 4) {
-                if(!memcmp(signature, "H+\x00\x04", 4)) {
-                    SLOGI("HFS+ filesystem detected.");
-                    *outResult = true;
-                }
-                else if(!memcmp(signature, "HX\x00\x05", 4)) {
-                    SLOGI("HFSX filesystem detected.");
-                    *outResult = true;
-                }
-                else {
-                    SLOGV("Filesystem detection failed (not an HFS+/HFSX "
-                          "filesystem).");
-                    *outResult = false;
-                }
+    if (FsProbe::probe(fsPath, &probe))
+        return -1;
 
-                retval = 0;
-            }
-            else if(read_res != -1)
-                errno = EIO;
-        }
-        else if(seek_res != -1)
-            errno = EIO;
-
-        close(fd);
-    }
-
-    return retval;
+    *outResult = (probe.type == FSTYPE_HFSPLUS);
+    return 0;
 }
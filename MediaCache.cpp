@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <sys/stat.h>
+
+#define LOG_TAG "Vold"
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+#include <openssl/md5.h>
+
+#include "MediaCache.h"
+
+const char *MediaCache::DEFAULT_PATH = "/data/misc/vold/media_cache";
+
+MediaCache::MediaCache(const char *path) {
+    mPath = strdup(path);
+    pthread_mutex_init(&mLock, NULL);
+    mLoaded = false;
+    mNumHits = 0;
+    mNumMisses = 0;
+    mNumEvicted = 0;
+    mNumChecksSkipped = 0;
+}
+
+MediaCache::~MediaCache() {
+    EntryCollection::iterator it;
+    for (it = mEntries.begin(); it != mEntries.end(); ++it) {
+        delete *it;
+    }
+    mEntries.clear();
+    pthread_mutex_destroy(&mLock);
+    free(mPath);
+}
+
+static bool readAt(int fd, uint8_t *buf, size_t len, off64_t offset) {
+    return pread64(fd, buf, len, offset) == (ssize_t) len;
+}
+
+int MediaCache::fingerprint(int fd, const uint8_t *buf, size_t len,
+        const FsProbeResult *probed, Fingerprint *fp) {
+    uint8_t fat[4096];
+    const uint8_t *fatBuf;
+    off64_t fatOffset;
+    size_t fatLen;
+
+    if (probed->type == FSTYPE_FAT) {
+        fatLen = buf[0x0b] | (buf[0x0c] << 8);
+        fatOffset = (off64_t) (buf[0x0e] | (buf[0x0f] << 8)) * fatLen;
+    } else if (probed->type == FSTYPE_EXFAT && buf[0x6c] >= 9 && buf[0x6c] <= 12) {
+        uint32_t sector = buf[0x50] | (buf[0x51] << 8) | (buf[0x52] << 16) |
+                ((uint32_t) buf[0x53] << 24);
+        fatLen = (size_t) 1 << buf[0x6c];
+        fatOffset = (off64_t) sector << buf[0x6c];
+    } else {
+        return -1;
+    }
+
+    if (fatLen > sizeof(fat))
+        return -1;
+    if (fatOffset + fatLen <= len) {
+        fatBuf = buf + fatOffset;
+    } else {
+        if (!readAt(fd, fat, fatLen, fatOffset))
+            return -1;
+        fatBuf = fat;
+    }
+
+    MD5_CTX ctx;
+    MD5_Init(&ctx);
+    MD5_Update(&ctx, buf, 512);
+    MD5_Update(&ctx, fatBuf, fatLen);
+    MD5_Final(fp->digest, &ctx);
+
+    fp->type = probed->type;
+    fp->id = probed->id;
+    fp->size = probed->size;
+    return 0;
+}
+
+struct FingerprintProbe {
+    MediaCache::Fingerprint *fp;
+    bool                     ok;
+    bool                     stop;
+};
+
+static bool fingerprintProbed(void *cookie, int fd, const uint8_t *buf, size_t len,
+        FsProbeResult *result) {
+    FingerprintProbe *probe = (FingerprintProbe *) cookie;
+
+    probe->ok = !MediaCache::fingerprint(fd, buf, len, result, probe->fp);
+    return probe->stop;
+}
+
+int MediaCache::fingerprint(const char *devPath, Fingerprint *fp) {
+    FingerprintProbe probe;
+    FsProbeResult result;
+
+    probe.fp = fp;
+    probe.ok = false;
+    probe.stop = true;
+    if (FsProbe::probeMetadata(devPath, &result, fingerprintProbed, &probe) || !probe.ok)
+        return -1;
+    return 0;
+}
+
+bool MediaCache::isEnabled() {
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get("tcc.vold.media_cache", value, "1");
+    return strcmp(value, "0") != 0;
+}
+
+/* Loads the file once /data is there; until then the cache stays empty */
+bool MediaCache::load_l() {
+    if (mLoaded)
+        return true;
+
+    char dir[PATH_MAX];
+    strlcpy(dir, mPath, sizeof(dir));
+    char *slash = strrchr(dir, '/');
+    if (slash) {
+        *slash = '\0';
+        if (mkdir(dir, 0700) && errno != EEXIST)
+            return false;
+    }
+    mLoaded = true;
+
+    FILE *fp = fopen(mPath, "r");
+    if (!fp) {
+        if (errno != ENOENT)
+            SLOGW("Cannot read media cache %s (%s)", mPath, strerror(errno));
+        return true;
+    }
+
+    FileHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != FILE_MAGIC ||
+            hdr.entrySize != sizeof(Entry) || hdr.count > MAX_ENTRIES) {
+        SLOGW("Discarding media cache %s from another version", mPath);
+        fclose(fp);
+        return true;
+    }
+    for (uint32_t i = 0; i < hdr.count; i++) {
+        Entry *e = new Entry();
+        if (fread(e, sizeof(*e), 1, fp) != 1) {
+            delete e;
+            break;
+        }
+        mEntries.push_back(e);
+    }
+    fclose(fp);
+    SLOGI("Media cache: %d entries loaded", mEntries.size());
+    return true;
+}
+
+void MediaCache::save_l() {
+    char tmp[PATH_MAX];
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", mPath);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        SLOGW("Cannot write media cache %s (%s)", tmp, strerror(errno));
+        return;
+    }
+
+    FileHeader hdr;
+    hdr.magic = FILE_MAGIC;
+    hdr.entrySize = sizeof(Entry);
+    hdr.count = mEntries.size();
+    bool ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr);
+
+    /* In LRU order, so it survives a restart */
+    EntryCollection::iterator it;
+    for (it = mEntries.begin(); ok && it != mEntries.end(); ++it) {
+        ok = write(fd, *it, sizeof(Entry)) == sizeof(Entry);
+    }
+    if (ok)
+        ok = fsync(fd) == 0;
+    close(fd);
+
+    if (!ok || rename(tmp, mPath)) {
+        SLOGW("Cannot write media cache %s (%s)", mPath, strerror(errno));
+        unlink(tmp);
+    }
+}
+
+MediaCache::Entry *MediaCache::find_l(const Fingerprint *fp) {
+    EntryCollection::iterator it;
+    for (it = mEntries.begin(); it != mEntries.end(); ++it) {
+        if (!memcmp(&(*it)->fp, fp, sizeof(*fp))) {
+            /* Most recently used go to the back */
+            Entry *e = *it;
+            mEntries.erase(it);
+            mEntries.push_back(e);
+            return e;
+        }
+    }
+    return NULL;
+}
+
+void MediaCache::insert_l(const Fingerprint *fp, const FsProbeResult *result, bool checked) {
+    Entry *e = find_l(fp);
+
+    if (!e) {
+        if ((int) mEntries.size() >= MAX_ENTRIES) {
+            delete *mEntries.begin();
+            mEntries.erase(mEntries.begin());
+            mNumEvicted++;
+        }
+        e = new Entry();
+        mEntries.push_back(e);
+    }
+    e->fp = *fp;
+    e->checked = checked;
+    e->result = *result;
+    save_l();
+}
+
+bool MediaCache::lookup(const Fingerprint *fp, FsProbeResult *result, bool *checked) {
+    if (!isEnabled())
+        return false;
+
+    pthread_mutex_lock(&mLock);
+    Entry *e = load_l() ? find_l(fp) : NULL;
+    if (e) {
+        *result = e->result;
+        *checked = e->checked;
+        mNumHits++;
+    } else {
+        mNumMisses++;
+    }
+    pthread_mutex_unlock(&mLock);
+    return e != NULL;
+}
+
+void MediaCache::record(const Fingerprint *fp, const FsProbeResult *result) {
+    if (!isEnabled())
+        return;
+
+    pthread_mutex_lock(&mLock);
+    if (load_l()) {
+        /* Keep the check result if we already knew the media */
+        Entry *e = find_l(fp);
+        insert_l(fp, result, e && e->checked);
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+void MediaCache::markChecked(const char *devPath) {
+    FingerprintProbe probe;
+    Fingerprint fp;
+    FsProbeResult result;
+
+    if (!isEnabled())
+        return;
+    /* One pass gives both the fingerprint and the full metadata */
+    probe.fp = &fp;
+    probe.ok = false;
+    probe.stop = false;
+    if (FsProbe::probeMetadata(devPath, &result, fingerprintProbed, &probe) || !probe.ok)
+        return;
+
+    pthread_mutex_lock(&mLock);
+    if (load_l())
+        insert_l(&fp, &result, true);
+    pthread_mutex_unlock(&mLock);
+}
+
+void MediaCache::noteCheckSkipped() {
+    pthread_mutex_lock(&mLock);
+    mNumChecksSkipped++;
+    pthread_mutex_unlock(&mLock);
+}
+
+int MediaCache::getNumEntries() {
+    pthread_mutex_lock(&mLock);
+    int n = mEntries.size();
+    pthread_mutex_unlock(&mLock);
+    return n;
+}
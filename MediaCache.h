@@ -0,0 +1,105 @@
+#ifndef _MEDIA_CACHE_H
+#define _MEDIA_CACHE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <utils/List.h>
+
+#include "FsProbe.h"
+
+/*
+ * Persistent record of media vold has seen before, so a stick that is
+ * pulled and reinserted unchanged skips the metadata probe and, if it
+ * passed a check last time, the filesystem check.
+ *
+ * Media are told apart by a fingerprint: filesystem type, serial, size and
+ * an MD5 of the boot sector and the first FAT sector. Only FAT and exFAT
+ * are fingerprinted, because their dirty state lives in exactly those
+ * sectors (FAT[1], exFAT VolumeFlags): media written elsewhere or pulled
+ * while mounted no longer matches. NTFS and HFS+ keep theirs further in
+ * and are never cached.
+ *
+ * At most MAX_ENTRIES are kept, least recently used evicted first. The
+ * file is loaded on first use once its directory can be created (/data
+ * is mounted) and rewritten through a temporary file on every change.
+ * tcc.vold.media_cache=0 turns the cache off.
+ */
+class MediaCache {
+public:
+    static const int MAX_ENTRIES = 32;
+    static const char *DEFAULT_PATH;
+
+    struct Fingerprint {
+        uint32_t type;
+        int32_t  id;
+        uint64_t size;
+        uint8_t  digest[16];
+    };
+
+    MediaCache(const char *path);
+    ~MediaCache();
+
+    /* Returns 0 and the fingerprint, or -1 if the media is not cacheable */
+    static int fingerprint(const char *devPath, Fingerprint *fp);
+
+    /*
+     * The same from a probe already under way, as a FsProbe::ShallowCallback
+     * sees it: the boot sector comes from 'buf', and only a FAT sector
+     * beyond the window is read through 'fd'.
+     */
+    static int fingerprint(int fd, const uint8_t *buf, size_t len,
+            const FsProbeResult *probed, Fingerprint *fp);
+
+    /*
+     * Returns true and the stored probe result if the media is known;
+     * 'checked' tells whether it passed a filesystem check as it is now.
+     */
+    bool lookup(const Fingerprint *fp, FsProbeResult *result, bool *checked);
+    void record(const Fingerprint *fp, const FsProbeResult *result);
+
+    /* Called after a successful check; re-reads the (possibly repaired) media */
+    void markChecked(const char *devPath);
+
+    void noteCheckSkipped();
+
+    int getNumEntries();
+    unsigned int getNumHits() { return mNumHits; }
+    unsigned int getNumMisses() { return mNumMisses; }
+    unsigned int getNumEvicted() { return mNumEvicted; }
+    unsigned int getNumChecksSkipped() { return mNumChecksSkipped; }
+
+private:
+    static const uint32_t FILE_MAGIC = 0x564d4331;  /* "VMC1" */
+
+    struct Entry {
+        Fingerprint   fp;
+        uint32_t      checked;
+        FsProbeResult result;
+    };
+    typedef android::List<Entry *> EntryCollection;
+
+    struct FileHeader {
+        uint32_t magic;
+        uint32_t entrySize;
+        uint32_t count;
+    };
+
+    char             *mPath;
+    pthread_mutex_t   mLock;
+    EntryCollection   mEntries;
+    bool              mLoaded;
+
+    unsigned int      mNumHits;
+    unsigned int      mNumMisses;
+    unsigned int      mNumEvicted;
+    unsigned int      mNumChecksSkipped;
+
+    bool isEnabled();
+    bool load_l();
+    void save_l();
+    Entry *find_l(const Fingerprint *fp);
+    void insert_l(const Fingerprint *fp, const FsProbeResult *result, bool checked);
+};
+
+#endif
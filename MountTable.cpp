@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#define LOG_TAG "Vold"
+
+#include <cutils/log.h>
+
+#include "MountTable.h"
+
+const char *MountTable::DEFAULT_PATH = "/proc/self/mountinfo";
+
+MountTable::MountTable(const char *path) {
+    mPath = strdup(path);
+    mFd = -1;
+    mValid = false;
+    pthread_mutex_init(&mLock, NULL);
+    memset(mBuckets, 0, sizeof(mBuckets));
+    mNumMounts = 0;
+    mNumLookups = 0;
+    mNumRefreshes = 0;
+}
+
+MountTable::~MountTable() {
+    clear_l();
+    if (mFd >= 0)
+        close(mFd);
+    pthread_mutex_destroy(&mLock);
+    free(mPath);
+}
+
+/* FNV-1a */
+unsigned int MountTable::hash(const char *s) {
+    unsigned int h = 2166136261U;
+
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+/* The kernel writes space, tab, newline and backslash as \ooo */
+void MountTable::unescape(char *s) {
+    char *out = s;
+
+    while (*s) {
+        if (s[0] == '\\' && s[1] >= '0' && s[1] <= '3' && s[2] >= '0' && s[2] <= '7' &&
+                s[3] >= '0' && s[3] <= '7') {
+            *out++ = ((s[1] - '0') << 6) | ((s[2] - '0') << 3) | (s[3] - '0');
+            s += 4;
+        } else {
+            *out++ = *s++;
+        }
+    }
+    *out = '\0';
+}
+
+void MountTable::clear_l() {
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        Entry *e = mBuckets[i];
+        while (e) {
+            Entry *next = e->next;
+            free(e->mountPoint);
+            free(e->source);
+            free(e->fsType);
+            delete e;
+            e = next;
+        }
+        mBuckets[i] = NULL;
+    }
+    mNumMounts = 0;
+}
+
+void MountTable::addEntry_l(char *mountPoint, char *source, char *fsType) {
+    Entry *e = new Entry();
+
+    unescape(mountPoint);
+    unescape(source);
+    e->hash = hash(mountPoint);
+    e->mountPoint = strdup(mountPoint);
+    e->source = strdup(source);
+    e->fsType = strdup(fsType);
+    /* Mounted over: the later (topmost) one goes first */
+    e->next = mBuckets[e->hash % NUM_BUCKETS];
+    mBuckets[e->hash % NUM_BUCKETS] = e;
+    mNumMounts++;
+}
+
+/*
+ * A mountinfo line is
+ *   id parent major:minor root mountpoint options [optional...] - fstype source superoptions
+ */
+bool MountTable::parse_l() {
+    size_t size = 16 * 1024;
+    size_t len = 0;
+    char *buf = (char *) malloc(size);
+
+    if (!buf)
+        return false;
+    if (lseek(mFd, 0, SEEK_SET) < 0) {
+        free(buf);
+        return false;
+    }
+    for (;;) {
+        if (len == size - 1) {
+            char *bigger = (char *) realloc(buf, size * 2);
+            if (!bigger) {
+                free(buf);
+                return false;
+            }
+            buf = bigger;
+            size *= 2;
+        }
+        ssize_t n = read(mFd, buf + len, size - 1 - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            SLOGE("Error reading %s (%s)", mPath, strerror(errno));
+            free(buf);
+            return false;
+        }
+        if (n == 0)
+            break;
+        len += n;
+    }
+    buf[len] = '\0';
+
+    clear_l();
+    char *save = NULL;
+    for (char *line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        char *fields[16];
+        int n = 0;
+        char *fsave = NULL;
+
+        for (char *f = strtok_r(line, " ", &fsave); f && n < 16; f = strtok_r(NULL, " ", &fsave))
+            fields[n++] = f;
+
+        /* Optional fields end at "-", after the six fixed ones */
+        int sep;
+        for (sep = 6; sep < n && strcmp(fields[sep], "-"); sep++)
+            ;
+        if (n < 6 || sep + 2 >= n) {
+            continue;
+        }
+        addEntry_l(fields[4], fields[sep + 2], fields[sep + 1]);
+    }
+    free(buf);
+    mNumRefreshes++;
+    return true;
+}
+
+/* Re-reads the table if it changed since we last did */
+bool MountTable::update_l() {
+    if (mFd < 0) {
+        mFd = open(mPath, O_RDONLY | O_CLOEXEC);
+        if (mFd < 0) {
+            SLOGE("Error opening %s (%s)", mPath, strerror(errno));
+            return false;
+        }
+        mValid = false;
+    }
+
+    struct pollfd pfd;
+    pfd.fd = mFd;
+    pfd.events = POLLPRI;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLPRI | POLLERR)))
+        mValid = false;
+
+    if (!mValid) {
+        mValid = parse_l();
+        if (!mValid) {
+            close(mFd);
+            mFd = -1;
+        }
+    }
+    return mValid;
+}
+
+MountTable::Entry *MountTable::find_l(const char *mountPoint) {
+    unsigned int h = hash(mountPoint);
+
+    mNumLookups++;
+    for (Entry *e = mBuckets[h % NUM_BUCKETS]; e; e = e->next) {
+        if (e->hash == h && !strcmp(e->mountPoint, mountPoint))
+            return e;
+    }
+    return NULL;
+}
+
+bool MountTable::isMounted(const char *mountPoint) {
+    pthread_mutex_lock(&mLock);
+    bool mounted = update_l() && find_l(mountPoint) != NULL;
+    pthread_mutex_unlock(&mLock);
+    return mounted;
+}
+
+int MountTable::getSource(const char *mountPoint, char *source, size_t size) {
+    int rc = -1;
+
+    pthread_mutex_lock(&mLock);
+    Entry *e = update_l() ? find_l(mountPoint) : NULL;
+    if (e) {
+        strlcpy(source, e->source, size);
+        rc = 0;
+    }
+    pthread_mutex_unlock(&mLock);
+    return rc;
+}
+
+void MountTable::forEachUnder(const char *dir, Visitor visitor, void *cookie) {
+    size_t len = strlen(dir);
+
+    pthread_mutex_lock(&mLock);
+    if (update_l()) {
+        for (int i = 0; i < NUM_BUCKETS; i++) {
+            for (Entry *e = mBuckets[i]; e; e = e->next) {
+                if (!strncmp(e->mountPoint, dir, len) && e->mountPoint[len] == '/')
+                    visitor(cookie, e->source, e->mountPoint);
+            }
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+static int64_t nowMs() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int MountTable::waitFor(const char *mountPoint, bool mounted, int timeoutMs) {
+    /*
+     * A descriptor of our own, opened before the first look: its POLLPRI
+     * covers every change from then on, whoever else reads the table.
+     */
+    int fd = open(mPath, O_RDONLY | O_CLOEXEC);
+    int64_t deadline = nowMs() + timeoutMs;
+
+    for (;;) {
+        if (isMounted(mountPoint) == mounted) {
+            if (fd >= 0)
+                close(fd);
+            return 0;
+        }
+        int64_t left = deadline - nowMs();
+        if (left <= 0)
+            break;
+
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLPRI;
+        pfd.revents = 0;
+        if (fd < 0 || (poll(&pfd, 1, (int) left) < 0 && errno != EINTR)) {
+            /* Nothing to sleep on: look again now and then */
+            usleep(10 * 1000);
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+void MountTable::invalidate() {
+    pthread_mutex_lock(&mLock);
+    mValid = false;
+    pthread_mutex_unlock(&mLock);
+}
+
+int MountTable::getNumMounts() {
+    pthread_mutex_lock(&mLock);
+    int n = mNumMounts;
+    pthread_mutex_unlock(&mLock);
+    return n;
+}
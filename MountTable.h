@@ -0,0 +1,79 @@
+#ifndef _MOUNT_TABLE_H
+#define _MOUNT_TABLE_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/*
+ * What is mounted where, from /proc/self/mountinfo, hashed by mount point.
+ *
+ * The file is parsed once and kept open; the kernel flags it with POLLPRI
+ * whenever the mount table of our namespace changes, so a lookup only
+ * re-reads it after a mount or unmount (anyone's, including our own)
+ * and is otherwise a hash probe. Mount points are compared unescaped,
+ * "\040" read back as a space.
+ */
+class MountTable {
+public:
+    static const int NUM_BUCKETS = 256;
+    static const char *DEFAULT_PATH;
+
+    typedef void (*Visitor)(void *cookie, const char *source, const char *mountPoint);
+
+    MountTable(const char *path);
+    ~MountTable();
+
+    bool isMounted(const char *mountPoint);
+
+    /* Returns 0 and the device (or other source) mounted there, or -1 */
+    int getSource(const char *mountPoint, char *source, size_t size);
+
+    /*
+     * Calls 'visitor' for every mount strictly below directory 'dir',
+     * under the table lock: it must not call back into the table.
+     */
+    void forEachUnder(const char *dir, Visitor visitor, void *cookie);
+
+    /*
+     * Waits at most timeoutMs for 'mountPoint' to be mounted (or, with
+     * mounted false, to be gone), sleeping in poll() between changes of
+     * the table. 0, or -1 with errno ETIMEDOUT.
+     */
+    int waitFor(const char *mountPoint, bool mounted, int timeoutMs);
+
+    /* Re-read on the next lookup even without POLLPRI */
+    void invalidate();
+
+    int getNumMounts();
+    unsigned int getNumLookups() { return mNumLookups; }
+    unsigned int getNumRefreshes() { return mNumRefreshes; }
+
+private:
+    struct Entry {
+        Entry        *next;
+        unsigned int  hash;
+        char         *mountPoint;
+        char         *source;
+        char         *fsType;
+    };
+
+    char            *mPath;
+    int              mFd;
+    bool             mValid;
+    pthread_mutex_t  mLock;
+    Entry           *mBuckets[NUM_BUCKETS];
+    int              mNumMounts;
+    unsigned int     mNumLookups;
+    unsigned int     mNumRefreshes;
+
+    static unsigned int hash(const char *s);
+    static void unescape(char *s);
+
+    bool update_l();
+    bool parse_l();
+    void clear_l();
+    void addEntry_l(char *mountPoint, char *source, char *fsType);
+    Entry *find_l(const char *mountPoint);
+};
+
+#endif
@@ -26,6 +26,7 @@
 #include <sysutils/NetlinkEvent.h>
 #include "NetlinkHandler.h"
 #include "VolumeManager.h"
+#include "BlockUevent.h"
 
 NetlinkHandler::NetlinkHandler(int listenerSocket) :
                 NetlinkListener(listenerSocket) {
@@ -52,6 +53,9 @@ void NetlinkHandler::onEvent(NetlinkEvent *evt) {
     }
 
     if (!strcmp(subsys, "block")) {
-        vm->handleBlockEvent(evt);
+        BlockUevent blk;
+        if (!blk.parse(evt)) {
+            vm->queueBlockEvent(&blk);
+        }
     }
 }
@@ -26,6 +26,7 @@
 #include <cutils/log.h>
 #include <sysutils/NetlinkEvent.h>
 #include <sys/mount.h>
+#include <sys/wait.h>
 
 #include <cutils/properties.h>
 #include <sqlite3.h>
@@ -33,7 +34,11 @@
 #include "NetworkVolume.h"
 #include "VolumeManager.h"
 #include "ResponseCode.h"
-#include "Process.h"
+#include "UnmountPolicy.h"
+#include "ToolRunner.h"
+
+/* A server that does not answer must not hold up the command thread */
+#define NETWORK_MOUNT_TIMEOUT_MS (30 * 1000)
 
 sqlite3 *pDbHandle = NULL;
 
@@ -57,7 +62,9 @@ NetworkVolume::~NetworkVolume() {
 }
 
 int NetworkVolume::mountVol() {
-    char mountCmd[256];
+    char source[256];
+    char options[512];
+    const char *fsType = NULL;
     char *mode, *remote_ip, *remote_path, *user_id, *user_pw;
 
     setState(Volume::State_Pending);
@@ -87,15 +94,34 @@ int NetworkVolume::mountVol() {
     user_pw = (char *)sqlite3_column_text(stmt, 4);
 
     if (!strcmp((char *)mode, "nfs")) {
-        sprintf(mountCmd, "busybox mount -t nfs -o vers=3,nolock %s:/%s %s",
-                remote_ip, remote_path, getMountpoint());
+        fsType = "nfs";
+        snprintf(source, sizeof(source), "%s:/%s", remote_ip, remote_path);
+        snprintf(options, sizeof(options), "vers=3,nolock");
     } else if (!strcmp((char *)mode, "cifs")) {
-        sprintf(mountCmd, "busybox mount -t cifs none -o user=%s,password=%s,iocharset=utf8,unc=\\\\\\\\%s\\\\%s %s",
-                user_id, user_pw, remote_ip, remote_path, getMountpoint());
+        fsType = "cifs";
+        snprintf(source, sizeof(source), "none");
+        snprintf(options, sizeof(options), "user=%s,password=%s,iocharset=utf8,unc=\\\\%s\\%s",
+                user_id, user_pw, remote_ip, remote_path);
+    } else {
+        SLOGE("Unknown network filesystem '%s'", mode);
     }
     sqlite3_finalize(stmt);
 
-    if (system(mountCmd)) {
+    /* Straight to busybox, so nothing from the database goes through a shell */
+    const char *args[8];
+    int status;
+    ToolRunner runner;
+    args[0] = "busybox";
+    args[1] = "mount";
+    args[2] = "-t";
+    args[3] = fsType;
+    args[4] = "-o";
+    args[5] = options;
+    args[6] = source;
+    args[7] = getMountpoint();
+    runner.setTimeout(NETWORK_MOUNT_TIMEOUT_MS);
+
+    if (!fsType || runner.run(8, args, &status) || !WIFEXITED(status) || WEXITSTATUS(status)) {
         setState(Volume::State_NoMedia);
         SLOGE("Failed to mount %s", getMountpoint());
         return -1;
@@ -105,41 +131,22 @@ int NetworkVolume::mountVol() {
     }
 }
 
-int NetworkVolume::doUnmount(const char *path, bool force) {
-    int retries = 10;
+int NetworkVolume::doUnmount(const char *path, bool force, OpenFileScanner *scanner,
+                             int64_t deadlineMs) {
+    UnmountPolicy policy("nfs", force, scanner);
 
     if (mDebug) {
         SLOGD("Unmounting {%s}, force = %d", path, force);
     }
 
-    while (retries--) {
-        if (!umount2(path, MNT_DETACH) || errno == EINVAL || errno == ENOENT) {
-            SLOGI("%s sucessfully unmounted", path);
-            return 0;
-        }
-
-        int action = 0;
-
-        if (force) {
-            if (retries == 1) {
-                action = 2; // SIGKILL
-            } else if (retries == 2) {
-                action = 1; // SIGHUP
-            }
-        }
-
-        SLOGW("Failed to unmount %s (%s, retries %d, action %d)",
-                path, strerror(errno), retries, action);
-
-        Process::killProcessesWithOpenFiles(path, action);
-        usleep(1000*1000);
-    }
-    errno = EBUSY;
-    SLOGE("Giving up on unmount %s (%s)", path, strerror(errno));
-    return -1;
+    if (deadlineMs)
+        policy.setDeadline(deadlineMs);
+    policy.addPath(path);
+    return policy.unmount(path);
 }
 
-int NetworkVolume::unmountVol(bool force, bool revert) {
+int NetworkVolume::unmountVol(bool force, bool revert, OpenFileScanner *scanner,
+                              int64_t deadlineMs) {
     char msg[255];
 
     if (getState() != Volume::State_Mounted) {
@@ -149,9 +156,10 @@ int NetworkVolume::unmountVol(bool force, bool revert) {
     }
 
     setState(Volume::State_Unmounting);
-    usleep(1000 * 1000); // Give the framework some time to react
+    if (!deadlineMs)
+        usleep(1000 * 1000); // Give the framework some time to react
 
-    if (doUnmount(getMountpoint(), force)) {
+    if (doUnmount(getMountpoint(), force, scanner, deadlineMs)) {
         //SLOGE("Failed to unmount %s (%s)", SEC_STGDIR, strerror(errno));
         setState(Volume::State_Mounted);
         return -1;
@@ -34,7 +34,8 @@ public:
     const char *getFuseMountpoint() { return mFuseMountpoint; }
 
     int mountVol();
-    int unmountVol(bool force, bool revert);
+    int unmountVol(bool force, bool revert, OpenFileScanner *scanner = NULL,
+                   int64_t deadlineMs = 0);
     int getVolInfo(struct volume_info *v) { return 0; }
 
 protected:
@@ -48,7 +49,7 @@ protected:
     char *getNodePath(void);
 
 private:
-    int doUnmount(const char *path, bool force);
+    int doUnmount(const char *path, bool force, OpenFileScanner *scanner, int64_t deadlineMs);
 };
 
 typedef android::List<NetworkVolume *> NetworkVolumeCollection;
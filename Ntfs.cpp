@@ -39,9 +39,10 @@
 #include <cutils/log.h>
 #include <cutils/properties.h>
 
-#include <logwrap/logwrap.h>
 
 #include "Ntfs.h"
+#include "FsProbe.h"
+#include "ToolRunner.h"
 
 //+NATIVE_PLATFORM
 #ifdef FUNCTION_STORAGE_TUXERA_PATCH    
@@ -57,42 +58,18 @@ extern "C" int mount(const char *, const char *, const char *, unsigned long, co
 //+NATIVE_PLATFORM
 #ifdef FUNCTION_STORAGE_TUXERA_PATCH    
 int Ntfs::detect(const char *fsPath, bool *outResult) {
-    int retval = -1;
-
-    int fd = open(fsPath, O_RDONLY);
-    if(fd != -1) {
-        loff_t seek_res = lseek64(fd, 3, SEEK_SET);
-        if(seek_res == 3) {
-            char signature[8];
-            ssize_t read_res = read(fd, signature, 8);
-            if(read_res == 8) {
-                if(!memcmp(signature, "NTFS    ", 8)) {
-                    SLOGI("Detected NTFS filesystem.");
-                    *outResult = true;
-                }
-                else {
-                    SLOGV("Filesystem detection failed (not an NTFS "
-                          "filesystem).");
-                    *outResult = false;
-                }
-
-                retval = 0;
-            }
-            else if(read_res != -1)
-                errno = EIO;
-        }
-        else if(seek_res != -1)
-            errno = EIO;
+    FsProbeResult probe;
 
-        close(fd);
-    }
+    if (FsProbe::probe(fsPath, &probe))
+        return -1;
 
-    return retval;
+    *outResult = (probe.type == FSTYPE_NTFS);
+    return 0;
 }
 #endif
 //-NATIVE_PLATFORM
 
-int Ntfs::check(const char *fsPath) {
+int Ntfs::check(const char *fsPath, ToolRunner *runner, bool *modified) {
     /* Insert NTFS checking code here. */
     
     //+NATIVE_PLATFORM
@@ -115,11 +92,13 @@ int Ntfs::check(const char *fsPath) {
         args[3] = "-f";
         args[4] = NULL;
 
-        rc = android_fork_execvp(5, (char **)args, &status, false, true);
+        ToolRunner local;
+        rc = (runner ? runner : &local)->run(4, args, &status);
 
         if (rc != 0) {
-            SLOGE("Filesystem check failed due to logwrap error");
-            errno = EIO;
+            SLOGE("Filesystem check could not run (%s)", strerror(errno));
+            if (errno != ETIMEDOUT)
+                errno = EIO;
             return -1;
         }
 
@@ -142,14 +121,20 @@ int Ntfs::check(const char *fsPath) {
 
         case 2:
             SLOGW("NTFS: error were found and fixed");
+            if (modified)
+                *modified = true;
             return 0;
 
         case 3:
             SLOGW("NTFS: only minor errors were found on the %d Volume", fsPath);
+            if (modified)
+                *modified = true;
             return 0;
 
         case 4:
             SLOGW("NTFS: errors were found onthe %s but they could not be fixed" , fsPath);
+            if (modified)
+                *modified = true;
             return 0;
 
         case 6:
@@ -263,6 +248,7 @@ int Ntfs::format(const char *fsPath, unsigned int numSectors) {
     const char *args[5];
     int rc;
     int status;
+    ToolRunner runner;
 
     //+NATIVE_PLATFORM
     #ifdef FUNCTION_STORAGE_TUXERA_PATCH    
@@ -273,10 +259,10 @@ int Ntfs::format(const char *fsPath, unsigned int numSectors) {
         char tmp[32];
         snprintf(tmp, sizeof(tmp), "%u", numSectors);
         args[3] = (const char*) tmp;
-        rc = android_fork_execvp(4, (char **)args, &status, false, true);
+        rc = runner.run(4, args, &status);
     }
     else {
-        rc = android_fork_execvp(3, (char **)args, &status, false, true);
+        rc = runner.run(3, args, &status);
     }
     #else
     args[0] = MKNTFS_PATH;
@@ -284,12 +270,12 @@ int Ntfs::format(const char *fsPath, unsigned int numSectors) {
     args[2] = "-f";
     args[3] = fsPath;
     
-    rc = android_fork_execvp(4, (char **)args, &status, false, true);
+    rc = runner.run(4, args, &status);
     #endif
     //-NATIVE_PLATFORM
 
     if (rc != 0) {
-        SLOGE("Filesystem format failed due to logwrap error");
+        SLOGE("Filesystem format could not run (%s)", strerror(errno));
         errno = EIO;
         return -1;
     }
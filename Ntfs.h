@@ -20,6 +20,8 @@
 
 #include <unistd.h>
 
+class ToolRunner;
+
 class Ntfs {
 public:
     //+NATIVE_PLATFORM
@@ -27,7 +29,7 @@ public:
     static int detect(const char *fsPath, bool *outResult);
     #endif
     //-NATIVE_PLATFORM
-    static int check(const char *fsPath);
+    static int check(const char *fsPath, ToolRunner *runner = NULL, bool *modified = NULL);
     //+NATIVE_PLATFORM
     #ifdef FUNCTION_STORAGE_TUXERA_PATCH        
     static int doMount(const char *fsPath, const char *mountPoint, bool ro,
@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+
+#define LOG_TAG "ProcessKiller"
+
+#include <cutils/log.h>
+
+#include "OpenFileScanner.h"
+#include "Process.h"
+
+pthread_mutex_t OpenFileScanner::sStatsLock = PTHREAD_MUTEX_INITIALIZER;
+unsigned int OpenFileScanner::sNumFullScans = 0;
+unsigned int OpenFileScanner::sNumReusedScans = 0;
+int64_t OpenFileScanner::sTotalScanMs = 0;
+
+static int64_t nowMs() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+OpenFileScanner::OpenFileScanner() {
+    mNumPaths = 0;
+    mProcFd = -1;
+    pthread_mutex_init(&mLock, NULL);
+    pthread_mutex_init(&mScanLock, NULL);
+}
+
+OpenFileScanner::~OpenFileScanner() {
+    clear();
+    for (int i = 0; i < mNumPaths; i++)
+        free(mPaths[i]);
+    if (mProcFd >= 0)
+        close(mProcFd);
+    pthread_mutex_destroy(&mLock);
+    pthread_mutex_destroy(&mScanLock);
+}
+
+bool OpenFileScanner::addPath(const char *path) {
+    bool added = true;
+
+    pthread_mutex_lock(&mScanLock);
+    int i;
+    for (i = 0; i < mNumPaths && strcmp(mPaths[i], path); i++)
+        ;
+    if (i == mNumPaths) {
+        if (mNumPaths < MAX_PATHS)
+            mPaths[mNumPaths++] = strdup(path);
+        else
+            added = false;
+    }
+    pthread_mutex_unlock(&mScanLock);
+    return added;
+}
+
+void OpenFileScanner::clear() {
+    HolderCollection::iterator it;
+    for (it = mHolders.begin(); it != mHolders.end(); ++it)
+        delete *it;
+    mHolders.clear();
+}
+
+bool OpenFileScanner::matches(const char *path) {
+    for (int i = 0; i < mNumPaths; i++) {
+        if (Process::pathMatchesMountPoint(path, mPaths[i]))
+            return true;
+    }
+    return false;
+}
+
+bool OpenFileScanner::checkLink(const char *name, pid_t pid, char *link) {
+    char path[32];
+
+    snprintf(path, sizeof(path), "%d/%s", pid, name);
+    ssize_t len = readlinkat(mProcFd, path, link, PATH_MAX - 1);
+    if (len <= 0)
+        return false;
+    link[len] = '\0';
+    return matches(link);
+}
+
+bool OpenFileScanner::checkFds(pid_t pid, char *file) {
+    char path[32];
+
+    snprintf(path, sizeof(path), "%d/fd", pid);
+    int fd = openat(mProcFd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        close(fd);
+        return false;
+    }
+
+    bool found = false;
+    struct dirent *de;
+    while (!found && (de = readdir(dir))) {
+        if (de->d_name[0] == '.')
+            continue;
+        ssize_t len = readlinkat(fd, de->d_name, file, PATH_MAX - 1);
+        if (len <= 0)
+            continue;
+        file[len] = '\0';
+        found = matches(file);
+    }
+    closedir(dir);
+    return found;
+}
+
+bool OpenFileScanner::checkMaps(pid_t pid, char *file) {
+    char path[32];
+    char buf[16 * 1024];
+    size_t len = 0;
+
+    snprintf(path, sizeof(path), "%d/maps", pid);
+    int fd = openat(mProcFd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    bool found = false;
+    for (;;) {
+        ssize_t n = read(fd, buf + len, sizeof(buf) - 1 - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len += n;
+        buf[len] = '\0';
+
+        /* Whole lines only; the rest waits for the next read */
+        char *line = buf;
+        char *end;
+        while ((end = strchr(line, '\n'))) {
+            *end = '\0';
+            // skip to the path
+            const char *p = strchr(line, '/');
+            if (p && matches(p)) {
+                strlcpy(file, p, PATH_MAX);
+                found = true;
+                break;
+            }
+            line = end + 1;
+        }
+        if (found)
+            break;
+        len -= line - buf;
+        if (len == sizeof(buf) - 1) {
+            /* No line is that long; drop it rather than stall */
+            len = 0;
+        }
+        memmove(buf, line, len);
+    }
+    close(fd);
+    return found;
+}
+
+bool OpenFileScanner::check(pid_t pid, Holder *h) {
+    h->pid = pid;
+    if (checkFds(pid, h->file)) {
+        h->reason = FD;
+    } else if (checkMaps(pid, h->file)) {
+        h->reason = MAPS;
+    } else if (checkLink("cwd", pid, h->file)) {
+        h->reason = CWD;
+    } else if (checkLink("root", pid, h->file)) {
+        h->reason = ROOT;
+    } else if (checkLink("exe", pid, h->file)) {
+        h->reason = EXE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void *OpenFileScanner::walkThread(void *arg) {
+    Walk *w = (Walk *) arg;
+    OpenFileScanner *me = w->scanner;
+    Holder *h = new Holder();
+
+    for (;;) {
+        int i = __sync_fetch_and_add(&w->next, 1);
+        if (i >= w->numPids)
+            break;
+        if (me->check(w->pids[i], h)) {
+            pthread_mutex_lock(&me->mLock);
+            me->mHolders.push_back(h);
+            pthread_mutex_unlock(&me->mLock);
+            h = new Holder();
+        }
+    }
+    delete h;
+    return NULL;
+}
+
+int OpenFileScanner::fullScan() {
+    int dupFd = dup(mProcFd);
+    if (dupFd < 0)
+        return -1;
+    DIR *dir = fdopendir(dupFd);
+    if (!dir) {
+        close(dupFd);
+        return -1;
+    }
+    /* The duplicate shares the offset the last walk left at the end */
+    rewinddir(dir);
+    clear();
+
+    Walk w;
+    int size = 512;
+    w.scanner = this;
+    w.pids = (int *) malloc(size * sizeof(int));
+    w.numPids = 0;
+    w.next = 0;
+
+    struct dirent *de;
+    while (w.pids && (de = readdir(dir))) {
+        int pid = Process::getPid(de->d_name);
+        if (pid <= 0)
+            continue;
+        if (w.numPids == size) {
+            int *bigger = (int *) realloc(w.pids, size * 2 * sizeof(int));
+            if (!bigger)
+                break;
+            w.pids = bigger;
+            size *= 2;
+        }
+        w.pids[w.numPids++] = pid;
+    }
+    closedir(dir);
+    if (!w.pids)
+        return -1;
+
+    /* A thread per 64 processes is plenty; the rest is syscall bound */
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int numThreads = w.numPids / 64 + 1;
+    if (numThreads > cpus)
+        numThreads = cpus > 0 ? cpus : 1;
+    if (numThreads > MAX_THREADS)
+        numThreads = MAX_THREADS;
+
+    pthread_t threads[MAX_THREADS];
+    int started = 0;
+    for (int i = 1; i < numThreads; i++) {
+        if (pthread_create(&threads[started], NULL, walkThread, &w))
+            break;
+        started++;
+    }
+    walkThread(&w);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    free(w.pids);
+    return 0;
+}
+
+int OpenFileScanner::recheck() {
+    HolderCollection::iterator it = mHolders.begin();
+    while (it != mHolders.end()) {
+        if (check((*it)->pid, *it)) {
+            ++it;
+        } else {
+            delete *it;
+            it = mHolders.erase(it);
+        }
+    }
+    return mHolders.size();
+}
+
+int OpenFileScanner::scan() {
+    int64_t start = nowMs();
+    bool reused = false;
+
+    pthread_mutex_lock(&mScanLock);
+    if (mProcFd < 0) {
+        mProcFd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (mProcFd < 0) {
+            SLOGE("Cannot open /proc (%s)", strerror(errno));
+            pthread_mutex_unlock(&mScanLock);
+            return -1;
+        }
+    }
+
+    if (!mHolders.empty() && recheck() > 0) {
+        reused = true;
+    } else if (fullScan()) {
+        SLOGE("Cannot read /proc (%s)", strerror(errno));
+        pthread_mutex_unlock(&mScanLock);
+        return -1;
+    }
+    int n = mHolders.size();
+    pthread_mutex_unlock(&mScanLock);
+
+    pthread_mutex_lock(&sStatsLock);
+    if (reused)
+        sNumReusedScans++;
+    else
+        sNumFullScans++;
+    sTotalScanMs += nowMs() - start;
+    pthread_mutex_unlock(&sStatsLock);
+    return n;
+}
+
+int OpenFileScanner::getNumHolders() {
+    pthread_mutex_lock(&mScanLock);
+    int n = mHolders.size();
+    pthread_mutex_unlock(&mScanLock);
+    return n;
+}
+
+bool OpenFileScanner::isHolder(pid_t pid) {
+    bool found = false;
+
+    pthread_mutex_lock(&mScanLock);
+    HolderCollection::iterator it;
+    for (it = mHolders.begin(); !found && it != mHolders.end(); ++it)
+        found = (*it)->pid == pid;
+    pthread_mutex_unlock(&mScanLock);
+    return found;
+}
+
+void OpenFileScanner::signalHolders(int action) {
+    HolderCollection::iterator it;
+
+    pthread_mutex_lock(&mScanLock);
+    for (it = mHolders.begin(); it != mHolders.end(); ++it) {
+        Holder *h = *it;
+        char name[PATH_MAX];
+
+        Process::getProcessName(h->pid, name, sizeof(name));
+        switch (h->reason) {
+        case FD:
+            SLOGE("Process %s (%d) has open file %s", name, h->pid, h->file);
+            break;
+        case MAPS:
+            SLOGE("Process %s (%d) has open filemap for %s", name, h->pid, h->file);
+            break;
+        case CWD:
+            SLOGE("Process %s (%d) has cwd within %s", name, h->pid, h->file);
+            break;
+        case ROOT:
+            SLOGE("Process %s (%d) has chroot within %s", name, h->pid, h->file);
+            break;
+        case EXE:
+            SLOGE("Process %s (%d) has executable path within %s", name, h->pid, h->file);
+            break;
+        }
+
+        if (h->pid == getpid())
+            continue;
+        if (action == 1) {
+            SLOGW("Sending SIGHUP to process %d", h->pid);
+            kill(h->pid, SIGTERM);
+        } else if (action == 2) {
+            SLOGE("Sending SIGKILL to process %d", h->pid);
+            kill(h->pid, SIGKILL);
+        }
+    }
+    pthread_mutex_unlock(&mScanLock);
+}
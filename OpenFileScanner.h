@@ -0,0 +1,91 @@
+#ifndef _OPEN_FILE_SCANNER_H
+#define _OPEN_FILE_SCANNER_H
+
+#include <pthread.h>
+#include <limits.h>
+#include <sys/types.h>
+
+#include <utils/List.h>
+
+/*
+ * Finds the processes that keep one or more mount points busy: an open
+ * file, a mapping, or cwd, root or exe beneath any of them.
+ *
+ * All paths are tested in one walk of /proc, opened once and read with
+ * the *at() calls, split over up to MAX_THREADS threads. The holders
+ * found stay with the scanner: a retry loop that calls scan() again
+ * only re-checks those, and walks /proc again once none of them holds
+ * anything any more.
+ *
+ * Several unmounts running at once may share one scanner; its calls are
+ * serialised, so each reuses what the others' scans found.
+ */
+class OpenFileScanner {
+public:
+    static const int MAX_PATHS = 32;
+    static const int MAX_THREADS = 4;
+
+    OpenFileScanner();
+    ~OpenFileScanner();
+
+    /* Adding one twice is a no-op; false once MAX_PATHS are in */
+    bool addPath(const char *path);
+
+    /* Returns the number of holders, or -1 if /proc cannot be read */
+    int scan();
+
+    /*
+     * Logs every holder of the last scan() and, with action 1, sends it
+     * SIGTERM or, with action 2, SIGKILL. Never signals vold itself.
+     */
+    void signalHolders(int action);
+
+    int getNumHolders();
+    bool isHolder(pid_t pid);
+
+    static unsigned int getNumFullScans() { return sNumFullScans; }
+    static unsigned int getNumReusedScans() { return sNumReusedScans; }
+    static int64_t getTotalScanMs() { return sTotalScanMs; }
+
+private:
+    enum Reason { FD, MAPS, CWD, ROOT, EXE };
+
+    struct Holder {
+        pid_t  pid;
+        Reason reason;
+        char   file[PATH_MAX];
+    };
+    typedef android::List<Holder *> HolderCollection;
+
+    struct Walk {
+        OpenFileScanner *scanner;
+        int             *pids;
+        int              numPids;
+        int              next;
+    };
+
+    char             *mPaths[MAX_PATHS];
+    int               mNumPaths;
+    int               mProcFd;
+    pthread_mutex_t   mLock;        // mHolders, while walking /proc
+    pthread_mutex_t   mScanLock;    // everything else, between callers
+    HolderCollection  mHolders;
+
+    static pthread_mutex_t sStatsLock;
+    static unsigned int    sNumFullScans;
+    static unsigned int    sNumReusedScans;
+    static int64_t         sTotalScanMs;
+
+    static void *walkThread(void *arg);
+
+    int fullScan();
+    int recheck();
+    void clear();
+    bool check(pid_t pid, Holder *h);
+    bool matches(const char *path);
+    bool checkLink(const char *name, pid_t pid, char *link);
+    bool checkFds(pid_t pid, char *file);
+    bool checkMaps(pid_t pid, char *file);
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/stat.h>
+
+#define LOG_TAG "Vold"
+
+#include <cutils/log.h>
+
+#include "ProbeCache.h"
+
+ProbeCache::ProbeCache() {
+    pthread_mutex_init(&mLock, NULL);
+    mGeneration = 0;
+    mMediaCache = NULL;
+    mNumHits = 0;
+    mNumMisses = 0;
+    mNumInvalidated = 0;
+}
+
+ProbeCache::~ProbeCache() {
+    EntryCollection::iterator it;
+    for (it = mEntries.begin(); it != mEntries.end(); ++it) {
+        delete *it;
+    }
+    mEntries.clear();
+    pthread_mutex_destroy(&mLock);
+}
+
+ProbeCache::Entry *ProbeCache::find(dev_t dev) {
+    EntryCollection::iterator it;
+    for (it = mEntries.begin(); it != mEntries.end(); ++it) {
+        if ((*it)->dev == dev)
+            return *it;
+    }
+    return NULL;
+}
+
+void ProbeCache::insert(dev_t dev, unsigned int generation, const FsProbeResult *result,
+        bool checked) {
+    Entry *e = find(dev);
+
+    if (!e) {
+        if ((int) mEntries.size() >= MAX_ENTRIES) {
+            /* Oldest entries are at the front */
+            delete *mEntries.begin();
+            mEntries.erase(mEntries.begin());
+        }
+        e = new Entry();
+        e->dev = dev;
+        mEntries.push_back(e);
+    }
+    e->generation = generation;
+    e->checked = checked;
+    e->result = *result;
+}
+
+/* ShallowCallback: the probe stops here if the media is known */
+bool ProbeCache::lookupMedia(void *cookie, int fd, const uint8_t *buf, size_t len,
+        FsProbeResult *result) {
+    MediaLookup *media = (MediaLookup *) cookie;
+
+    media->cacheable = !MediaCache::fingerprint(fd, buf, len, result, &media->fp);
+    media->hit = media->cacheable &&
+            media->cache->lookup(&media->fp, result, &media->checked);
+    return media->hit;
+}
+
+int ProbeCache::get(const char *devPath, FsProbeResult *result, bool *checked) {
+    struct stat st;
+
+    if (checked)
+        *checked = false;
+    if (stat(devPath, &st) || !S_ISBLK(st.st_mode)) {
+        /* Not a block device (image file in tests, ...): don't cache */
+        return FsProbe::probeMetadata(devPath, result);
+    }
+
+    pthread_mutex_lock(&mLock);
+    Entry *e = find(st.st_rdev);
+    if (e && e->generation == mGeneration) {
+        *result = e->result;
+        if (checked)
+            *checked = e->checked;
+        mNumHits++;
+        pthread_mutex_unlock(&mLock);
+        return 0;
+    }
+    unsigned int generation = mGeneration;
+    mNumMisses++;
+    pthread_mutex_unlock(&mLock);
+
+    /* Probe without the lock; other partitions can be probed meanwhile */
+    MediaLookup media;
+    media.cache = mMediaCache;
+    media.cacheable = false;
+    media.hit = false;
+    media.checked = false;
+    if (FsProbe::probeMetadata(devPath, result, mMediaCache ? lookupMedia : NULL, &media))
+        return -1;
+    if (media.cacheable && !media.hit)
+        mMediaCache->record(&media.fp, result);
+    if (checked)
+        *checked = media.checked;
+
+    pthread_mutex_lock(&mLock);
+    /* Media changed while we were reading: hand out the result, don't keep it */
+    if (generation == mGeneration)
+        insert(st.st_rdev, generation, result, media.checked);
+    pthread_mutex_unlock(&mLock);
+    return 0;
+}
+
+void *ProbeCache::prefetchThread(void *obj) {
+    PrefetchJob *job = reinterpret_cast<PrefetchJob *>(obj);
+    FsProbeResult result;
+
+    while (true) {
+        pthread_mutex_lock(&job->lock);
+        int i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->count)
+            break;
+        job->cache->get(job->devPaths[i], &result);
+    }
+    return NULL;
+}
+
+void ProbeCache::prefetch(const char *const *devPaths, int count) {
+    PrefetchJob job;
+    pthread_t threads[MAX_PREFETCH_THREADS - 1];
+    int numThreads = 0;
+
+    job.cache = this;
+    job.devPaths = devPaths;
+    job.count = count;
+    job.next = 0;
+    pthread_mutex_init(&job.lock, NULL);
+
+    /* The calling thread is one of the workers */
+    while (numThreads < MAX_PREFETCH_THREADS - 1 && numThreads < count - 1) {
+        if (pthread_create(&threads[numThreads], NULL, ProbeCache::prefetchThread, &job)) {
+            SLOGW("Probe prefetch: pthread_create (%s)", strerror(errno));
+            break;
+        }
+        numThreads++;
+    }
+    prefetchThread(&job);
+    for (int i = 0; i < numThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&job.lock);
+}
+
+void ProbeCache::invalidate(dev_t dev) {
+    pthread_mutex_lock(&mLock);
+    EntryCollection::iterator it;
+    for (it = mEntries.begin(); it != mEntries.end(); ++it) {
+        if ((*it)->dev == dev) {
+            delete *it;
+            mEntries.erase(it);
+            mNumInvalidated++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+void ProbeCache::invalidate(const char *devPath) {
+    struct stat st;
+
+    if (!stat(devPath, &st) && S_ISBLK(st.st_mode))
+        invalidate(st.st_rdev);
+}
+
+void ProbeCache::invalidateAll() {
+    pthread_mutex_lock(&mLock);
+    mGeneration++;
+    mNumInvalidated += mEntries.size();
+    EntryCollection::iterator it;
+    for (it = mEntries.begin(); it != mEntries.end(); ++it) {
+        delete *it;
+    }
+    mEntries.clear();
+    pthread_mutex_unlock(&mLock);
+}
+
+int ProbeCache::getNumEntries() {
+    pthread_mutex_lock(&mLock);
+    int n = mEntries.size();
+    pthread_mutex_unlock(&mLock);
+    return n;
+}
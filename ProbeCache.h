@@ -0,0 +1,103 @@
+#ifndef _PROBE_CACHE_H
+#define _PROBE_CACHE_H
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <utils/List.h>
+
+#include "FsProbe.h"
+#include "MediaCache.h"
+
+/*
+ * Per partition cache of FsProbe::probeMetadata() results, so one insert
+ * reads the superblock and label structures of each partition only once
+ * no matter how many of partition selection, initMountpoint(), detect()
+ * and extractMetadata() ask.
+ *
+ * Entries are keyed by dev_t and stamped with the media generation they
+ * were filled in. A change or remove of a partition drops its entry; a
+ * change or remove of a whole disk (media change, repartition, eject)
+ * bumps the generation so every older entry misses. Formatting drops the
+ * entry of the formatted device.
+ *
+ * On a miss the device is read once: the superblock window read by the
+ * probe also gives the MediaCache fingerprint, and the rest of the probe
+ * is skipped when the persistent cache knows the media.
+ */
+class ProbeCache {
+public:
+    static const int MAX_ENTRIES = 64;
+    static const int MAX_PREFETCH_THREADS = 4;
+
+    ProbeCache();
+    ~ProbeCache();
+
+    void setMediaCache(MediaCache *mediaCache) { mMediaCache = mediaCache; }
+
+    /*
+     * Same contract as FsProbe::probeMetadata(). 'checked', if given, tells
+     * whether the MediaCache knows the media as passing a check unchanged.
+     */
+    int get(const char *devPath, FsProbeResult *result, bool *checked = NULL);
+
+    /*
+     * Fills the cache for all of 'devPaths' with up to MAX_PREFETCH_THREADS
+     * probes in flight and returns once every one has completed, so the
+     * partitions of a disk are read concurrently rather than one seek
+     * after the other.
+     */
+    void prefetch(const char *const *devPaths, int count);
+
+    void invalidate(dev_t dev);
+    void invalidate(const char *devPath);
+    void invalidateAll();
+
+    int getNumEntries();
+    unsigned int getNumHits() { return mNumHits; }
+    unsigned int getNumMisses() { return mNumMisses; }
+    unsigned int getNumInvalidated() { return mNumInvalidated; }
+    unsigned int getGeneration() { return mGeneration; }
+
+private:
+    struct Entry {
+        dev_t         dev;
+        unsigned int  generation;
+        bool          checked;
+        FsProbeResult result;
+    };
+    typedef android::List<Entry *> EntryCollection;
+
+    struct MediaLookup {
+        MediaCache              *cache;
+        MediaCache::Fingerprint  fp;
+        bool                     cacheable;
+        bool                     hit;
+        bool                     checked;
+    };
+
+    struct PrefetchJob {
+        ProbeCache          *cache;
+        const char *const   *devPaths;
+        int                  count;
+        int                  next;
+        pthread_mutex_t      lock;
+    };
+
+    pthread_mutex_t  mLock;
+    EntryCollection  mEntries;
+    unsigned int     mGeneration;
+    MediaCache      *mMediaCache;
+
+    unsigned int     mNumHits;
+    unsigned int     mNumMisses;
+    unsigned int     mNumInvalidated;
+
+    Entry *find(dev_t dev);
+    void insert(dev_t dev, unsigned int generation, const FsProbeResult *result, bool checked);
+    static bool lookupMedia(void *cookie, int fd, const uint8_t *buf, size_t len,
+            FsProbeResult *result);
+    static void *prefetchThread(void *obj);
+};
+
+#endif
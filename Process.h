@@ -27,9 +27,9 @@ public:
     static int checkFileDescriptorSymLinks(int pid, const char *mountPoint);
     static int checkFileDescriptorSymLinks(int pid, const char *mountPoint, char *openFilename, size_t max);
     static void getProcessName(int pid, char *buffer, size_t max);
+    static int pathMatchesMountPoint(const char *path, const char *mountPoint);
 private:
     static int readSymLink(const char *path, char *link, size_t max);
-    static int pathMatchesMountPoint(const char *path, const char *mountPoint);
 };
 
 #endif
@@ -59,6 +59,8 @@ public:
     static const int VolumeMountFailedNoMedia       = 612;
     static const int VolumeUuidChange               = 613;
     static const int VolumeUserLabelChange          = 614;
+    static const int VolumeReadOnlyChange           = 615;
+    static const int VolumeCheckProgress            = 616;
 
     static const int ShareAvailabilityChange        = 620;
 
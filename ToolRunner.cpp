@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define LOG_TAG "Vold"
+
+#include <cutils/log.h>
+#include <cutils/sched_policy.h>
+
+#include "ToolRunner.h"
+
+pthread_mutex_t ToolRunner::sLock = PTHREAD_MUTEX_INITIALIZER;
+ToolRunner::RunnerCollection ToolRunner::sRunning;
+unsigned int ToolRunner::sNumRuns = 0;
+unsigned int ToolRunner::sNumKilled = 0;
+int64_t ToolRunner::sTotalWallMs = 0;
+int64_t ToolRunner::sTotalCpuMs = 0;
+
+static int64_t nowMs() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int64_t timevalMs(const struct timeval *tv) {
+    return (int64_t) tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
+
+ToolRunner::ToolRunner() {
+    mTimeoutMs = 0;
+    mSpentMs = 0;
+    mBackground = false;
+    mLineCb = NULL;
+    mLineCookie = NULL;
+    mPid = -1;
+    mArgc = 0;
+    mArgv = NULL;
+    mCancelled = false;
+    mOutputStart = 0;
+    mOutputLen = 0;
+    mLineLen = 0;
+    mWallMs = 0;
+    mUserMs = 0;
+    mSysMs = 0;
+}
+
+ToolRunner::~ToolRunner() {
+}
+
+void ToolRunner::flushLine(const char *tag) {
+    if (!mLineLen)
+        return;
+    mLine[mLineLen] = '\0';
+    ALOG(LOG_INFO, tag, "%s", mLine);
+    if (mLineCb)
+        mLineCb(mLineCookie, mLine);
+    mLineLen = 0;
+}
+
+void ToolRunner::consume(const char *tag, const char *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        /* Ring buffer of the raw output */
+        mOutput[(mOutputStart + mOutputLen) % OUTPUT_SIZE] = buf[i];
+        if (mOutputLen < OUTPUT_SIZE)
+            mOutputLen++;
+        else
+            mOutputStart = (mOutputStart + 1) % OUTPUT_SIZE;
+
+        /* Checkers redraw progress with '\r'; that ends a line too */
+        if (buf[i] == '\n' || buf[i] == '\r') {
+            flushLine(tag);
+        } else {
+            mLine[mLineLen++] = buf[i];
+            if (mLineLen == MAX_LINE - 1)
+                flushLine(tag);
+        }
+    }
+}
+
+size_t ToolRunner::getOutput(char *buf, size_t size) {
+    size_t len = mOutputLen < size - 1 ? mOutputLen : size - 1;
+    size_t skip = mOutputLen - len;
+
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = mOutput[(mOutputStart + skip + i) % OUTPUT_SIZE];
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+/* sLock held */
+bool ToolRunner::kill_l() {
+    if (mPid <= 0)
+        return false;
+    return ::kill(mPid, SIGKILL) == 0;
+}
+
+void ToolRunner::cancel() {
+    pthread_mutex_lock(&sLock);
+    mCancelled = true;
+    kill_l();
+    pthread_mutex_unlock(&sLock);
+}
+
+bool ToolRunner::isCancelled() {
+    pthread_mutex_lock(&sLock);
+    bool cancelled = mCancelled;
+    pthread_mutex_unlock(&sLock);
+    return cancelled;
+}
+
+int ToolRunner::cancelByArg(const char *arg) {
+    int n = 0;
+
+    pthread_mutex_lock(&sLock);
+    RunnerCollection::iterator it;
+    for (it = sRunning.begin(); it != sRunning.end(); ++it) {
+        ToolRunner *r = *it;
+        for (int i = 1; i < r->mArgc; i++) {
+            if (r->mArgv[i] && !strcmp(r->mArgv[i], arg)) {
+                SLOGW("Cancelling %s (pid %d) on %s", r->mArgv[0], r->mPid, arg);
+                r->mCancelled = true;
+                r->kill_l();
+                n++;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&sLock);
+    return n;
+}
+
+int ToolRunner::run(int argc, const char **argv, int *status) {
+    const char *args[MAX_ARGS + 1];
+    int pipefd[2];
+    int devnull;
+
+    if (argc < 1 || argc > MAX_ARGS) {
+        errno = E2BIG;
+        return -1;
+    }
+    if (mTimeoutMs > 0 && mSpentMs >= mTimeoutMs) {
+        SLOGE("No time left to run %s", argv[0]);
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    if (isCancelled()) {
+        SLOGW("%s cancelled before it started", argv[0]);
+        errno = ECANCELED;
+        return -1;
+    }
+    /* Callers pass argc without a terminating NULL */
+    memcpy(args, argv, argc * sizeof(args[0]));
+    args[argc] = NULL;
+
+    mOutputStart = 0;
+    mOutputLen = 0;
+    mLineLen = 0;
+    mWallMs = mUserMs = mSysMs = 0;
+
+    devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (devnull < 0)
+        return -1;
+    if (pipe2(pipefd, O_CLOEXEC)) {
+        int err = errno;
+        close(devnull);
+        errno = err;
+        return -1;
+    }
+
+    int64_t start = nowMs();
+    /* The child only execs, so sharing our memory until then is safe */
+    volatile int execErr = 0;
+    pid_t pid = vfork();
+    if (pid == 0) {
+        dup2(devnull, 0);
+        dup2(pipefd[1], 1);
+        dup2(pipefd[1], 2);
+        execvp(args[0], (char *const *) args);
+        execErr = errno;
+        _exit(127);
+    }
+    int err = errno;
+    close(devnull);
+    close(pipefd[1]);
+
+    if (pid < 0) {
+        SLOGE("Cannot start %s (%s)", args[0], strerror(err));
+        close(pipefd[0]);
+        errno = err;
+        return -1;
+    }
+    if (execErr) {
+        SLOGE("Cannot execute %s (%s)", args[0], strerror(execErr));
+        close(pipefd[0]);
+        waitpid(pid, NULL, 0);
+        errno = execErr;
+        return -1;
+    }
+
+    if (mBackground) {
+        int rc = set_sched_policy(pid, SP_BACKGROUND);
+        if (rc < 0)
+            SLOGW("Unable to background %s (%s)", args[0], strerror(-rc));
+    }
+
+    pthread_mutex_lock(&sLock);
+    mPid = pid;
+    mArgc = argc;
+    mArgv = args;
+    sRunning.push_back(this);
+    /* cancel() may have come in before there was anything to kill */
+    if (mCancelled)
+        kill_l();
+    pthread_mutex_unlock(&sLock);
+
+    fcntl(pipefd[0], F_SETFL, fcntl(pipefd[0], F_GETFL) | O_NONBLOCK);
+
+    int64_t deadline = mTimeoutMs > 0 ? start + (mTimeoutMs - mSpentMs) : -1;
+    int64_t exitDeadline = -1;
+    bool timedOut = false;
+    bool exited = false;
+    bool eof = false;
+    int wstatus = 0;
+    struct rusage ru;
+    memset(&ru, 0, sizeof(ru));
+    while (!eof) {
+        struct pollfd pfd;
+        int64_t until = deadline;
+        int wait = -1;
+
+        /*
+         * A grandchild can inherit the pipe and keep it open long after
+         * the tool itself is gone, so EOF alone cannot end the run.
+         */
+        if (!exited) {
+            pid_t w = wait4(pid, &wstatus, WNOHANG, &ru);
+            if (w == pid || (w < 0 && errno != EINTR)) {
+                exited = true;
+                exitDeadline = nowMs() + EXIT_GRACE_MS;
+                /* Reaped: the pid may be reused, nothing left to kill */
+                pthread_mutex_lock(&sLock);
+                mPid = -1;
+                pthread_mutex_unlock(&sLock);
+            }
+        }
+
+        /* Whatever poll() says: a tool that never stops writing must still stop */
+        int64_t now = nowMs();
+        if (exited && now >= exitDeadline) {
+            SLOGW("%s exited but its output is still held open, not waiting", args[0]);
+            break;
+        }
+        if (!exited && deadline >= 0 && now >= deadline) {
+            if (timedOut) {
+                /* Killed, but something still holds the pipe open */
+                break;
+            }
+            SLOGE("%s timed out after %d ms, killing it", args[0], mTimeoutMs);
+            pthread_mutex_lock(&sLock);
+            kill_l();
+            pthread_mutex_unlock(&sLock);
+            timedOut = true;
+            deadline = now + KILL_GRACE_MS;
+            until = deadline;
+        }
+
+        if (exited)
+            until = exitDeadline;
+        if (until >= 0) {
+            int64_t left = until - nowMs();
+            wait = left > 0 ? (int) left : 0;
+        }
+        if (!exited && (wait < 0 || wait > REAP_POLL_MS))
+            wait = REAP_POLL_MS;
+
+        pfd.fd = pipefd[0];
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int rc = poll(&pfd, 1, wait);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            SLOGE("poll on %s output (%s)", args[0], strerror(errno));
+            break;
+        }
+        if (rc == 0)
+            continue;
+
+        /* Bounded, so the deadlines above get looked at again */
+        char buf[512];
+        for (size_t total = 0; total < READ_BUDGET; ) {
+            ssize_t n = read(pipefd[0], buf, sizeof(buf));
+            if (n > 0) {
+                consume(args[0], buf, n);
+                total += n;
+            } else if (n == 0) {
+                eof = true;
+                break;
+            } else {
+                if (errno != EINTR && errno != EAGAIN)
+                    eof = true;
+                if (errno != EINTR)
+                    break;
+            }
+        }
+    }
+    close(pipefd[0]);
+    flushLine(args[0]);
+
+    if (!exited) {
+        while (wait4(pid, &wstatus, 0, &ru) < 0 && errno == EINTR)
+            ;
+    }
+
+    pthread_mutex_lock(&sLock);
+    RunnerCollection::iterator it;
+    for (it = sRunning.begin(); it != sRunning.end(); ++it) {
+        if (*it == this) {
+            sRunning.erase(it);
+            break;
+        }
+    }
+    mPid = -1;
+    mArgv = NULL;
+    mArgc = 0;
+    bool cancelled = mCancelled;
+
+    mWallMs = nowMs() - start;
+    mSpentMs += mWallMs;
+    mUserMs = timevalMs(&ru.ru_utime);
+    mSysMs = timevalMs(&ru.ru_stime);
+    sNumRuns++;
+    if (timedOut || cancelled)
+        sNumKilled++;
+    sTotalWallMs += mWallMs;
+    sTotalCpuMs += mUserMs + mSysMs;
+    pthread_mutex_unlock(&sLock);
+
+    if (WIFEXITED(wstatus)) {
+        if (WEXITSTATUS(wstatus)) {
+            SLOGI("%s terminated by exit(%d) after %lld ms (cpu %lld ms)", args[0],
+                    WEXITSTATUS(wstatus), mWallMs, mUserMs + mSysMs);
+        } else {
+            SLOGI("%s finished after %lld ms (cpu %lld ms)", args[0], mWallMs,
+                    mUserMs + mSysMs);
+        }
+    } else if (WIFSIGNALED(wstatus)) {
+        SLOGI("%s terminated by signal %d after %lld ms", args[0], WTERMSIG(wstatus),
+                mWallMs);
+    }
+
+    if (status)
+        *status = wstatus;
+    if (timedOut) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    if (cancelled) {
+        errno = ECANCELED;
+        return -1;
+    }
+    return 0;
+}
+
+extern "C" int runTool(int argc, const char **argv, int *status) {
+    ToolRunner runner;
+
+    return runner.run(argc, argv, status);
+}
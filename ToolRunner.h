@@ -0,0 +1,127 @@
+#ifndef _TOOL_RUNNER_H
+#define _TOOL_RUNNER_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+#include <pthread.h>
+
+#include <utils/List.h>
+
+/*
+ * Runs an external tool (checker, mkfs, mount helper) the one way vold
+ * does it: vfork() + exec, so launching does not copy vold's address
+ * space, with stdin on /dev/null and stdout/stderr on a pipe that is read
+ * without blocking. Each output line is logged under argv[0] and handed to
+ * the line callback, and the last OUTPUT_SIZE bytes are kept for the
+ * caller. A timeout or cancel() kills the tool; wall clock and CPU time
+ * of every run are accounted.
+ */
+class ToolRunner {
+public:
+    static const int MAX_ARGS = 32;
+    static const size_t OUTPUT_SIZE = 4096;
+    static const size_t MAX_LINE = 1024;
+    /* How long a killed tool gets to close its output before we stop reading */
+    static const int KILL_GRACE_MS = 1000;
+    /* How long output is still read once the tool itself has exited */
+    static const int EXIT_GRACE_MS = 200;
+    /* How often a running tool is checked for having exited */
+    static const int REAP_POLL_MS = 100;
+    /* Most output read in one go before the deadlines are checked again */
+    static const size_t READ_BUDGET = 16 * 1024;
+
+    typedef void (*LineCallback)(void *cookie, const char *line);
+
+    ToolRunner();
+    ~ToolRunner();
+
+    /*
+     * 0 for none, the default. Covers every run() on this runner together,
+     * so a checker making several passes gets one budget.
+     */
+    void setTimeout(int ms) { mTimeoutMs = ms; mSpentMs = 0; }
+    /* Run in the background scheduling group */
+    void setBackground(bool background) { mBackground = background; }
+    void setLineCallback(LineCallback cb, void *cookie) { mLineCb = cb; mLineCookie = cookie; }
+
+    /*
+     * Runs argv[0] (looked up in PATH if it has no '/') and waits for it.
+     * Returns 0 and its wait status, or -1 with errno set: why it could not
+     * be started, or ETIMEDOUT / ECANCELED if it was killed.
+     */
+    int run(int argc, const char **argv, int *status);
+
+    /*
+     * Kills the tool if it is running; from any thread. Sticks: every
+     * later run() on this runner fails with ECANCELED straight away.
+     */
+    void cancel();
+    bool isCancelled();
+
+    /*
+     * Kills every running tool with 'arg' among its arguments, e.g. the
+     * checker of a device being unmounted. Returns how many.
+     */
+    static int cancelByArg(const char *arg);
+
+    /* The tail of the last run's output, NUL terminated; returns its length */
+    size_t getOutput(char *buf, size_t size);
+
+    int64_t getWallMs() { return mWallMs; }
+    int64_t getUserMs() { return mUserMs; }
+    int64_t getSysMs() { return mSysMs; }
+
+    static unsigned int getNumRuns() { return sNumRuns; }
+    static unsigned int getNumKilled() { return sNumKilled; }
+    static int64_t getTotalWallMs() { return sTotalWallMs; }
+    static int64_t getTotalCpuMs() { return sTotalCpuMs; }
+
+private:
+    typedef android::List<ToolRunner *> RunnerCollection;
+
+    static pthread_mutex_t   sLock;
+    static RunnerCollection  sRunning;
+    static unsigned int      sNumRuns;
+    static unsigned int      sNumKilled;
+    static int64_t           sTotalWallMs;
+    static int64_t           sTotalCpuMs;
+
+    int           mTimeoutMs;
+    int64_t       mSpentMs;
+    bool          mBackground;
+    LineCallback  mLineCb;
+    void         *mLineCookie;
+
+    /* Valid while registered in sRunning */
+    pid_t         mPid;
+    int           mArgc;
+    const char  **mArgv;
+    bool          mCancelled;
+
+    char          mOutput[OUTPUT_SIZE];
+    size_t        mOutputStart;
+    size_t        mOutputLen;
+    char          mLine[MAX_LINE];
+    size_t        mLineLen;
+
+    int64_t       mWallMs;
+    int64_t       mUserMs;
+    int64_t       mSysMs;
+
+    void consume(const char *tag, const char *buf, size_t len);
+    void flushLine(const char *tag);
+    bool kill_l();
+};
+
+extern "C" {
+#endif /* defined(__cplusplus) */
+
+/* ToolRunner::run() with the defaults, for the C parts of vold */
+int runTool(int argc, const char **argv, int *status);
+
+#if defined(__cplusplus)
+}
+#endif /* defined(__cplusplus) */
+#endif
@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define LOG_TAG "Vold"
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "UeventCoalescer.h"
+#include "VolumeManager.h"
+
+UeventCoalescer::UeventCoalescer(VolumeManager *vm) {
+    mVm = vm;
+    pthread_mutex_init(&mLock, NULL);
+    pthread_cond_init(&mCond, NULL);
+    mRunning = false;
+    mStopping = false;
+    mWindowMs = DEFAULT_WINDOW_MS;
+    mNumPosted = 0;
+    mNumDelivered = 0;
+    mNumCancelled = 0;
+    mNumBatches = 0;
+}
+
+UeventCoalescer::~UeventCoalescer() {
+    stop();
+    pthread_cond_destroy(&mCond);
+    pthread_mutex_destroy(&mLock);
+}
+
+int64_t UeventCoalescer::nowMs() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int UeventCoalescer::start() {
+    char value[PROPERTY_VALUE_MAX];
+    char def[16];
+
+    snprintf(def, sizeof(def), "%d", DEFAULT_WINDOW_MS);
+    property_get("tcc.vold.uevent.window_ms", value, def);
+    mWindowMs = atoi(value);
+    if (mWindowMs <= 0) {
+        SLOGI("Uevent coalescing disabled");
+        mWindowMs = 0;
+        return 0;
+    }
+
+    mStopping = false;
+    if (pthread_create(&mThread, NULL, UeventCoalescer::threadStart, this)) {
+        SLOGE("pthread_create (%s)", strerror(errno));
+        return -1;
+    }
+    mRunning = true;
+    SLOGI("Uevent coalescing window %d ms", mWindowMs);
+    return 0;
+}
+
+int UeventCoalescer::stop() {
+    if (!mRunning)
+        return 0;
+
+    pthread_mutex_lock(&mLock);
+    mStopping = true;
+    pthread_cond_signal(&mCond);
+    pthread_mutex_unlock(&mLock);
+
+    void *ret;
+    if (pthread_join(mThread, &ret)) {
+        SLOGE("Error joining to uevent coalescer thread (%s)", strerror(errno));
+        return -1;
+    }
+    mRunning = false;
+    return 0;
+}
+
+/*
+ * Partitions are grouped with their disk: the disk devpath is the parent
+ * directory of the partition devpath (.../block/sda/sda1 -> .../block/sda).
+ */
+void UeventCoalescer::diskPathOf(const BlockUevent *evt, char *buf, size_t len) {
+    strlcpy(buf, evt->devpath, len);
+    if (evt->devtype == BlockUevent::DevType_Partition) {
+        char *slash = strrchr(buf, '/');
+        if (slash && slash != buf)
+            *slash = '\0';
+    }
+}
+
+void UeventCoalescer::post(const BlockUevent *evt) {
+    if (!mRunning) {
+        mVm->handleBlockEvent(evt);
+        return;
+    }
+
+    char disk[BlockUevent::DEVPATH_MAX];
+    diskPathOf(evt, disk, sizeof(disk));
+
+    BlockUevent *copy = new BlockUevent(*evt);
+    int64_t now = nowMs();
+
+    pthread_mutex_lock(&mLock);
+    mNumPosted++;
+
+    Batch *batch = NULL;
+    BatchCollection::iterator it;
+    for (it = mBatches.begin(); it != mBatches.end(); ++it) {
+        if (!strcmp((*it)->disk, disk)) {
+            batch = *it;
+            break;
+        }
+    }
+    if (!batch) {
+        batch = new Batch();
+        strcpy(batch->disk, disk);
+        batch->firstMs = now;
+        mBatches.push_back(batch);
+        mNumBatches++;
+    }
+    batch->lastMs = now;
+    batch->events.push_back(copy);
+
+    pthread_cond_signal(&mCond);
+    pthread_mutex_unlock(&mLock);
+}
+
+void *UeventCoalescer::threadStart(void *obj) {
+    UeventCoalescer *me = reinterpret_cast<UeventCoalescer *>(obj);
+
+    me->run();
+    pthread_exit(NULL);
+    return NULL;
+}
+
+void UeventCoalescer::run() {
+    int64_t maxHoldMs = (int64_t) mWindowMs * MAX_HOLD_FACTOR;
+
+    pthread_mutex_lock(&mLock);
+    while (true) {
+        BatchCollection ready;
+        int64_t now = nowMs();
+        int64_t next = -1;
+
+        BatchCollection::iterator it = mBatches.begin();
+        while (it != mBatches.end()) {
+            Batch *b = *it;
+            int64_t due = b->lastMs + mWindowMs;
+            if (due > b->firstMs + maxHoldMs)
+                due = b->firstMs + maxHoldMs;
+
+            if (mStopping || due <= now) {
+                ready.push_back(b);
+                it = mBatches.erase(it);
+            } else {
+                if (next < 0 || due < next)
+                    next = due;
+                ++it;
+            }
+        }
+
+        if (!ready.empty()) {
+            pthread_mutex_unlock(&mLock);
+            for (it = ready.begin(); it != ready.end(); ++it) {
+                deliver(*it);
+                delete *it;
+            }
+            pthread_mutex_lock(&mLock);
+            continue;
+        }
+
+        if (mStopping)
+            break;
+
+        if (next < 0) {
+            pthread_cond_wait(&mCond, &mLock);
+        } else {
+            struct timespec ts;
+            int64_t wait = next - now;
+
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += wait / 1000;
+            ts.tv_nsec += (wait % 1000) * 1000000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&mCond, &mLock, &ts);
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+void UeventCoalescer::fold(EventCollection *events) {
+    int n = events->size();
+    if (n < 2)
+        return;
+
+    BlockUevent **ev = new BlockUevent *[n];
+    bool *dead = new bool[n];
+    EventCollection::iterator it;
+    int i = 0;
+    for (it = events->begin(); it != events->end(); ++it, ++i) {
+        ev[i] = *it;
+        dead[i] = false;
+    }
+
+    for (int r = 0; r < n; r++) {
+        if (ev[r]->action != NetlinkEvent::NlActionRemove)
+            continue;
+
+        for (i = 0; i < r; i++) {
+            if (dead[i] || ev[i]->action == NetlinkEvent::NlActionRemove)
+                continue;
+            /* A disk remove takes every partition with it */
+            if (ev[r]->isDisk() ||
+                    (ev[i]->major == ev[r]->major && ev[i]->minor == ev[r]->minor)) {
+                dead[i] = true;
+            }
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        if (dead[i] || !ev[i]->isDisk() || ev[i]->action != NetlinkEvent::NlActionChange)
+            continue;
+        for (int j = i + 1; j < n; j++) {
+            if (dead[j])
+                continue;
+            if (ev[j]->isDisk() && ev[j]->action == NetlinkEvent::NlActionChange)
+                dead[i] = true;
+            break;
+        }
+    }
+
+    events->clear();
+    for (i = 0; i < n; i++) {
+        if (dead[i]) {
+            delete ev[i];
+            mNumCancelled++;
+        } else {
+            events->push_back(ev[i]);
+        }
+    }
+    delete[] ev;
+    delete[] dead;
+}
+
+void UeventCoalescer::deliver(Batch *batch) {
+    int posted = batch->events.size();
+
+    fold(&batch->events);
+    if ((int) batch->events.size() != posted) {
+        SLOGD("Coalesced %d uevents for %s into %d", posted, batch->disk,
+                batch->events.size());
+    }
+
+    EventCollection::iterator it;
+    for (it = batch->events.begin(); it != batch->events.end(); ++it) {
+        mVm->handleBlockEvent(*it);
+        mNumDelivered++;
+        delete *it;
+    }
+    batch->events.clear();
+}
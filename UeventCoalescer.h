@@ -0,0 +1,91 @@
+#ifndef _UEVENT_COALESCER_H
+#define _UEVENT_COALESCER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <utils/List.h>
+
+#include "BlockUevent.h"
+
+class VolumeManager;
+
+/*
+ * Holds block uevents per disk for a short window before handing them to
+ * VolumeManager::handleBlockEvent(), so a burst from one disk is folded
+ * before any probing starts:
+ *
+ *  - adds and changes queued ahead of a disk remove are dropped (flaky
+ *    connector, the device is already gone);
+ *  - adds and changes of a partition queued ahead of its remove are dropped;
+ *  - back-to-back disk change events collapse into the last one.
+ *
+ * Removes themselves are always delivered: a volume which never saw the
+ * matching add just declines them, and one which had the device from an
+ * earlier window still gets cleaned up.
+ *
+ * What remains is delivered in kernel order, so each volume sees its disk
+ * add followed by all of its partitions in one go and goes Pending -> Idle
+ * once.
+ *
+ * The window is a quiet period in ms (tcc.vold.uevent.window_ms). A disk
+ * that keeps producing events is flushed after MAX_HOLD_FACTOR windows
+ * anyway. A window of 0 disables the stage and events are handled
+ * synchronously on the netlink thread as before.
+ */
+class UeventCoalescer {
+public:
+    static const int DEFAULT_WINDOW_MS = 50;
+    static const int MAX_HOLD_FACTOR = 8;
+
+    typedef android::List<BlockUevent *> EventCollection;
+
+    UeventCoalescer(VolumeManager *vm);
+    ~UeventCoalescer();
+
+    int start();
+    int stop();
+    bool isRunning() { return mRunning; }
+    int getWindowMs() { return mWindowMs; }
+
+    void post(const BlockUevent *evt);
+
+    unsigned int getNumPosted() { return mNumPosted; }
+    unsigned int getNumDelivered() { return mNumDelivered; }
+    unsigned int getNumCancelled() { return mNumCancelled; }
+    unsigned int getNumBatches() { return mNumBatches; }
+
+    /* Folds one disk's batch in place as above, deleting what it drops */
+    void fold(EventCollection *events);
+
+private:
+    struct Batch {
+        char            disk[BlockUevent::DEVPATH_MAX];
+        int64_t         firstMs;
+        int64_t         lastMs;
+        EventCollection events;
+    };
+    typedef android::List<Batch *> BatchCollection;
+
+    VolumeManager   *mVm;
+    pthread_t        mThread;
+    pthread_mutex_t  mLock;
+    pthread_cond_t   mCond;
+    BatchCollection  mBatches;
+    bool             mRunning;
+    bool             mStopping;
+    int              mWindowMs;
+
+    unsigned int     mNumPosted;
+    unsigned int     mNumDelivered;
+    unsigned int     mNumCancelled;
+    unsigned int     mNumBatches;
+
+    static void *threadStart(void *obj);
+    void run();
+    void deliver(Batch *batch);
+    static void diskPathOf(const BlockUevent *evt, char *buf, size_t len);
+    static int64_t nowMs();
+};
+
+#endif
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/mount.h>
+
+#define LOG_TAG "Vold"
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "UnmountPolicy.h"
+
+/* Network mounts are slow to let go; local ones usually go at once */
+static const struct {
+    const char *type;
+    int         backoffMs;
+    int         maxBackoffMs;
+    int         timeoutMs;
+} sDefaults[] = {
+    { "usb",  20, 1000, 10000 },
+    { "sd",   20, 1000, 10000 },
+    { "nfs", 100, 2000, 15000 },
+};
+
+pthread_mutex_t UnmountPolicy::sLock = PTHREAD_MUTEX_INITIALIZER;
+unsigned int UnmountPolicy::sNumUnmounts = 0;
+unsigned int UnmountPolicy::sNumAttempts = 0;
+unsigned int UnmountPolicy::sNumGivenUp = 0;
+unsigned int UnmountPolicy::sNumTerm = 0;
+unsigned int UnmountPolicy::sNumKill = 0;
+char UnmountPolicy::sLastPath[PATH_MAX];
+int UnmountPolicy::sLastResult = 0;
+int64_t UnmountPolicy::sLastMs = 0;
+int UnmountPolicy::sLastNumAttempts = 0;
+UnmountPolicy::Attempt UnmountPolicy::sLastAttempts[MAX_RECORDED];
+
+static int64_t nowMs() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int UnmountPolicy::settingKey(char *key, size_t size, const char *type, const char *name) {
+    int len;
+
+    if (type)
+        len = snprintf(key, size, "tcc.vold.umount.%s.%s", type, name);
+    else
+        len = snprintf(key, size, "tcc.vold.umount.%s", name);
+    if (len < 0 || len >= (int) size || len >= PROPERTY_KEY_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+int UnmountPolicy::getSetting(const char *type, const char *name, int def) {
+    char key[PROPERTY_KEY_MAX];
+    char value[PROPERTY_VALUE_MAX];
+
+    value[0] = '\0';
+    if (!settingKey(key, sizeof(key), type, name))
+        property_get(key, value, "");
+    else
+        SLOGW("Unmount setting %s for %s has no usable property name", name, type);
+    if (!value[0] && !settingKey(key, sizeof(key), NULL, name))
+        property_get(key, value, "");
+    int v = atoi(value);
+    return v > 0 ? v : def;
+}
+
+UnmountPolicy::UnmountPolicy(const char *type, bool force, OpenFileScanner *scanner) {
+    unsigned int i = 0;
+
+    /* Anything else is treated as local media, like the first entry */
+    for (unsigned int j = 0; j < sizeof(sDefaults) / sizeof(sDefaults[0]); j++) {
+        if (!strcmp(sDefaults[j].type, type)) {
+            i = j;
+            break;
+        }
+    }
+    mScanner = scanner ? scanner : &mOwnScanner;
+    mForce = force;
+    mInitialBackoffMs = getSetting(type, "backoff_ms", sDefaults[i].backoffMs);
+    mBackoffMs = mInitialBackoffMs;
+    mMaxBackoffMs = getSetting(type, "max_ms", sDefaults[i].maxBackoffMs);
+    mDeadline = nowMs() + getSetting(type, "timeout_ms", sDefaults[i].timeoutMs);
+    mTermAt = -1;
+}
+
+UnmountPolicy::~UnmountPolicy() {
+}
+
+void UnmountPolicy::setDeadline(int64_t deadlineMs) {
+    if (deadlineMs < mDeadline)
+        mDeadline = deadlineMs;
+}
+
+/*
+ * 0 to warn, 1 for SIGTERM, 2 for SIGKILL; the same numbers as
+ * Process::killProcessesWithOpenFiles().
+ */
+int UnmountPolicy::chooseAction(int64_t now, int holders) {
+    if (!mForce || holders <= 0)
+        return 0;
+    if (mTermAt < 0) {
+        /* Still time for them to go quietly? */
+        if (mDeadline - now > mBackoffMs) {
+            mTermAt = now;
+            return 1;
+        }
+        return 2;
+    }
+    if (now - mTermAt >= TERM_GRACE_MS || mDeadline - now <= mBackoffMs)
+        return 2;
+    return 0;
+}
+
+int UnmountPolicy::unmount(const char *path, bool eioIsGone) {
+    int64_t start = nowMs();
+    Attempt attempts[MAX_RECORDED];
+    int numAttempts = 0;
+    int numTerm = 0;
+    int numKill = 0;
+    int rc = -1;
+
+    mBackoffMs = mInitialBackoffMs;
+    for (;;) {
+        int64_t attemptStart = nowMs();
+        bool done = !umount2(path, MNT_DETACH) || errno == EINVAL || errno == ENOENT ||
+                (eioIsGone && errno == EIO);
+        int err = errno;
+
+        if (done) {
+            SLOGI("%s sucessfully unmounted", path);
+            rc = 0;
+        } else {
+            int holders = mScanner->scan();
+            int64_t now = nowMs();
+            int action = chooseAction(now, holders);
+
+            SLOGW("Failed to unmount %s (%s, attempt %d, %d holders, action %d)",
+                    path, strerror(err), numAttempts + 1, holders, action);
+            if (holders > 0)
+                mScanner->signalHolders(action);
+            if (action == 1)
+                numTerm++;
+            else if (action == 2)
+                numKill++;
+        }
+
+        if (numAttempts < MAX_RECORDED) {
+            attempts[numAttempts].startMs = attemptStart - start;
+            attempts[numAttempts].tookMs = nowMs() - attemptStart;
+        }
+        numAttempts++;
+        if (done)
+            break;
+
+        int64_t left = mDeadline - nowMs();
+        if (left <= 0) {
+            SLOGE("Giving up on unmount %s (%s)", path, strerror(EBUSY));
+            break;
+        }
+        usleep((left < mBackoffMs ? left : mBackoffMs) * 1000);
+        mBackoffMs = mBackoffMs * 2 < mMaxBackoffMs ? mBackoffMs * 2 : mMaxBackoffMs;
+    }
+
+    pthread_mutex_lock(&sLock);
+    sNumUnmounts++;
+    sNumAttempts += numAttempts;
+    if (rc)
+        sNumGivenUp++;
+    sNumTerm += numTerm;
+    sNumKill += numKill;
+    strlcpy(sLastPath, path, sizeof(sLastPath));
+    sLastResult = rc;
+    sLastMs = nowMs() - start;
+    sLastNumAttempts = numAttempts;
+    memcpy(sLastAttempts, attempts,
+            (numAttempts < MAX_RECORDED ? numAttempts : MAX_RECORDED) * sizeof(Attempt));
+    pthread_mutex_unlock(&sLock);
+
+    if (rc)
+        errno = EBUSY;
+    return rc;
+}
+
+void UnmountPolicy::describeLast(char *buf, size_t size) {
+    pthread_mutex_lock(&sLock);
+    if (!sLastPath[0]) {
+        snprintf(buf, size, "none yet");
+    } else {
+        int len = snprintf(buf, size, "%s %s: %d attempts in %lld ms (", sLastPath,
+                sLastResult ? "gave up" : "unmounted", sLastNumAttempts, sLastMs);
+        for (int i = 0; i < sLastNumAttempts && i < MAX_RECORDED && len < (int) size; i++) {
+            len += snprintf(buf + len, size - len, "%s%d+%d", i ? " " : "",
+                    sLastAttempts[i].startMs, sLastAttempts[i].tookMs);
+        }
+        if (len < (int) size)
+            snprintf(buf + len, size - len, ")");
+    }
+    pthread_mutex_unlock(&sLock);
+}
@@ -0,0 +1,91 @@
+#ifndef _UNMOUNT_POLICY_H
+#define _UNMOUNT_POLICY_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "OpenFileScanner.h"
+
+/*
+ * How hard and how long to try unmounting the mounts of one volume.
+ *
+ * Attempts are spaced by a backoff that starts short and doubles up to a
+ * maximum, all within one deadline shared by every unmount() made
+ * through the policy. The values come per volume type ("usb", "sd",
+ * "nfs") from tcc.vold.umount.<type>.backoff_ms, .max_ms and .timeout_ms,
+ * falling back to tcc.vold.umount.* and then the built-in defaults.
+ *
+ * When forced, holders the scanner finds get SIGTERM at once and SIGKILL
+ * TERM_GRACE_MS later, or right away once the deadline is too close for
+ * another wait.
+ */
+class UnmountPolicy {
+public:
+    static const int TERM_GRACE_MS = 500;
+    static const int MAX_RECORDED = 16;
+
+    /* With 'scanner', holders are looked for there rather than privately */
+    UnmountPolicy(const char *type, bool force, OpenFileScanner *scanner = NULL);
+    ~UnmountPolicy();
+
+    /* Where to look for holders, typically every mount of the volume */
+    void addPath(const char *path) { mScanner->addPath(path); }
+
+    /* Absolute CLOCK_MONOTONIC ms; only ever brings the deadline closer */
+    void setDeadline(int64_t deadlineMs);
+
+    /*
+     * Lazily unmounts 'path', retrying while it is busy. A path that is
+     * not mounted (EINVAL, ENOENT, or EIO with 'eioIsGone') counts as
+     * unmounted. 0, or -1 with errno EBUSY once the deadline passes.
+     */
+    int unmount(const char *path, bool eioIsGone = false);
+
+    /*
+     * Property key for setting 'name', per 'type' or shared when 'type' is
+     * NULL. -1 with errno ENAMETOOLONG when it does not fit PROPERTY_KEY_MAX.
+     */
+    static int settingKey(char *key, size_t size, const char *type, const char *name);
+
+    static unsigned int getNumUnmounts() { return sNumUnmounts; }
+    static unsigned int getNumAttempts() { return sNumAttempts; }
+    static unsigned int getNumGivenUp() { return sNumGivenUp; }
+    static unsigned int getNumTerm() { return sNumTerm; }
+    static unsigned int getNumKill() { return sNumKill; }
+
+    /* "<path>: <n> attempts in <ms> ms (start+took ...)" for the dump */
+    static void describeLast(char *buf, size_t size);
+
+private:
+    struct Attempt {
+        int startMs;
+        int tookMs;
+    };
+
+    OpenFileScanner  mOwnScanner;
+    OpenFileScanner *mScanner;
+    bool             mForce;
+    int              mInitialBackoffMs;
+    int              mBackoffMs;
+    int              mMaxBackoffMs;
+    int64_t          mDeadline;
+    int64_t          mTermAt;
+
+    static pthread_mutex_t sLock;
+    static unsigned int    sNumUnmounts;
+    static unsigned int    sNumAttempts;
+    static unsigned int    sNumGivenUp;
+    static unsigned int    sNumTerm;
+    static unsigned int    sNumKill;
+    static char            sLastPath[PATH_MAX];
+    static int             sLastResult;
+    static int64_t         sLastMs;
+    static int             sLastNumAttempts;
+    static Attempt         sLastAttempts[MAX_RECORDED];
+
+    static int getSetting(const char *type, const char *name, int def);
+    int chooseAction(int64_t now, int holders);
+};
+
+#endif
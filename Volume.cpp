@@ -20,6 +20,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -41,15 +42,15 @@
 #include <cutils/fs.h>
 #include <cutils/log.h>
 
-#include <string>
-
 #include "Volume.h"
 #include "VolumeManager.h"
 #include "ResponseCode.h"
 #include "Fat.h"
+#include "FsProbe.h"
+#include "Filesystems.h"
+#include "ToolRunner.h"
 //+NATIVE_PLATFORM
 #ifdef FUNCTION_STORAGE_TUXERA_PATCH    
-#include "Filesystems.h"
 #include "ExFat.h"
 #endif
 //-NATIVE_PLATFORM
@@ -58,12 +59,9 @@
 #include "Ntfs.h" // For telechips
 #endif
 //-NATIVE_PLATFORM
-//+NATIVE_PLATFORM Support Cdrom
-#ifdef FUNCTION_STORAGE_SUPPORT_CDROM
 #include "fusefs.h"
-#endif
-//-NATIVE_PLATFORM
 #include "Process.h"
+#include "UnmountPolicy.h"
 #include "cryptfs.h"
 //+NATIVE_PLATFORM
 #ifdef FUNCTION_STORAGE_FOR_AUTOMOTIVE
@@ -105,7 +103,13 @@ const char *Volume::ASECDIR           = "/mnt/asec";
  */
 const char *Volume::LOOPDIR           = "/mnt/obb";
 
-const char *Volume::BLKID_PATH = "/system/bin/blkid";
+
+static int64_t nowMs() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
 static const char *stateToStr(int state) {
     if (state == Volume::State_Init)
@@ -155,6 +159,8 @@ Volume::Volume(VolumeManager *vm, const fstab_rec* rec, int flags) {
     mMultiMount = true;
     mRemoving = 0;
     pthread_mutex_init(&mLock, NULL);
+    mCheckGeneration = 0;
+    mCheckedDevicePath[0] = '\0';
     //===========================
 
     //+FW_STANDARD Removal of VoldResponseCode.VolumeDiskPrepared
@@ -188,7 +194,12 @@ void Volume::handleVolumeShared() {
 void Volume::handleVolumeUnshared() {
 }
 
-int Volume::handleBlockEvent(NetlinkEvent *evt) {
+int Volume::handleBlockEvent(const BlockUevent *evt) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int Volume::handleBlockEvent(const BlockUevent *evt, int pathIndex) {
     errno = ENOSYS;
     return -1;
 }
@@ -257,6 +268,10 @@ void Volume::setState(int state) {
 
     mVm->getBroadcaster()->sendBroadcast(ResponseCode::VolumeStateChange,
                                          msg, false);
+
+    if (mState == Volume::State_Idle) {
+        mVm->notifyVolumeIdle(this);
+    }
 }
 
 //===========================
@@ -412,7 +427,7 @@ int Volume::formatVol(const char* path, const char* fstype, bool wipe) { // For
     SLOGI("Formatting volume %s (%s)", getLabel(), devicePath);
 
     if (!strcmp(fstype, "ntfs")) {
-        if (Ntfs::format(devicePath, 0)) {
+        if (Filesystems::format(FSTYPE_NTFS, devicePath, 0, wipe)) {
 	        SLOGE("Failed to format (%s)", strerror(errno));
 	        goto err;
         }
@@ -438,7 +453,7 @@ int Volume::formatVol(const char* path, const char* fstype, bool wipe) { // For
                     goto err;
                 }
             }
-            else if (ExFat::format(devicePath, 0, false)) {
+            else if (Filesystems::format(FSTYPE_EXFAT, devicePath, 0, wipe)) {
                 SLOGE("Failed to format with exFAT (%s) (%s)",
                     strerror(errno), devicePath);
                 goto err;
@@ -447,7 +462,7 @@ int Volume::formatVol(const char* path, const char* fstype, bool wipe) { // For
         else
         #endif
         //-NATIVE_PLATFORM
-        if (Fat::format(devicePath, 0, wipe)) {
+        if (Filesystems::format(FSTYPE_FAT, devicePath, 0, wipe)) {
 	        SLOGE("Failed to format (%s)", strerror(errno));
             goto err;
         }
@@ -456,33 +471,14 @@ int Volume::formatVol(const char* path, const char* fstype, bool wipe) { // For
     ret = 0;
 
 err:
+    /* The disk or one of its partitions has been rewritten (maybe partly) */
+    mVm->getProbeCache()->invalidateAll();
     setState(Volume::State_Idle);
     return ret;
 }
 
 bool Volume::isMountpointMounted(const char *path) {
-    char device[256];
-    char mount_path[256];
-    char rest[256];
-    FILE *fp;
-    char line[1024];
-
-    if (!(fp = fopen("/proc/mounts", "r"))) {
-        SLOGE("Error opening /proc/mounts (%s)", strerror(errno));
-        return false;
-    }
-
-    while(fgets(line, sizeof(line), fp)) {
-        line[strlen(line)-1] = '\0';
-        sscanf(line, "%255s %255s %255s\n", device, mount_path, rest);
-        if (!strcmp(mount_path, path)) {
-            fclose(fp);
-            return true;
-        }
-    }
-
-    fclose(fp);
-    return false;
+    return mVm->getMountTable()->isMounted(path);
 }
 
 int Volume::mountVol() {
@@ -688,7 +684,12 @@ int Volume::mountVol_l() {
 
         char service[64];
         snprintf(service, 64, "fuse_%s", getLabel());
-        property_set("ctl.start", service);
+        /* Mounted only once apps can see it through the daemon; nofuse has none */
+        if (!(flags & VOL_NOFUSE) &&
+                FuseFS::startService(service, getFuseMountpoint(), FuseFS::SERVICE_TIMEOUT_MS)) {
+            SLOGW("%s is not up (%s), %s may be unreachable for a while", service,
+                    strerror(errno), getFuseMountpoint());
+        }
 
         // For telechips setState(Volume::State_Mounted);
         mCurrentlyMountedKdev = deviceNodes[i];
@@ -746,23 +747,267 @@ int Volume::mountVol_l() {
 
 //===========================
 // For telechips
-#ifdef FUNCTION_STORAGE_TUXERA_PATCH    
-int Volume::mountPartition(const char *devicePath, const char *mountPoint, int uid, int gid, int mask)
-{
-    char fscheck_sdcard[PROPERTY_VALUE_MAX];
-    char fscheck_usb[PROPERTY_VALUE_MAX];
-    bool disableFsChecks;
-    FSType recognizedFS = FSTYPE_UNRECOGNIZED;
+/*
+ * Whether the forked checker has to run before devicePath is mounted.
+ * tcc.vold.fsck.policy.usb / tcc.vold.fsck.policy.sdcard (falling back to
+ * tcc.vold.fsck.policy) is one of
+ *   always - check every mount
+ *   dirty  - check unless the filesystem says it was cleanly unmounted
+ *            (FAT[1] / exFAT VolumeFlags / NTFS $Volume) or the media
+ *            cache knows it unchanged since it last passed
+ *   never  - do not check
+ * Without one, the older tcc.checkdisk.disable* properties decide with
+ * their old defaults: "never" where they turned checks off, else "dirty".
+ */
+bool Volume::needsFsCheck(const char *devicePath) {
+    char policy[PROPERTY_VALUE_MAX];
+    bool usb = !strncmp(&devicePath[16], "8:", 2);
 
-    property_get("tcc.checkdisk.disable.sdcard", fscheck_sdcard, "1");
-    property_get("tcc.checkdisk.disable.usb", fscheck_usb, "1");
+    if (mCheckedDevicePath[0] && !strcmp(devicePath, mCheckedDevicePath)) {
+        SLOGI("Skip check disk : %s (just checked in the background)\n", devicePath);
+        return false;
+    }
 
-    if(strncmp(&devicePath[16], "8:", 2)) {
-        disableFsChecks = (fscheck_sdcard[0] != '0' || fscheck_sdcard[1] != '\0');    // sdcard
+    property_get(usb ? "tcc.vold.fsck.policy.usb" : "tcc.vold.fsck.policy.sdcard", policy, "");
+    if (!policy[0]) {
+        property_get("tcc.vold.fsck.policy", policy, "");
+    }
+    if (!policy[0]) {
+        char disable[PROPERTY_VALUE_MAX];
+
+        #ifdef FUNCTION_STORAGE_TUXERA_PATCH
+        property_get(usb ? "tcc.checkdisk.disable.usb" : "tcc.checkdisk.disable.sdcard",
+                disable, "1");
+        #else
+        /* USB was never checked here */
+        property_get("tcc.checkdisk.disable", disable, "0");
+        if (usb)
+            strcpy(disable, "1");
+        #endif
+        strcpy(policy, strcmp(disable, "0") ? "never" : "dirty");
+    }
+
+    if (!strcmp(policy, "never")) {
+        SLOGW("Skip check disk : %s (policy)\n", devicePath);
+        return false;
+    }
+    if (!strcmp(policy, "always")) {
+        return true;
+    }
+    if (strcmp(policy, "dirty")) {
+        SLOGW("Unknown fsck policy '%s', checking %s", policy, devicePath);
+        return true;
+    }
+
+    FsProbeResult probe;
+    bool checked;
+    if (mVm->getProbeCache()->get(devicePath, &probe, &checked))
+        return true;
+
+    /* Same media as last time, and it passed the check then */
+    if (checked) {
+        SLOGI("Skip check disk : %s (unchanged since last check)\n", devicePath);
+        mVm->getMediaCache()->noteCheckSkipped();
+        return false;
+    }
+    if (probe.state == FSSTATE_CLEAN) {
+        SLOGI("Skip check disk : %s (%s marked clean)\n", devicePath,
+                Filesystems::fsName(probe.type));
+        return false;
+    }
+    return true;
+}
+
+/* The checker may have repaired it: re-probe, and remember it as checked */
+void Volume::noteFsChecked(const char *devicePath) {
+    mVm->getProbeCache()->invalidate(devicePath);
+    mVm->getMediaCache()->markChecked(devicePath);
+}
+
+/*
+ * Runs the checker through the scheduler with the filesystem's deadline,
+ * broadcasting VolumeCheckProgress ("label path percent") as its output
+ * moves on. Fails with ETIMEDOUT if the checker was killed at the deadline,
+ * EBUSY if it had no slot within 'maxWaitMs' (see CheckScheduler::check()).
+ * 'runner', if given, is the one cancelling the check goes through.
+ */
+int Volume::checkFs(FSType fsType, const char *devicePath, int maxWaitMs,
+                    ToolRunner *runner, bool *modified) {
+    CheckProgress progress;
+    ToolRunner local;
+
+    if (!runner)
+        runner = &local;
+    progress.volume = this;
+    progress.fsType = fsType;
+    progress.percent = -1;
+    runner->setTimeout(Filesystems::checkDeadline(fsType));
+    runner->setLineCallback(Volume::checkProgressLine, &progress);
+    return mVm->getCheckScheduler()->check(fsType, devicePath, getLabel(), runner, modified,
+            maxWaitMs);
+}
+
+/* Mounted read-only instead of read-write; the next mount checks again */
+void Volume::noteCheckTimedOut() {
+    char msg[255];
+
+    snprintf(msg, sizeof(msg), "%s %s ro", getLabel(), getFuseMountpoint());
+    mVm->getBroadcaster()->sendBroadcast(ResponseCode::VolumeReadOnlyChange, msg, false);
+}
+
+void Volume::checkProgressLine(void *cookie, const char *line) {
+    CheckProgress *progress = reinterpret_cast<CheckProgress *>(cookie);
+    Volume *v = progress->volume;
+    char msg[255];
+
+    /* Rechecking passes start over; the framework only sees it go up */
+    int percent = Filesystems::checkProgress(progress->fsType, line);
+    if (percent <= progress->percent)
+        return;
+    progress->percent = percent;
+    snprintf(msg, sizeof(msg), "%s %s %d", v->getLabel(), v->getFuseMountpoint(), percent);
+    v->mVm->getBroadcaster()->sendBroadcast(ResponseCode::VolumeCheckProgress, msg, false);
+}
+
+/*
+ * With tcc.vold.fsck.background set, a partition that needs checking is
+ * mounted read-only straight away and checked behind the user's back
+ * instead of holding up the mount. Only for filesystems that would be
+ * mounted read-write anyway.
+ */
+bool Volume::deferFsCheck(FSType fsType) {
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get("tcc.vold.fsck.background", value, "0");
+    return !strcmp(value, "1") && Filesystems::isWritable(fsType);
+}
+
+void Volume::startBackgroundCheck(FSType fsType, const char *devicePath, const char *mountPoint,
+                                  int uid, int gid, int mask) {
+    BackgroundCheck *job = new BackgroundCheck();
+    char msg[255];
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    job->volume = this;
+    job->fsType = fsType;
+    strlcpy(job->devicePath, devicePath, sizeof(job->devicePath));
+    strlcpy(job->mountPoint, mountPoint, sizeof(job->mountPoint));
+    job->uid = uid;
+    job->gid = gid;
+    job->mask = mask;
+    job->generation = mCheckGeneration;
+
+    /* Nobody joins: the job finds out on its own whether the volume is still there */
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, Volume::backgroundCheckThread, job)) {
+        SLOGE("Cannot start background check of %s (%s), staying read-only", devicePath,
+                strerror(errno));
+        delete job;
+    } else {
+        /* The job cannot finish before mountVol() lets go of mLock */
+        mBackgroundChecks.push_back(job);
+    }
+    pthread_attr_destroy(&attr);
+
+    snprintf(msg, sizeof(msg), "%s %s ro", getLabel(), getFuseMountpoint());
+    mVm->getBroadcaster()->sendBroadcast(ResponseCode::VolumeReadOnlyChange, msg, false);
+}
+
+void *Volume::backgroundCheckThread(void *obj) {
+    BackgroundCheck *job = reinterpret_cast<BackgroundCheck *>(obj);
+
+    SLOGI("Background check of %s started", job->devicePath);
+    bool modified = false;
+    int rc = job->volume->checkFs(job->fsType, job->devicePath, -1, &job->runner, &modified);
+    job->volume->finishBackgroundCheck(job, rc, modified);
+    delete job;
+    return NULL;
+}
+
+void Volume::finishBackgroundCheck(BackgroundCheck *job, int rc, bool modified) {
+    int err = errno;
+    char msg[255];
+
+    /* mountVol() holds the lock until the volume is fully mounted */
+    pthread_mutex_lock(&mLock);
+    BackgroundCheckCollection::iterator it;
+    for (it = mBackgroundChecks.begin(); it != mBackgroundChecks.end(); ++it) {
+        if (*it == job) {
+            mBackgroundChecks.erase(it);
+            break;
+        }
+    }
+
+    if (job->generation != mCheckGeneration || mRemoving) {
+        SLOGW("%s was unmounted during its background check", job->devicePath);
+    } else if (rc && err != EUCLEAN) {
+        SLOGE("Background check of %s failed (%s), staying read-only", job->devicePath,
+                strerror(err));
+    } else {
+        /* Remember the media as checked before a read-write mount marks it */
+        if (!rc) {
+            noteFsChecked(job->devicePath);
+        } else {
+            SLOGW("%s has errors its checker left unrepaired, mounting anyway",
+                    job->devicePath);
+            mVm->getProbeCache()->invalidate(job->devicePath);
+        }
+
+        if (modified) {
+            remountRepaired(job);
+        } else if (Filesystems::doMount(job->fsType, job->devicePath, job->mountPoint, false,
+                true, false, job->uid, job->gid, job->mask, false)) {
+            SLOGE("Cannot remount %s read-write (%s)", job->mountPoint, strerror(errno));
+        } else {
+            SLOGI("%s checked, remounted read-write", job->devicePath);
+            snprintf(msg, sizeof(msg), "%s %s rw", getLabel(), getFuseMountpoint());
+            mVm->getBroadcaster()->sendBroadcast(ResponseCode::VolumeReadOnlyChange, msg,
+                    false);
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+/*
+ * The checker wrote behind the read-only mount, so the driver's superblock,
+ * FAT and inodes are stale; remounted read-write in place, it would write
+ * them back over the repair. Unmount the volume and mount it afresh
+ * instead, without running the checker on that partition again. If it
+ * cannot be unmounted it stays read-only. Called with mLock held.
+ */
+void Volume::remountRepaired(const BackgroundCheck *job) {
+    char msg[255];
+
+    SLOGI("%s repaired behind its mount, mounting it again", job->devicePath);
+    if (unmountVol_l(false, false, NULL, 0)) {
+        SLOGE("Cannot unmount repaired %s (%s), staying read-only", job->devicePath,
+                strerror(errno));
+        return;
+    }
+
+    strlcpy(mCheckedDevicePath, job->devicePath, sizeof(mCheckedDevicePath));
+    int rc = mountVol_l();
+    mCheckedDevicePath[0] = '\0';
+    if (rc) {
+        SLOGE("Cannot mount repaired %s again (%s)", job->devicePath, strerror(errno));
+        return;
     }
-    else {
-        disableFsChecks = (fscheck_usb[0] != '0' || fscheck_usb[1] != '\0');    // usb
+
+    /* Unless another partition went back to a background check */
+    if (mBackgroundChecks.empty()) {
+        snprintf(msg, sizeof(msg), "%s %s rw", getLabel(), getFuseMountpoint());
+        mVm->getBroadcaster()->sendBroadcast(ResponseCode::VolumeReadOnlyChange, msg, false);
     }
+}
+
+#ifdef FUNCTION_STORAGE_TUXERA_PATCH    
+int Volume::mountPartition(const char *devicePath, const char *mountPoint, int uid, int gid, int mask)
+{
+    FSType recognizedFS = FSTYPE_UNRECOGNIZED;
+    bool deferCheck = false;
+    bool checkTimedOut = false;
 
     //+NATIVE_PLATFORM Support Cdrom
     #ifdef FUNCTION_STORAGE_SUPPORT_CDROM
@@ -823,38 +1068,56 @@ int Volume::mountPartition(const char *devicePath, const char *mountPoint, int u
             return -2;
         }
 
-        if (!disableFsChecks && Filesystems::check(recognizedFS, devicePath)) {
-            if (recognizedFS == FSTYPE_FAT && errno == ENODATA) {
-                /* Remove when reliable FAT detection code has been added. */
+        if (!needsFsCheck(devicePath)) {
+            // nothing to do
+        } else if (deferFsCheck(recognizedFS)) {
+            deferCheck = true;
+        } else if (checkFs(recognizedFS, devicePath, CheckScheduler::MAX_SYNC_WAIT_MS)) {
+            if (errno == EBUSY && Filesystems::isWritable(recognizedFS)) {
+                /* Other checks hold the host: read-only now, checked once it is free */
+                SLOGW("%s waits for other checks, mounting read-only meanwhile", devicePath);
+                deferCheck = true;
+            } else if (errno == ETIMEDOUT || errno == EBUSY) {
+                /* Better read-only now than nothing at all */
+                SLOGW("%s not checked in time, mounting read-only", devicePath);
+                checkTimedOut = true;
+            } else if (errno == EUCLEAN) {
+                /* Mounted as before, but checked again next time */
+                SLOGW("%s has errors its checker left unrepaired, mounting anyway", devicePath);
+                mVm->getProbeCache()->invalidate(devicePath);
+            } else if (recognizedFS == FSTYPE_FAT && errno == ENODATA) {
+                /* Valid looking BPB, but fsck_msdos disagrees */
                 SLOGW("%s does not contain a FAT filesystem\n", devicePath);
                 return -2;
+            } else {
+                errno = EIO;
+                /* Badness - abort the mount */
+                SLOGE("%s failed FS checks (%s)", devicePath, strerror(errno));
+                setState(Volume::State_Idle);
+                return -1;
             }
-            errno = EIO;
-            /* Badness - abort the mount */
-            SLOGE("%s failed FS checks (%s)", devicePath, strerror(errno));
-            setState(Volume::State_Idle);
-            return -1;
-		}
+		} else {
+            noteFsChecked(devicePath);
+        }
     }
 
-    // added exfat, ntfs to writable (2017.09.04)
-    #ifdef FEATURE_ENABLE_NTFS_EXFAT_READWRITE
-    bool isWritableUsb = ((recognizedFS == FSTYPE_FAT) 
-                        || (recognizedFS == FSTYPE_EXFAT) 
-                        || (recognizedFS == FSTYPE_NTFS));
-    #else
-    bool isWritableUsb = (recognizedFS == FSTYPE_FAT);
-    #endif
+    bool isWritableUsb = Filesystems::isWritable(recognizedFS);
     bool readonly = isReadOnlyMedia(getFuseMountpoint(),(int)isWritableUsb); // <- changed from getMountpoint for Kitkat
     
     mkdir(mountPoint, mask);
 
-    if (recognizedFS != FSTYPE_UNRECOGNIZED && Filesystems::doMount(recognizedFS, devicePath, mountPoint, readonly, false, false,
-            uid, gid, mask, true)) {
+    if (recognizedFS != FSTYPE_UNRECOGNIZED && Filesystems::doMount(recognizedFS, devicePath, mountPoint,
+            readonly || deferCheck || checkTimedOut, false, false, uid, gid, mask, true)) {
         SLOGE("%s failed to mount via %s (%s)\n", Filesystems::fsName(recognizedFS), devicePath, strerror(errno));
         return -3;
     }
 
+    if (deferCheck && !readonly) {
+        startBackgroundCheck(recognizedFS, devicePath, mountPoint, uid, gid, mask);
+    } else if (checkTimedOut && !readonly) {
+        noteCheckTimedOut();
+    }
+
     //+NATIVE_PLATFORM Support Cdrom
     #ifdef FUNCTION_STORAGE_SUPPORT_CDROM
     // === For Lollipop ===
@@ -874,75 +1137,63 @@ int Volume::mountPartition(const char *devicePath, const char *mountPoint, int u
 }
 #else
 int Volume::mountPartition(char *devicePath, char *mountPoint, int uid, int gid, int mask) {
-    int fstype = NOT_CHECK;
-    char fscheck[PROPERTY_VALUE_MAX];
-
-    property_get("tcc.checkdisk.disable", fscheck, "0");
+    FSType recognizedFS = FSTYPE_UNRECOGNIZED;
+    bool isCdrom = false;
+    bool deferCheck = false;
+    bool checkTimedOut = false;
     //+NATIVE_PLATFORM Support Cdrom
     #ifdef FUNCTION_STORAGE_SUPPORT_CDROM
     if (isCdromPoint(getFuseMountpoint())) { // <- changed from getMountpoint for Kitkat
-        fstype = CDFS;
-        // FIXME
-        if (0 && !strcmp(fscheck, "0")) {
-            SLOGW("%s does not contain a CDFS filesystem\n", devicePath);
-            return -1;
-        }
+        isCdrom = true;
 	} else
     #endif
     //-NATIVE_PLATFORM
-    if (!strcmp(fscheck, "0")&& strncmp(&devicePath[16], "8:", 2)) {
-        fstype = FAT;
-        if (Fat::check(devicePath)) {
-            //+NATIVE_PLATFORM
-            #ifdef FUNCTION_STORAGE_SUPPORT_NTFS
-            fstype = NTFS;
-            if (Ntfs::check(devicePath)) 
-            #endif
-            //-NATIVE_PLATFORM
-            {
-                if (errno == ENODATA) {
-                    SLOGW("%s does not contain a FAT(NTFS) filesystem\n", devicePath);
-                    return -1;
-                }
+    {
+        if (Filesystems::detect(devicePath, &recognizedFS) ||
+                !Filesystems::isSupported(recognizedFS)) {
+            SLOGW("%s does not contain a FAT(NTFS) filesystem (%s)\n", devicePath,
+                    Filesystems::fsName(recognizedFS));
+            return -1;
+        }
+
+        if (!needsFsCheck(devicePath)) {
+            // nothing to do
+        } else if (deferFsCheck(recognizedFS)) {
+            deferCheck = true;
+        } else if (checkFs(recognizedFS, devicePath, CheckScheduler::MAX_SYNC_WAIT_MS)) {
+            if (errno == EBUSY && Filesystems::isWritable(recognizedFS)) {
+                /* Other checks hold the host: read-only now, checked once it is free */
+                SLOGW("%s waits for other checks, mounting read-only meanwhile", devicePath);
+                deferCheck = true;
+            } else if (errno == ETIMEDOUT || errno == EBUSY) {
+                /* Better read-only now than nothing at all */
+                SLOGW("%s not checked in time, mounting read-only", devicePath);
+                checkTimedOut = true;
+            } else if (errno == EUCLEAN) {
+                /* Mounted as before, but checked again next time */
+                SLOGW("%s has errors its checker left unrepaired, mounting anyway", devicePath);
+                mVm->getProbeCache()->invalidate(devicePath);
+            } else if (errno == ENODATA) {
+                SLOGW("%s does not contain a FAT(NTFS) filesystem\n", devicePath);
+                return -1;
+            } else {
                 errno = EIO;
                 /* Badness - abort the mount */
                 SLOGE("%s failed FS checks (%s)", devicePath, strerror(errno));
                 return -2;
             }
+        } else {
+            noteFsChecked(devicePath);
         }
-    } else {
-        SLOGW("Skip check disk : %s\n", devicePath);
     }
     
-    // added ntfs to writable (2017.09.04), (exfat is only supported with TUXERA_PATCH)
-    #ifdef FEATURE_ENABLE_NTFS_EXFAT_READWRITE
-    bool isWritableUsb = ((fstype == FAT) 
-                        || (fstype == NTFS));
-    #else
-    bool isWritableUsb = (recognizedFS == FSTYPE_FAT);
-    #endif
+    bool isWritableUsb = Filesystems::isWritable(recognizedFS);
     bool readonly = isReadOnlyMedia(getFuseMountpoint(), (int)isWritableUsb); // <- changed from getMountpoint for Kitkat
     
     mkdir(mountPoint, 0007);
-    if (fstype == FAT) {
-        if (Fat::doMount(devicePath, mountPoint, readonly, false, false,
-                uid, gid, mask, true)) {
-            SLOGE("%s failed to mount via VFAT (%s)\n", devicePath, strerror(errno));
-            return -3;
-        }
-    //+NATIVE_PLATFORM
-    #ifdef FUNCTION_STORAGE_SUPPORT_NTFS
-    } else if (fstype == NTFS) {
-        if (Ntfs::doMount(devicePath, mountPoint, readonly, false, false,
-                uid, gid, mask, true)) {
-            SLOGE("%s failed to mount via NTFS (%s)\n", devicePath, strerror(errno));
-            return -3;
-        }
-    #endif
-    //-NATIVE_PLATFORM
     //+NATIVE_PLATFORM Support Cdrom
     #ifdef FUNCTION_STORAGE_SUPPORT_CDROM
-    } else if (fstype == CDFS) {
+    if (isCdrom) {
         // === For Lollipop ===
         // changed mountPoint -> getFuseMountPoint() for cdrom 
         // because mounting cdrom use not aosp 'fuse_cdrom' service(/system/bin/sdcard at init.tcc893x.rc) 
@@ -952,17 +1203,21 @@ int Volume::mountPartition(char *devicePath, char *mountPoint, int uid, int gid,
             SLOGE("%s failed to mount via FuseFS (%s)\n", devicePath, strerror(errno));
             return -3;
         }
+        return 0;
+    }
     #endif
     //-NATIVE_PLATFORM
-    } else {
-        if (Fat::doMount(devicePath, mountPoint, readonly, false, false,
-                uid, gid, mask, true)) {
-            //if (Ntfs::doMount(devicePath, mountPoint, false, false, false,
-            //        uid, gid, mask, true)) {
-                SLOGE("%s failed to mount(No check disk)", devicePath);
-                return -3;
-            //}
-        }
+    if (Filesystems::doMount(recognizedFS, devicePath, mountPoint,
+            readonly || deferCheck || checkTimedOut, false, false, uid, gid, mask, true)) {
+        SLOGE("%s failed to mount via %s (%s)\n", devicePath,
+                Filesystems::fsName(recognizedFS), strerror(errno));
+        return -3;
+    }
+
+    if (deferCheck && !readonly) {
+        startBackgroundCheck(recognizedFS, devicePath, mountPoint, uid, gid, mask);
+    } else if (checkTimedOut && !readonly) {
+        noteCheckTimedOut();
     }
     return 0;
 }
@@ -997,56 +1252,48 @@ int Volume::mountAsecExternal() {
     return 0;
 }
 
-int Volume::doUnmount(const char *path, bool force) {
-    int retries = 10;
+/* The backoff and timeout settings to unmount this volume with */
+const char *Volume::getUnmountType() {
+    /* SCSI disks are USB mass storage here */
+    return MAJOR(mCurrentlyMountedKdev) == 8 ? "usb" : "sd";
+}
+
+/*
+ * 'policy', if given, carries the deadline and the holders found across
+ * the calls for every mount of the volume; otherwise 'path' gets one of
+ * its own.
+ */
+int Volume::doUnmount(const char *path, bool force, UnmountPolicy *policy) {
+    UnmountPolicy own(getUnmountType(), force);
+
+    if (!policy) {
+        own.addPath(path);
+        policy = &own;
+    }
 
     if (mDebug) {
         SLOGD("Unmounting {%s}, force = %d", path, force);
     }
 
-    while (retries--) {
-        #ifdef FUNCTION_STORAGE_TUXERA_PATCH    
-        if (!umount2(path, MNT_DETACH) || errno == EINVAL || errno == ENOENT || errno == EIO) {
-        #else
-        if (!umount2(path, MNT_DETACH) || errno == EINVAL || errno == ENOENT) { // For telechips
-        #endif
-            SLOGI("%s sucessfully unmounted", path);
-            return 0;
-        }
-
-        int action = 0;
-
-        if (force) {
-            if (retries == 1) {
-                action = 2; // SIGKILL
-            } else if (retries == 2) {
-                action = 1; // SIGHUP
-            }
-        }
-
-        SLOGW("Failed to unmount %s (%s, retries %d, action %d)",
-                path, strerror(errno), retries, action);
-
-        Process::killProcessesWithOpenFiles(path, action);
-        usleep(1000*1000);
-    }
-    errno = EBUSY;
-    SLOGE("Giving up on unmount %s (%s)", path, strerror(errno));
-    return -1;
+    #ifdef FUNCTION_STORAGE_TUXERA_PATCH    
+    return policy->unmount(path, true);
+    #else
+    return policy->unmount(path); // For telechips
+    #endif
 }
 
-int Volume::unmountVol(bool force, bool revert) {
+int Volume::unmountVol(bool force, bool revert, OpenFileScanner *scanner, int64_t deadlineMs) {
 //===========================
 // For telechips
     int iRet;
 
     pthread_mutex_lock(&mLock);
-    iRet = unmountVol_l(force, revert);
+    iRet = unmountVol_l(force, revert, scanner, deadlineMs);
     pthread_mutex_unlock(&mLock);
     return iRet;
 }
 
-int Volume::unmountVol_l(bool force, bool revert) {
+int Volume::unmountVol_l(bool force, bool revert, OpenFileScanner *scanner, int64_t deadlineMs) {
 //===========================
     int i, rc;
 
@@ -1059,16 +1306,49 @@ int Volume::unmountVol_l(bool force, bool revert) {
         return UNMOUNT_NOT_MOUNTED_ERR;
     }
 
+    /* A background check still running must not remount what we unmount */
+    mCheckGeneration++;
+    char devicePath[255];
+    snprintf(devicePath, sizeof(devicePath), "/dev/block/vold/%d:%d",
+            MAJOR(mCurrentlyMountedKdev), MINOR(mCurrentlyMountedKdev));
+    ToolRunner::cancelByArg(devicePath);
+    /* Including the ones still queued for a checker slot */
+    BackgroundCheckCollection::iterator job;
+    for (job = mBackgroundChecks.begin(); job != mBackgroundChecks.end(); ++job) {
+        mVm->getCheckScheduler()->cancel(&(*job)->runner);
+    }
+
     setState(Volume::State_Unmounting);
-    usleep(1000 * 1000); // Give the framework some time to react
 
+    /*
+     * Apps reach the volume through the fuse daemon; once init reports it
+     * stopped nothing new gets in, and doUnmount() deals with what is
+     * still open on the real mount.
+     */
     char service[64];
+    int stopTimeoutMs = FuseFS::SERVICE_TIMEOUT_MS;
+    if (deadlineMs) {
+        int64_t left = deadlineMs - nowMs();
+        if (left < stopTimeoutMs)
+            stopTimeoutMs = left > 0 ? (int) left : 0;
+    }
     snprintf(service, 64, "fuse_%s", getLabel());
-    property_set("ctl.stop", service);
-    /* Give it a chance to stop.  I wish we had a synchronous way to determine this... */
-    sleep(1);
+    if (!(flags & VOL_NOFUSE) && FuseFS::stopService(service, stopTimeoutMs)) {
+        /* doUnmount() below still takes its mount down */
+        SLOGW("%s did not stop (%s), unmounting anyway", service, strerror(errno));
+    }
 
-    // TODO: determine failure mode if FUSE times out
+    /*
+     * One deadline and one /proc walk for them all; the sub-parts live
+     * under the mount point.
+     */
+    UnmountPolicy policy(getUnmountType(), force, scanner);
+    if (deadlineMs)
+        policy.setDeadline(deadlineMs);
+    policy.addPath(getMountpoint());
+    policy.addPath(getFuseMountpoint());
+    if (providesAsec)
+        policy.addPath(Volume::SEC_ASECDIR_EXT);
 
     //===========================
     // For telechips    
@@ -1085,7 +1365,7 @@ int Volume::unmountVol_l(bool force, bool revert) {
         for (i = 1; i < n; i++) {
             sprintf(mountPoint, "%s/%s%d", getMountpoint(), getLabel(), i+1);
             if (isMountpointMounted(mountPoint)) {
-                if (doUnmount(mountPoint, force) < 0) {
+                if (doUnmount(mountPoint, force, &policy) < 0) {
                     SLOGE("Failed to unmount sub-part: %s", mountPoint);
                     setState(Volume::State_Mounted);
                     return -1;
@@ -1096,19 +1376,19 @@ int Volume::unmountVol_l(bool force, bool revert) {
     }
     //===========================
 
-    if (providesAsec && doUnmount(Volume::SEC_ASECDIR_EXT, force) != 0) {
+    if (providesAsec && doUnmount(Volume::SEC_ASECDIR_EXT, force, &policy) != 0) {
         SLOGE("Failed to unmount secure area on %s (%s)", getMountpoint(), strerror(errno));
         goto out_mounted;
     }
 
     /* Now that the fuse daemon is dead, unmount it */
-    if (doUnmount(getFuseMountpoint(), force) != 0) {
+    if (doUnmount(getFuseMountpoint(), force, &policy) != 0) {
         SLOGE("Failed to unmount %s (%s)", getFuseMountpoint(), strerror(errno));
         goto fail_remount_secure;
     }
 
     /* Unmount the real sd card */
-    if (doUnmount(getMountpoint(), force) != 0) {
+    if (doUnmount(getMountpoint(), force, &policy) != 0) {
         SLOGE("Failed to unmount %s (%s)", getMountpoint(), strerror(errno));
         goto fail_remount_secure;
     }
@@ -1128,6 +1408,8 @@ int Volume::unmountVol_l(bool force, bool revert) {
     setUuid(NULL);
     setUserLabel(NULL);
     setState(Volume::State_Idle);
+    /* The clean state probed at insert no longer holds once we mounted it */
+    mVm->getProbeCache()->invalidate(mCurrentlyMountedKdev);
     mCurrentlyMountedKdev = -1;
     return 0;
 
@@ -1187,54 +1469,22 @@ int Volume::initializeMbr(const char *deviceNode) {
 }
 
 /*
- * Use blkid to extract UUID and label from device, since it handles many
- * obscure edge cases around partition types and formats. Always broadcasts
- * updated metadata values.
+ * Extract UUID and label from the device in-process; FsProbe reports the
+ * same values blkid would without forking it, and the probe cache usually
+ * has them already from initMountpoint(). Always broadcasts updated
+ * metadata values.
  */
 int Volume::extractMetadata(const char* devicePath) {
-    int res = 0;
-
-    std::string cmd;
-    cmd = BLKID_PATH;
-    cmd += " -c /dev/null ";
-    cmd += devicePath;
-
-    FILE* fp = popen(cmd.c_str(), "r");
-    if (!fp) {
-        ALOGE("Failed to run %s: %s", cmd.c_str(), strerror(errno));
-        res = -1;
-        goto done;
-    }
-
-    char line[1024];
-    char value[128];
-    if (fgets(line, sizeof(line), fp) != NULL) {
-        ALOGD("blkid identified as %s", line);
+    FsProbeResult probe;
 
-        char* start = strstr(line, "UUID=");
-        if (start != NULL && sscanf(start + 5, "\"%127[^\"]\"", value) == 1) {
-            setUuid(value);
-        } else {
-            setUuid(NULL);
-        }
-
-        start = strstr(line, "LABEL=");
-        if (start != NULL && sscanf(start + 6, "\"%127[^\"]\"", value) == 1) {
-            setUserLabel(value);
-        } else {
-            setUserLabel(NULL);
-        }
-    } else {
-        ALOGW("blkid failed to identify %s", devicePath);
-        res = -1;
-    }
-
-    pclose(fp);
-
-done:
-    if (res == -1) {
+    if (mVm->getProbeCache()->get(devicePath, &probe) || probe.type == FSTYPE_UNRECOGNIZED) {
+        ALOGW("Failed to identify %s", devicePath);
         setUuid(NULL);
         setUserLabel(NULL);
+        return -1;
     }
-    return res;
+
+    setUuid(probe.uuid[0] ? probe.uuid : NULL);
+    setUserLabel(probe.label[0] ? probe.label : NULL);
+    return 0;
 }
@@ -17,27 +17,23 @@
 #ifndef _VOLUME_H
 #define _VOLUME_H
 
+#include <stdint.h>
+
 #include <utils/List.h>
 #include <fs_mgr.h>
 
-class NetlinkEvent;
+#include "Filesystems.h"
+#include "ToolRunner.h"
+
+struct BlockUevent;
 class VolumeManager;
+class UnmountPolicy;
+class OpenFileScanner;
 
 //===========================
 // For telechips
 // The number of partitions including extended partition
 #define MAX_MOUNT_PART 16
-
-enum {
-    NOT_CHECK,
-    FAT,
-    NTFS,
-    //+NATIVE_PLATFORM
-    #ifdef FUNCTION_STORAGE_FOR_AUTOMOTIVE
-    CDFS,    
-    #endif
-    //-NATIVE_PLATFORM
-};
 //===========================
 
 class Volume {
@@ -68,7 +64,6 @@ public:
     static const char *SEC_ASECDIR_INT;
     static const char *ASECDIR;
     static const char *LOOPDIR;
-    static const char *BLKID_PATH;
 
 protected:
     char* mLabel;
@@ -103,12 +98,47 @@ protected:
      */
     dev_t mCurrentlyMountedKdev;
 
+    /*
+     * A dirty partition mounted read-only while its checker runs in the
+     * background (tcc.vold.fsck.background). Unmounting cancels the
+     * checks in mBackgroundChecks, queued or running, and bumps
+     * mCheckGeneration so a check which finishes afterwards is dropped.
+     */
+    struct BackgroundCheck {
+        Volume       *volume;
+        FSType        fsType;
+        char          devicePath[255];
+        char          mountPoint[255];
+        int           uid;
+        int           gid;
+        int           mask;
+        unsigned int  generation;
+        ToolRunner    runner;
+    };
+    typedef android::List<BackgroundCheck *> BackgroundCheckCollection;
+    BackgroundCheckCollection mBackgroundChecks;
+    unsigned int mCheckGeneration;
+    /* Repaired in the background and mounted again; not checked once more */
+    char mCheckedDevicePath[255];
+
+    /* What checkFs() last told the framework about a running checker */
+    struct CheckProgress {
+        Volume  *volume;
+        FSType   fsType;
+        int      percent;
+    };
+
 public:
     Volume(VolumeManager *vm, const fstab_rec* rec, int flags);
     virtual ~Volume();
 
     virtual int mountVol(); // For telechips
-    virtual int unmountVol(bool force, bool revert); // For telechips
+    /*
+     * 'scanner' is shared with other volumes unmounting at the same time;
+     * 'deadlineMs', CLOCK_MONOTONIC, bounds it below the per-type timeout.
+     */
+    virtual int unmountVol(bool force, bool revert, OpenFileScanner *scanner = NULL,
+                           int64_t deadlineMs = 0); // For telechips
     int formatVol(const char* path, const char* fstype, bool wipe); // For telechips
 
     const char* getLabel() { return mLabel; }
@@ -121,7 +151,8 @@ public:
     virtual const char *getMountpoint() = 0;
     virtual const char *getFuseMountpoint() = 0;
 
-    virtual int handleBlockEvent(NetlinkEvent *evt);
+    virtual int handleBlockEvent(const BlockUevent *evt);
+    virtual int handleBlockEvent(const BlockUevent *evt, int pathIndex);
     virtual dev_t getDiskDevice();
     virtual dev_t getShareDevice();
     virtual void handleVolumeShared();
@@ -153,7 +184,8 @@ private:
     int initializeMbr(const char *deviceNode);
     bool isMountpointMounted(const char *path);
     int mountAsecExternal();
-    int doUnmount(const char *path, bool force);
+    const char *getUnmountType();
+    int doUnmount(const char *path, bool force, UnmountPolicy *policy = NULL);
     int extractMetadata(const char* devicePath);
     //===========================
     // For telechips
@@ -162,9 +194,21 @@ private:
     #else
     int mountPartition(char *devicePath, char*mountPoint, int uid, int gid, int mask);
     #endif
+    bool needsFsCheck(const char *devicePath);
+    void noteFsChecked(const char *devicePath);
+    int checkFs(FSType fsType, const char *devicePath, int maxWaitMs,
+                ToolRunner *runner = NULL, bool *modified = NULL);
+    void noteCheckTimedOut();
+    static void checkProgressLine(void *cookie, const char *line);
+    bool deferFsCheck(FSType fsType);
+    void startBackgroundCheck(FSType fsType, const char *devicePath, const char *mountPoint,
+                              int uid, int gid, int mask);
+    void finishBackgroundCheck(BackgroundCheck *job, int rc, bool modified);
+    void remountRepaired(const BackgroundCheck *job);
+    static void *backgroundCheckThread(void *obj);
 
     int mountVol_l();
-    int unmountVol_l(bool force, bool revert);
+    int unmountVol_l(bool force, bool revert, OpenFileScanner *scanner, int64_t deadlineMs);
     //===========================
 };
 
@@ -23,8 +23,10 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/sysmacros.h>
 #include <sys/mount.h>
 #include <dirent.h>
+#include <time.h>
 
 #include <linux/kdev_t.h>
 
@@ -34,6 +36,7 @@
 
 #include <cutils/fs.h>
 #include <cutils/log.h>
+#include <cutils/properties.h>
 
 #include <sysutils/NetlinkEvent.h>
 
@@ -41,6 +44,7 @@
 
 #include "VolumeManager.h"
 #include "DirectVolume.h"
+#include "BlockUevent.h"
 #include "ResponseCode.h"
 #include "Loop.h"
 #include "Ext4.h"
@@ -49,12 +53,19 @@
 #include "Process.h"
 #include "Asec.h"
 #include "cryptfs.h"
+#include "ToolRunner.h"
+#include "OpenFileScanner.h"
+#include "UnmountPolicy.h"
 //+NATIVE_PLATFORM
 #ifdef FUNCTION_STORAGE_FOR_AUTOMOTIVE
 #include "utils.h"
 #endif
 //-NATIVE_PLATFORM
 
+#ifndef CLOCK_BOOTTIME
+#define CLOCK_BOOTTIME 7
+#endif
+
 //B090162
 #define MASS_STORAGE_FILE_PATH  "/sys/class/android_usb/android0/f_mass_storage/lun/file"
 //===========================
@@ -81,10 +92,33 @@ VolumeManager::VolumeManager() {
     // set dirty ratio to 5 when UMS is active
     mUmsDirtyRatio = 5; // For telechip 0 -> 5
     mVolManagerDisabled = 0;
+    mDevpathIndex = new DevpathIndex();
+    mNextVolumeOrder = 0;
+    mBlockEventsRouted = 0;
+    mBlockEventsDeclined = 0;
+    mBlockEventsUnmatched = 0;
+    mCoalescer = new UeventCoalescer(this);
+    mMediaCache = new MediaCache(MediaCache::DEFAULT_PATH);
+    mProbeCache = new ProbeCache();
+    mProbeCache->setMediaCache(mMediaCache);
+    mCheckScheduler = new CheckScheduler();
+    mMountTable = new MountTable(MountTable::DEFAULT_PATH);
+    mFirstIdleMs = -1;
+    mFirstIdleLabel[0] = '\0';
+    mNumUnmountAlls = 0;
+    mLastUnmountAllVolumes = 0;
+    mLastUnmountAllMissed = 0;
+    mLastUnmountAllMs = 0;
 }
 
 VolumeManager::~VolumeManager() {
     delete mVolumes;
+    delete mCoalescer;
+    delete mProbeCache;
+    delete mMediaCache;
+    delete mCheckScheduler;
+    delete mMountTable;
+    delete mDevpathIndex;
     delete mActiveContainers;
 }
 
@@ -129,41 +163,150 @@ void VolumeManager::setDebug(bool enable) {
 }
 
 int VolumeManager::start() {
-    return 0;
+    return mCoalescer->start();
 }
 
 int VolumeManager::stop() {
-    return 0;
+    return mCoalescer->stop();
 }
 
 int VolumeManager::addVolume(Volume *v) {
     mVolumes->push_back(v);
+    /* Routing keeps the fstab order when several volumes claim a devpath */
+    mDevpathIndex->setOrder(v, mNextVolumeOrder++);
     return 0;
 }
 
-void VolumeManager::handleBlockEvent(NetlinkEvent *evt) {
-    const char *devpath = evt->findParam("DEVPATH");
+/*
+ * Called on the netlink thread. Events go through the coalescer when it is
+ * running and reach handleBlockEvent() from its thread.
+ */
+void VolumeManager::queueBlockEvent(const BlockUevent *evt) {
+    mCoalescer->post(evt);
+}
+
+void VolumeManager::handleBlockEvent(const BlockUevent *evt) {
+    const char *devpath = evt->devpath;
+
+    /* Whatever was probed on this device may be stale now */
+    if (evt->action == NetlinkEvent::NlActionChange ||
+            evt->action == NetlinkEvent::NlActionRemove) {
+        if (evt->isDisk()) {
+            mProbeCache->invalidateAll();
+        } else {
+            mProbeCache->invalidate(makedev(evt->major, evt->minor));
+        }
+    }
 
     /* Lookup a volume to handle this device */
-    VolumeCollection::iterator it;
+    DevpathIndex::Match matches[DevpathIndex::MAX_MATCHES];
+    int count = mDevpathIndex->lookup(devpath, matches, DevpathIndex::MAX_MATCHES);
     bool hit = false;
-    for (it = mVolumes->begin(); it != mVolumes->end(); ++it) {
-        if (!(*it)->handleBlockEvent(evt)) {
+    for (int i = 0; i < count; i++) {
+        if (!matches[i].volume->handleBlockEvent(evt, matches[i].pathIndex)) {
 #ifdef NETLINK_DEBUG
-            SLOGD("Device '%s' event handled by volume %s\n", devpath, (*it)->getLabel());
+            SLOGD("Device '%s' event handled by volume %s\n", devpath, matches[i].volume->getLabel());
 #endif
             hit = true;
             break;
         }
     }
 
-    if (!hit) {
+    if (hit) {
+        mBlockEventsRouted++;
+    } else {
+        if (count) {
+            mBlockEventsDeclined++;
+        } else {
+            mBlockEventsUnmatched++;
+        }
 #ifdef NETLINK_DEBUG
         SLOGW("No volumes handled block event for '%s'", devpath);
 #endif
     }
 }
 
+/*
+ * Boot-to-media-ready: records how long after boot the first volume
+ * became Idle (media present and ready to mount).
+ */
+void VolumeManager::notifyVolumeIdle(Volume *v) {
+    struct timespec ts;
+    char value[PROPERTY_VALUE_MAX];
+
+    if (mFirstIdleMs >= 0)
+        return;
+
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    mFirstIdleMs = (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    strlcpy(mFirstIdleLabel, v->getLabel(), sizeof(mFirstIdleLabel));
+
+    SLOGI("First volume ready: %s at %lld ms after boot", mFirstIdleLabel, mFirstIdleMs);
+    snprintf(value, sizeof(value), "%lld", mFirstIdleMs);
+    property_set("tcc.vold.first_idle_ms", value);
+}
+
+int VolumeManager::dumpStats(SocketClient *cli) {
+    char msg[255];
+    char last[200];
+
+    snprintf(msg, sizeof(msg), "devpath index: %d paths, %d nodes",
+            mDevpathIndex->getNumPaths(), mDevpathIndex->getNumNodes());
+    cli->sendMsg(0, msg, false);
+    snprintf(msg, sizeof(msg), "block events: routed %u, declined %u, unmatched %u",
+            mBlockEventsRouted, mBlockEventsDeclined, mBlockEventsUnmatched);
+    cli->sendMsg(0, msg, false);
+    snprintf(msg, sizeof(msg), "uevent coalescing: window %d ms, posted %u, batches %u, cancelled %u, delivered %u",
+            mCoalescer->getWindowMs(), mCoalescer->getNumPosted(), mCoalescer->getNumBatches(),
+            mCoalescer->getNumCancelled(), mCoalescer->getNumDelivered());
+    cli->sendMsg(0, msg, false);
+    snprintf(msg, sizeof(msg), "probe cache: %d entries, generation %u, hits %u, misses %u, invalidated %u",
+            mProbeCache->getNumEntries(), mProbeCache->getGeneration(), mProbeCache->getNumHits(),
+            mProbeCache->getNumMisses(), mProbeCache->getNumInvalidated());
+    cli->sendMsg(0, msg, false);
+    snprintf(msg, sizeof(msg), "media cache: %d entries, hits %u, misses %u, evicted %u, checks skipped %u",
+            mMediaCache->getNumEntries(), mMediaCache->getNumHits(), mMediaCache->getNumMisses(),
+            mMediaCache->getNumEvicted(), mMediaCache->getNumChecksSkipped());
+    cli->sendMsg(0, msg, false);
+    snprintf(msg, sizeof(msg),
+            "fs checks: %d running, %u run, %u queued, %u moved to the front, %u deferred",
+            mCheckScheduler->getNumRunning(), mCheckScheduler->getNumChecks(),
+            mCheckScheduler->getNumQueued(), mCheckScheduler->getNumPromoted(),
+            mCheckScheduler->getNumBusy());
+    cli->sendMsg(0, msg, false);
+    snprintf(msg, sizeof(msg), "mount table: %d mounts, %u lookups, %u refreshes",
+            mMountTable->getNumMounts(), mMountTable->getNumLookups(),
+            mMountTable->getNumRefreshes());
+    cli->sendMsg(0, msg, false);
+    snprintf(msg, sizeof(msg), "open-file scans: %u full, %u reused, %lld ms",
+            OpenFileScanner::getNumFullScans(), OpenFileScanner::getNumReusedScans(),
+            OpenFileScanner::getTotalScanMs());
+    cli->sendMsg(0, msg, false);
+    snprintf(msg, sizeof(msg), "unmounts: %u, %u attempts, %u given up, %u SIGTERM, %u SIGKILL",
+            UnmountPolicy::getNumUnmounts(), UnmountPolicy::getNumAttempts(),
+            UnmountPolicy::getNumGivenUp(), UnmountPolicy::getNumTerm(),
+            UnmountPolicy::getNumKill());
+    cli->sendMsg(0, msg, false);
+    UnmountPolicy::describeLast(last, sizeof(last));
+    snprintf(msg, sizeof(msg), "last unmount: %s", last);
+    cli->sendMsg(0, msg, false);
+    snprintf(msg, sizeof(msg), "unmount all: %u runs, last %d volumes in %lld ms, %d missed",
+            mNumUnmountAlls, mLastUnmountAllVolumes, mLastUnmountAllMs, mLastUnmountAllMissed);
+    cli->sendMsg(0, msg, false);
+    snprintf(msg, sizeof(msg), "external tools: %u run, %u killed, wall %lld ms, cpu %lld ms",
+            ToolRunner::getNumRuns(), ToolRunner::getNumKilled(), ToolRunner::getTotalWallMs(),
+            ToolRunner::getTotalCpuMs());
+    cli->sendMsg(0, msg, false);
+    if (mFirstIdleMs >= 0) {
+        snprintf(msg, sizeof(msg), "first volume ready: %s at %lld ms after boot",
+                mFirstIdleLabel, mFirstIdleMs);
+    } else {
+        snprintf(msg, sizeof(msg), "first volume ready: none yet");
+    }
+    cli->sendMsg(0, msg, false);
+    return 0;
+}
+
 int VolumeManager::listVolumes(SocketClient *cli) {
     VolumeCollection::iterator i;
 
@@ -1397,48 +1540,50 @@ int VolumeManager::mountVolume(const char *label) {
     return ret;
 }
 
+int VolumeManager::setForegroundVolume(const char *label) {
+    if (!strcmp(label, "none")) {
+        mCheckScheduler->setForeground(NULL);
+        return 0;
+    }
+
+    Volume *v = lookupVolume(label);
+    if (!v) {
+        errno = ENOENT;
+        return -1;
+    }
+    mCheckScheduler->setForeground(v->getLabel());
+    return 0;
+}
+
+static void collectObbDevice(void *cookie, const char *source, const char *mountPoint) {
+    android::List<char *> *devices = (android::List<char *> *) cookie;
+
+    devices->push_back(strdup(source));
+}
+
 int VolumeManager::listMountedObbs(SocketClient* cli) {
-    char device[256];
-    char mount_path[256];
-    char rest[256];
-    FILE *fp;
-    char line[1024];
-
-    if (!(fp = fopen("/proc/mounts", "r"))) {
-        SLOGE("Error opening /proc/mounts (%s)", strerror(errno));
-        return -1;
-    }
-
-    // Create a string to compare against that has a trailing slash
-    int loopDirLen = strlen(Volume::LOOPDIR);
-    char loopDir[loopDirLen + 2];
-    strcpy(loopDir, Volume::LOOPDIR);
-    loopDir[loopDirLen++] = '/';
-    loopDir[loopDirLen] = '\0';
-
-    while(fgets(line, sizeof(line), fp)) {
-        line[strlen(line)-1] = '\0';
-
-        /*
-         * Should look like:
-         * /dev/block/loop0 /mnt/obb/fc99df1323fd36424f864dcb76b76d65 ...
-         */
-        sscanf(line, "%255s %255s %255s\n", device, mount_path, rest);
-
-        if (!strncmp(mount_path, loopDir, loopDirLen)) {
-            int fd = open(device, O_RDONLY);
-            if (fd >= 0) {
-                struct loop_info64 li;
-                if (ioctl(fd, LOOP_GET_STATUS64, &li) >= 0) {
-                    cli->sendMsg(ResponseCode::AsecListResult,
-                            (const char*) li.lo_file_name, false);
-                }
-                close(fd);
+    android::List<char *> devices;
+
+    /*
+     * Should look like:
+     * /dev/block/loop0 on /mnt/obb/fc99df1323fd36424f864dcb76b76d65
+     * Copied out first: the ioctls need not run under the table lock.
+     */
+    mMountTable->forEachUnder(Volume::LOOPDIR, collectObbDevice, &devices);
+
+    android::List<char *>::iterator it;
+    for (it = devices.begin(); it != devices.end(); ++it) {
+        int fd = open(*it, O_RDONLY);
+        if (fd >= 0) {
+            struct loop_info64 li;
+            if (ioctl(fd, LOOP_GET_STATUS64, &li) >= 0) {
+                cli->sendMsg(ResponseCode::AsecListResult,
+                        (const char*) li.lo_file_name, false);
             }
+            close(fd);
         }
+        free(*it);
     }
-
-    fclose(fp);
     return 0;
 }
 
@@ -1677,6 +1822,11 @@ extern "C" int vold_disableVol(const char *label) {
     return vm->unmountVolume(label, true, false);
 }
 
+extern "C" int vold_probeDevice(const char *devPath, FsProbeResult *result) {
+    VolumeManager *vm = VolumeManager::Instance();
+    return vm->getProbeCache()->get(devPath, result);
+}
+
 extern "C" int vold_getNumDirectVolumes(void) {
     VolumeManager *vm = VolumeManager::Instance();
     return vm->getNumDirectVolumes();
@@ -1741,6 +1891,96 @@ int VolumeManager::unmountVolume(const char *label, bool force, bool revert) {
     return v->unmountVol(force, revert);
 }
 
+void *VolumeManager::unmountThread(void *arg) {
+    UnmountJob *job = (UnmountJob *) arg;
+
+    job->rc = job->volume->unmountVol(true, false, job->scanner, job->deadlineMs);
+    return NULL;
+}
+
+int VolumeManager::unmountAll(int64_t deadlineMs, char *missed, size_t size) {
+    struct timespec ts;
+    VolumeCollection::iterator i;
+    OpenFileScanner scanner;
+    int n = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t start = (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+    /*
+     * Sized for every volume: the coalescer can bring one back to Mounted
+     * while we go, so the targets are picked in this one pass only.
+     */
+    size_t numVolumes = mVolumes->size();
+    UnmountJob *jobs = new UnmountJob[numVolumes];
+    pthread_t *threads = new pthread_t[numVolumes];
+    bool *started = new bool[numVolumes];
+
+    /*
+     * One walk of /proc finds whoever holds any of them. ASECs and OBBs
+     * go first and one at a time: they live on the volumes, and
+     * mActiveContainers has no lock of its own.
+     */
+    for (i = mVolumes->begin(); i != mVolumes->end() && (size_t) n < numVolumes; ++i) {
+        Volume *v = *i;
+
+        if (v->getState() != Volume::State_Mounted)
+            continue;
+        scanner.addPath(v->getMountpoint());
+        scanner.addPath(v->getFuseMountpoint());
+        cleanupAsec(v, true);
+        jobs[n].volume = v;
+        jobs[n].scanner = &scanner;
+        jobs[n].deadlineMs = deadlineMs;
+        jobs[n].rc = -1;
+        n++;
+    }
+
+    /* The volumes themselves are independent; each has its own lock */
+    for (int j = 0; j < n; j++) {
+        started[j] = !pthread_create(&threads[j], NULL, unmountThread, &jobs[j]);
+        if (!started[j]) {
+            SLOGW("Cannot start unmount of %s (%s), doing it here",
+                    jobs[j].volume->getLabel(), strerror(errno));
+            unmountThread(&jobs[j]);
+        }
+    }
+
+    int numMissed = 0;
+    size_t len = 0;
+    if (size)
+        missed[0] = '\0';
+    for (int j = 0; j < n; j++) {
+        if (started[j])
+            pthread_join(threads[j], NULL);
+        /* Someone else may have got there first */
+        if (!jobs[j].rc || jobs[j].rc == UNMOUNT_NOT_MOUNTED_ERR)
+            continue;
+        SLOGE("Volume %s missed the unmount deadline", jobs[j].volume->getLabel());
+        numMissed++;
+        if (len < size) {
+            len += snprintf(missed + len, size - len, "%s%s", len ? " " : "",
+                    jobs[j].volume->getLabel());
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    mNumUnmountAlls++;
+    mLastUnmountAllVolumes = n;
+    mLastUnmountAllMissed = numMissed;
+    mLastUnmountAllMs = (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000 - start;
+    SLOGI("Unmounted %d of %d volumes in %lld ms", n - numMissed, n, mLastUnmountAllMs);
+
+    delete[] jobs;
+    delete[] threads;
+    delete[] started;
+    if (numMissed) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return 0;
+}
+
 extern "C" int vold_unmountAllAsecs(void) {
     int rc;
 
@@ -1817,28 +2057,7 @@ Volume *VolumeManager::lookupVolume(const char *label) {
 
 bool VolumeManager::isMountpointMounted(const char *mp)
 {
-    char device[256];
-    char mount_path[256];
-    char rest[256];
-    FILE *fp;
-    char line[1024];
-
-    if (!(fp = fopen("/proc/mounts", "r"))) {
-        SLOGE("Error opening /proc/mounts (%s)", strerror(errno));
-        return false;
-    }
-
-    while(fgets(line, sizeof(line), fp)) {
-        line[strlen(line)-1] = '\0';
-        sscanf(line, "%255s %255s %255s\n", device, mount_path, rest);
-        if (!strcmp(mount_path, mp)) {
-            fclose(fp);
-            return true;
-        }
-    }
-
-    fclose(fp);
-    return false;
+    return mMountTable->isMounted(mp);
 }
 
 int VolumeManager::cleanupAsec(Volume *v, bool force) {
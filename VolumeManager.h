@@ -19,11 +19,19 @@
 
 #include <pthread.h>
 
+#include "FsProbe.h"
+
 #ifdef __cplusplus
 #include <utils/List.h>
 #include <sysutils/SocketListener.h>
 
 #include "Volume.h"
+#include "DevpathIndex.h"
+#include "UeventCoalescer.h"
+#include "ProbeCache.h"
+#include "MediaCache.h"
+#include "MountTable.h"
+#include "CheckScheduler.h"
 
 /* The length of an MD5 hash when encoded into ASCII hex characters */
 #define MD5_ASCII_LENGTH_PLUS_NULL ((MD5_DIGEST_LENGTH*2)+1)
@@ -67,19 +75,50 @@ private:
     int                    mUmsDirtyRatio;
     int                    mVolManagerDisabled;
 
+    // devpath prefix -> owning volumes, filled in by DirectVolume::addPath()
+    DevpathIndex          *mDevpathIndex;
+    int                    mNextVolumeOrder;
+    unsigned int           mBlockEventsRouted;
+    unsigned int           mBlockEventsDeclined;
+    unsigned int           mBlockEventsUnmatched;
+    UeventCoalescer       *mCoalescer;
+    ProbeCache            *mProbeCache;
+    MediaCache            *mMediaCache;
+    CheckScheduler        *mCheckScheduler;
+    MountTable            *mMountTable;
+    // CLOCK_BOOTTIME when the first volume reached State_Idle, -1 until then
+    int64_t                mFirstIdleMs;
+    char                   mFirstIdleLabel[64];
+    unsigned int           mNumUnmountAlls;
+    int                    mLastUnmountAllVolumes;
+    int                    mLastUnmountAllMissed;
+    int64_t                mLastUnmountAllMs;
+
 public:
     virtual ~VolumeManager();
 
     int start();
     int stop();
 
-    void handleBlockEvent(NetlinkEvent *evt);
+    void queueBlockEvent(const BlockUevent *evt);
+    void handleBlockEvent(const BlockUevent *evt);
 
     int addVolume(Volume *v);
 
     int listVolumes(SocketClient *cli);
+    int dumpStats(SocketClient *cli);
+    void notifyVolumeIdle(Volume *v);
     int mountVolume(const char *label);
     int unmountVolume(const char *label, bool force, bool revert);
+    /*
+     * Force-unmounts every mounted volume by 'deadlineMs' (CLOCK_MONOTONIC):
+     * their ASECs and OBBs first, then the volumes side by side, sharing
+     * one open-file scan. Volumes that did not make it are listed by label
+     * in 'missed', and give -1 with errno ETIMEDOUT.
+     */
+    int unmountAll(int64_t deadlineMs, char *missed, size_t size);
+    // Its filesystem check goes ahead of others queued on the same host; "none" clears
+    int setForegroundVolume(const char *label);
     int shareVolume(const char *label, const char *method);
     int unshareVolume(const char *label, const char *method);
     int shareEnabled(const char *path, const char *method, bool *enabled);
@@ -131,6 +170,11 @@ public:
 
     void setBroadcaster(SocketListener *sl) { mBroadcaster = sl; }
     SocketListener *getBroadcaster() { return mBroadcaster; }
+    DevpathIndex *getDevpathIndex() { return mDevpathIndex; }
+    ProbeCache *getProbeCache() { return mProbeCache; }
+    MediaCache *getMediaCache() { return mMediaCache; }
+    MountTable *getMountTable() { return mMountTable; }
+    CheckScheduler *getCheckScheduler() { return mCheckScheduler; }
 
     static VolumeManager *Instance();
 
@@ -151,8 +195,16 @@ public:
     int mkdirs(char* path);
 
 private:
+    struct UnmountJob {
+        Volume          *volume;
+        OpenFileScanner *scanner;
+        int64_t          deadlineMs;
+        int              rc;
+    };
+
     VolumeManager();
     void readInitialState();
+    static void *unmountThread(void *arg);
     bool isMountpointMounted(const char *mp);
     bool isAsecInDirectory(const char *dir, const char *asec) const;
     // Vold ASEC(4.4.x)
@@ -166,6 +218,7 @@ extern "C" {
     int vold_getNumDirectVolumes(void);
     int vold_getDirectVolumeList(struct volume_info *v);
     int vold_unmountAllAsecs(void);
+    int vold_probeDevice(const char *devPath, FsProbeResult *result);
 #ifdef __cplusplus
 }
 #endif
@@ -40,7 +40,6 @@
 
 #include "cdfs.h"
 
-extern "C" int logwrap(int argc, const char **argv, int background);
 extern "C" int mount(const char *, const char *, const char *, unsigned long, const void *);
 
 
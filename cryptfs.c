@@ -45,9 +45,9 @@
 #include "cutils/properties.h"
 #include "cutils/android_reboot.h"
 #include "hardware_legacy/power.h"
-#include <logwrap/logwrap.h>
 #include "VolumeManager.h"
 #include "VoldUtil.h"
+#include "ToolRunner.h"
 #include "crypto_scrypt.h"
 
 #define DM_CRYPT_BUF_SIZE 4096
@@ -1473,10 +1473,11 @@ static int cryptfs_enable_wipe(char *crypto_blkdev, off64_t size, int type)
         return -1;
     }
 
-    tmp = android_fork_execvp(num_args, (char **)args, &status, false, true);
+    tmp = runTool(num_args, args, &status);
 
     if (tmp != 0) {
-      SLOGE("Error creating empty filesystem on %s due to logwrap error\n", crypto_blkdev);
+      SLOGE("Error creating empty filesystem on %s, could not run %s (%s)\n", crypto_blkdev,
+            args[0], strerror(errno));
     } else {
         if (WIFEXITED(status)) {
             if (WEXITSTATUS(status)) {
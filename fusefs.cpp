@@ -13,35 +13,89 @@
 #include <cutils/properties.h>
 
 #include "fusefs.h"
+#include "VolumeManager.h"
 
 #define CDROM_NAMECONV "cdrom_nameconv"
 #define CDROM_MNTPNT "/storage/cdrom_actual"
 #define PROP_STOPPED "stopped"
 #define FUSE_MAX_RETRY_TIMEOUT 30
 
-bool FuseFS::isMounted(const char *path) {
-    char device[256];
-    char mount_path[256];
-    char rest[256];
-    FILE *fp;
-    char line[1024];
-    bool mounted = false;
-
-    if (!(fp = fopen("/proc/mounts", "r"))) {
-        SLOGE("Error opening /proc/mounts (%s)", strerror(errno));
-        return mounted;
-    }
+bool FuseFS::waitForMount(const char *path, int timeoutMs) {
+    return VolumeManager::Instance()->getMountTable()->waitFor(path, true, timeoutMs) == 0;
+}
+
+bool FuseFS::isServiceState(const char *service, const char *state) {
+    char name[PROPERTY_KEY_MAX];
+    char value[PROPERTY_VALUE_MAX];
+
+    /* Never started, init has not set it at all */
+    snprintf(name, sizeof(name), "init.svc.%s", service);
+    property_get(name, value, PROP_STOPPED);
+    return !strcmp(value, state);
+}
+
+int FuseFS::startService(const char *service, const char *mountPoint, int timeoutMs) {
+    struct timeval start, end;
+    bool seenRunning = false;
 
-    while(fgets(line, sizeof(line), fp) != NULL) {
-        sscanf(line, "%255s %255s %255s\n", device, mount_path, rest);
-        if (!strcmp(mount_path, path)) {
-            mounted = true;
+    gettimeofday(&start, NULL);
+    property_set("ctl.start", service);
+
+    for (;;) {
+        /* The daemon mounts it once it is ready to serve */
+        if (waitForMount(mountPoint, SERVICE_POLL_MS)) {
             break;
         }
+        if (isServiceState(service, "running")) {
+            seenRunning = true;
+        } else if (seenRunning && isServiceState(service, PROP_STOPPED)) {
+            SLOGE("%s stopped before mounting %s", service, mountPoint);
+            errno = ECHILD;
+            return -1;
+        }
+
+        gettimeofday(&end, NULL);
+        timersub(&end, &start, &end);
+        int elapsedMs = end.tv_sec * 1000 + end.tv_usec / 1000;
+        if (!seenRunning && elapsedMs >= SERVICE_START_MS) {
+            SLOGE("init never reported %s running, not waiting for %s", service, mountPoint);
+            errno = ESRCH;
+            return -1;
+        }
+        if (elapsedMs >= timeoutMs) {
+            SLOGE("%s did not mount %s within %d ms", service, mountPoint, timeoutMs);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+
+    gettimeofday(&end, NULL);
+    timersub(&end, &start, &end);
+    SLOGD("%s ready after %ld.%06ld sec", service, end.tv_sec, end.tv_usec);
+    return 0;
+}
+
+int FuseFS::stopService(const char *service, int timeoutMs) {
+    struct timeval start, end;
+
+    gettimeofday(&start, NULL);
+    property_set("ctl.stop", service);
+
+    while (!isServiceState(service, PROP_STOPPED)) {
+        gettimeofday(&end, NULL);
+        timersub(&end, &start, &end);
+        if (end.tv_sec * 1000 + end.tv_usec / 1000 >= timeoutMs) {
+            SLOGE("%s did not stop within %d ms", service, timeoutMs);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        usleep(SERVICE_POLL_MS * 1000);
     }
 
-    fclose(fp);
-    return mounted;
+    gettimeofday(&end, NULL);
+    timersub(&end, &start, &end);
+    SLOGD("%s stopped after %ld.%06ld sec", service, end.tv_sec, end.tv_usec);
+    return 0;
 }
 
 int FuseFS::doMount(const char *fsPath, const char *mountPoint,
@@ -59,11 +113,11 @@ int FuseFS::doMount(const char *fsPath, const char *mountPoint,
     property_set("ctl.restart", CDROM_NAMECONV);
 
     do {
-        if (isMounted(mountPoint)) {
+        /* Sleeps until the mount table changes, or 100 ms */
+        if (waitForMount(mountPoint, 100)) {
             rc = 0;
             break;
         }
-        usleep(100 * 1000);
 
         property_get("init.svc." CDROM_NAMECONV, prop, PROP_STOPPED);
         if (strcmp(prop, PROP_STOPPED) == 0) {
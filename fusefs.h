@@ -9,8 +9,31 @@ public:
                        bool ro, bool remount, bool executable,
                        int ownerUid, int ownerGid, int permMask,
                        bool createLost);
+
+    static const int SERVICE_TIMEOUT_MS = 5000;
+    /* How long init gets to report a started service as running */
+    static const int SERVICE_START_MS = 500;
+
+    /*
+     * Starts the fuse daemon 'service' and waits, at most timeoutMs, for
+     * it to mount 'mountPoint'. 0, or -1 with errno ETIMEDOUT, ECHILD if
+     * init reports the daemon stopped again first, or ESRCH if init never
+     * reports it running within SERVICE_START_MS (no such service).
+     */
+    static int startService(const char *service, const char *mountPoint, int timeoutMs);
+
+    /*
+     * Stops 'service' and waits, at most timeoutMs, for init to report it
+     * stopped. Its mount stays for the caller to take down.
+     */
+    static int stopService(const char *service, int timeoutMs);
+
 private:
-    static bool isMounted(const char *path);
+    /* How often init.svc.* is looked at; init has no timed wait for it */
+    static const int SERVICE_POLL_MS = 10;
+
+    static bool waitForMount(const char *path, int timeoutMs);
+    static bool isServiceState(const char *service, const char *state);
 };
 
 #endif
@@ -28,6 +28,9 @@
 //===========================
 #include <fcntl.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <limits.h>
+#include <time.h>
 #include <fs_mgr.h>
 
 #define LOG_TAG "Vold"
@@ -47,6 +50,7 @@
 
 static int process_config(VolumeManager *vm);
 static void coldboot(const char *path);
+static void coldboot_block(VolumeManager *vm, const char *path);
 
 #define FSTAB_PREFIX "/fstab."
 struct fstab *fstab;
@@ -54,7 +58,6 @@ struct fstab *fstab;
 //===========================
 // For telechips
 /* USB DRD default mode */
-#define USB_DRD_CMD_VALUE_MAX	50
 
 // host mode
 #define USB_DRD_DEF_HOST	"host"
@@ -77,7 +80,6 @@ int main() {
 	int host_mode = 0;
 	char mode[PROPERTY_VALUE_MAX];
     //char chip[PROPERTY_VALUE_MAX];
-	char usb_config_cmd[USB_DRD_CMD_VALUE_MAX];
     //===========================
 
     //+NATIVE_PLATFORM
@@ -123,7 +125,12 @@ int main() {
     }
 
     coldboot("sys/block/ndda"); // For telechips
-    coldboot("/sys/block");
+    property_get("tcc.vold.coldboot", mode, "filtered");
+    if (!strcmp(mode, "full")) {
+        coldboot("/sys/block");
+    } else {
+        coldboot_block(vm, "/sys/block");
+    }
 //    coldboot("/sys/class/switch");
 
     /*
@@ -145,14 +152,14 @@ int main() {
 	{
 		SLOGI("## Set USB DRD default mode : %s ##",USB_DEF_MODE);
 
-		ret = system("setprop persist.sys.usb.defset done");
-	    if (WIFSIGNALED(ret) && (WTERMSIG(ret) == SIGINT || WTERMSIG(ret) == SIGQUIT)) {
+		// vold may set these itself; no need for a shell and setprop
+		ret = property_set("persist.sys.usb.defset", "done");
+	    if (ret) {
 	         SLOGE("USB default mode set fail - 0(%d).", ret);
 	    }
 
-		sprintf(usb_config_cmd,"setprop persist.sys.usb.config %s",USB_DEF_MODE);
-		ret = system(usb_config_cmd);
-	    if (WIFSIGNALED(ret) && (WTERMSIG(ret) == SIGINT || WTERMSIG(ret) == SIGQUIT)) {
+		ret = property_set("persist.sys.usb.config", USB_DEF_MODE);
+	    if (ret) {
 	         SLOGE("USB default mode set fail - 1(%d).", ret);
 	    }
 	}
@@ -217,6 +224,125 @@ static void coldboot(const char *path)
     }
 }
 
+#define COLDBOOT_DEFAULT_THREADS 2
+#define COLDBOOT_MAX_THREADS 8
+
+struct coldboot_queue {
+    pthread_mutex_t lock;
+    char **dirs;
+    int count;
+    int next;
+};
+
+static void *coldboot_worker(void *arg)
+{
+    struct coldboot_queue *q = (struct coldboot_queue *) arg;
+
+    while (1) {
+        pthread_mutex_lock(&q->lock);
+        int i = q->next++;
+        pthread_mutex_unlock(&q->lock);
+        if (i >= q->count)
+            break;
+
+        DIR *d = opendir(q->dirs[i]);
+        if (d) {
+            /* Level 1: like coldboot("/sys/block") once past the symlink */
+            do_coldboot(d, 1);
+            closedir(d);
+        }
+    }
+    return NULL;
+}
+
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Same as coldboot("/sys/block"), but only replays "add" for the block
+ * devices whose sysfs devpath is claimed by a volume from process_config(),
+ * and spreads the sysfs walk over a few threads.
+ */
+static void coldboot_block(VolumeManager *vm, const char *path)
+{
+    char link[PATH_MAX];
+    char resolved[PATH_MAX];
+    char value[PROPERTY_VALUE_MAX];
+    struct coldboot_queue q;
+    pthread_t threads[COLDBOOT_MAX_THREADS];
+    struct dirent *de;
+    int total = 0;
+    int nthreads;
+    int started = 0;
+    int i;
+    int64_t start = now_ms();
+
+    DIR *d = opendir(path);
+    if (!d)
+        return;
+
+    pthread_mutex_init(&q.lock, NULL);
+    q.dirs = NULL;
+    q.count = 0;
+    q.next = 0;
+
+    while ((de = readdir(d))) {
+        DevpathIndex::Match match;
+
+        if (de->d_name[0] == '.' || !strcmp(de->d_name, "ndda")) // For telechips
+            continue;
+        total++;
+
+        snprintf(link, sizeof(link), "%s/%s", path, de->d_name);
+        if (!realpath(link, resolved) || strncmp(resolved, "/sys/", 5))
+            continue;
+        /* DEVPATH as the kernel reports it is relative to /sys */
+        if (vm->getDevpathIndex()->lookup(resolved + 4, &match, 1) == 0)
+            continue;
+
+        char **dirs = (char **) realloc(q.dirs, (q.count + 1) * sizeof(char *));
+        if (!dirs)
+            break;
+        q.dirs = dirs;
+        q.dirs[q.count++] = strdup(resolved);
+    }
+    closedir(d);
+
+    property_get("tcc.vold.coldboot.threads", value, "");
+    nthreads = value[0] ? atoi(value) : COLDBOOT_DEFAULT_THREADS;
+    if (nthreads > COLDBOOT_MAX_THREADS)
+        nthreads = COLDBOOT_MAX_THREADS;
+    if (nthreads > q.count)
+        nthreads = q.count;
+
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, coldboot_worker, &q)) {
+            SLOGW("coldboot: cannot start worker %d (%s)", i, strerror(errno));
+            break;
+        }
+        started++;
+    }
+    /* Whatever the workers did not take is done here */
+    coldboot_worker(&q);
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    SLOGI("coldboot: %d of %d block devices claimed, %d threads, %lld ms",
+            q.count, total, started, now_ms() - start);
+
+    for (i = 0; i < q.count; i++) {
+        free(q.dirs[i]);
+    }
+    free(q.dirs);
+    pthread_mutex_destroy(&q.lock);
+}
+
 static int process_config(VolumeManager *vm)
 {
     char fstab_filename[PROPERTY_VALUE_MAX + sizeof(FSTAB_PREFIX)];
@@ -27,69 +27,58 @@
 #endif
 
 #include "ntfsutils.h"
+#include "VolumeManager.h"
 
-struct NTFSBoot{
-    unsigned char   bJumpCode[3];      // 0x00: Jump to boot code
-    char            cSystemID[8];      // 0x03: System ID, equals "NTFS    "
+#define NTFS_LABEL_SIZE 12
 
-    unsigned char   wBytesPerSector[2];// 0x0cB: Bytes per sector
-
-    unsigned char   bSectorsPerCluster;// 0x0D: Sectors per cluster
-    unsigned char   Unused1[7];        //
-    unsigned char   bMediaType;        // 0x15: Media type (0xF8 - harddisk)
-    unsigned char   Unused2[2];        //
-    unsigned short  wSectorsPerTrack;  // 0x18: number of sectors per track
-    unsigned short  wHeadNumber;       // 0x1A: number of heads per cylinder
-    unsigned int    HiddenSectors;     // 0x1C: number of 'hidden' sectors
-    unsigned char   Unused3[4];        //
-    unsigned char   bBIOSDriveNumber;  // 0x24: BIOS drive number =0x80
-    unsigned char   bReserved1;
-    unsigned char   bExtendedSignature;// 0x26: Extended BOOT signature =0x80
-    unsigned char   bReserved2;
-    uint64_t        SectorsPerVolume;  // 0x28: size of volume in sectors
-    uint64_t        MFTCluster;        // 0x30: first cluster of $MFT
-    uint64_t        MFTCopyCluster;    // 0x38: first cluster of $MFTMirr
-    signed char     bMFTRecordSize;    // 0x40: size of MFT record in clusters(sectors)
-    unsigned char   bReserved3[3];
-    signed char     bIndexRecordSize;  // 0x44: size of INDX record in clusters(sectors)
-    char            bReserved4[3];
-    uint64_t        SerialNumber;      // 0x48: Volume serial number
-    unsigned int    CheckSum;          // 0x50: Simple additive checksum of all of the ULONGs which precede the Checksum
-
-    unsigned char   BootCode[ 0x200 - 0x50 - 2 - 4 ]; // 0x54: 0x1AA = 426
-    unsigned char   Magic[2];          // 0x1FE: Boot signature =0x55 + 0xAA
-};
+/*
+ * Both readers go through the vold probe cache, so the boot sector is read
+ * and validated (OEM id, sector, cluster and MFT record size) by
+ * FsProbe::probeNtfs() once per device until the device changes.
+ */
+static int readNtfsBoot(const char *devPath, FsProbeResult *probe) {
+    if (vold_probeDevice(devPath, probe) != 0) {
+        SLOGE("cannot probe device: %s %s", devPath, strerror(errno));
+        return -1;
+    }
+    if (probe->type != FSTYPE_NTFS) {
+        return -1;
+    }
+    return 0;
+}
 
 /**
  * ntfs 볼륨의 정보를 얻어옵니다.
  * @param devPath ntfs 볼륨이 포함된 블럭장치의 경로
- * @param label [OUT] ntfs 볼륨의 label, 최대크기는 12byte
- *    현재 사용되지 않으므로 구현하지 않아도 됩니다.
- * @param id [OUT] ntfs 볼륨 MFT의 guid
+ * @param label [OUT] ntfs 볼륨의 label ($Volume), 최대크기는 12byte
+ * @param id [OUT] ntfs 볼륨의 serial number
  * @return ntfs 볼륨에서 데이터를 얻어오면 0
  *    ntfs볼륨이 아니거나, devPath의 경로가 잘못되었거나,
  *    정보를 얻는데 실패하면 -1
  */
 int getNtfsInfo(const char *devPath, char *label, int64_t *id) {
-    struct NTFSBoot boot;
-    FILE *fp = fopen(devPath, "r");
-    if(fp == NULL) {
-        SLOGE("getNtfsId: cannot open device: %s %s", devPath, strerror(errno));
-        return -1;
-    }
+    FsProbeResult probe;
 
-    if ( fread( &boot, 1, sizeof(boot), fp) != sizeof(boot) ) {
-        SLOGE("fread fail. path=%s", devPath);
-        boot.SerialNumber = -1;
-    } else {
-        SLOGD("getNtfsId() id=%llx", boot.SerialNumber);
+    if (readNtfsBoot(devPath, &probe) != 0) {
+        label[0] = '\0';
+        return -1;
     }
 
-    fclose(fp);
+    /* The uuid is the full 64 bit serial in hex */
+    *id = (int64_t) strtoull(probe.uuid, NULL, 16);
 
-    *id = boot.SerialNumber;
-    *label = boot.cSystemID;
+    size_t n = strlen(probe.label);
+    if (n >= NTFS_LABEL_SIZE) {
+        /* don't cut a UTF-8 sequence in half */
+        n = NTFS_LABEL_SIZE - 1;
+        while (n > 0 && ((unsigned char) probe.label[n] & 0xc0) == 0x80) {
+            n--;
+        }
+    }
+    memcpy(label, probe.label, n);
+    label[n] = '\0';
 
+    SLOGD("getNtfsId() id=%llx", *id);
     return 0;
 }
 
@@ -101,23 +90,11 @@ int getNtfsInfo(const char *devPath, char *label, int64_t *id) {
  *    정보를 얻는데 실패하면 0
  */
 uint64_t getNtfsSize(const char *devPath) {
-    struct NTFSBoot boot;
-    uint64_t NtfsSize;
+    FsProbeResult probe;
 
-    FILE *fp = fopen(devPath, "r");
-    if (fp == NULL) {
-        SLOGE("getNtfsSize: cannot open device: %s %s", devPath, strerror(errno));
+    if (readNtfsBoot(devPath, &probe) != 0) {
         return 0;
     }
-
-    if ( fread( &boot, 1, sizeof(boot), fp) != sizeof(boot) ) {
-        SLOGE("fread fail. path=%s", devPath);
-        NtfsSize = 0;
-    } else {
-        NtfsSize = boot.SectorsPerVolume * (boot.wBytesPerSector[1] << 8);
-        SLOGD("getNtfsSize() size=%lld", NtfsSize);
-    }
-
-    fclose(fp);
-    return NtfsSize;
+    SLOGD("getNtfsSize() size=%lld", probe.size);
+    return probe.size;
 }
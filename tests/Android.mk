@@ -3,7 +3,17 @@ LOCAL_PATH := $(call my-dir)
 include $(CLEAR_VARS)
 
 test_src_files := \
-	VolumeManager_test.cpp
+	VolumeManager_test.cpp \
+	FsProbe_test.cpp \
+	MediaCache_test.cpp \
+	CheckScheduler_test.cpp \
+	Fat_test.cpp \
+	MountTable_test.cpp \
+	OpenFileScanner_test.cpp \
+	UnmountPolicy_test.cpp \
+	ToolRunner_test.cpp \
+	UeventCoalescer_test.cpp \
+	DevpathIndex_test.cpp
 
 shared_libraries := \
 	liblog \
@@ -0,0 +1,88 @@
+/*
+ * Host keys the checker scheduler derives from sysfs devpaths, and how it
+ * admits checks.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#define LOG_TAG "CheckScheduler_test"
+#include <utils/Log.h>
+#include "../CheckScheduler.h"
+#include "../ToolRunner.h"
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+class CheckSchedulerTest : public testing::Test {
+protected:
+    char mKey[PATH_MAX];
+
+    const char *key(const char *sysPath) {
+        CheckScheduler::hostKeyFromSysPath(sysPath, mKey, sizeof(mKey));
+        return mKey;
+    }
+};
+
+TEST_F(CheckSchedulerTest, UsbDisksShareTheirBus) {
+    EXPECT_STREQ("/sys/devices/platform/tcc-ehci/usb1",
+            key("/sys/devices/platform/tcc-ehci/usb1/1-1/1-1.2/1-1.2:1.0/host0/target0:0:0/"
+                "0:0:0:0/block/sda/sda1"));
+    EXPECT_STREQ("/sys/devices/platform/tcc-ehci/usb1",
+            key("/sys/devices/platform/tcc-ehci/usb1/1-1/1-1.3/1-1.3:1.0/host1/target1:0:0/"
+                "1:0:0:0/block/sdb/sdb1"));
+    EXPECT_STREQ("/sys/devices/platform/tcc-ohci/usb2",
+            key("/sys/devices/platform/tcc-ohci/usb2/2-1/2-1:1.0/host2/target2:0:0/"
+                "2:0:0:0/block/sdc"));
+}
+
+TEST_F(CheckSchedulerTest, MmcHost) {
+    EXPECT_STREQ("/sys/devices/platform/tcc-sdhc.2/mmc_host/mmc1",
+            key("/sys/devices/platform/tcc-sdhc.2/mmc_host/mmc1/mmc1:aaaa/block/mmcblk1/"
+                "mmcblk1p1"));
+}
+
+TEST_F(CheckSchedulerTest, OtherDisksStandAlone) {
+    EXPECT_STREQ("/sys/devices/virtual/block/loop0",
+            key("/sys/devices/virtual/block/loop0"));
+    EXPECT_STREQ("/sys/devices/platform/ahci/ata1/host0/target0:0:0/0:0:0:0/block/sda",
+            key("/sys/devices/platform/ahci/ata1/host0/target0:0:0/0:0:0:0/block/sda/sda2"));
+    EXPECT_STREQ("/sys/devices/usbfoo", key("/sys/devices/usbfoo"));
+}
+
+TEST_F(CheckSchedulerTest, CheckKeepsErrno) {
+    CheckScheduler scheduler;
+
+    errno = 0;
+    EXPECT_EQ(-1, scheduler.check(FSTYPE_UNRECOGNIZED, "/nonexistent", "sdcard"));
+    EXPECT_EQ(ENODATA, errno);
+    EXPECT_EQ(0, scheduler.getNumRunning());
+    EXPECT_EQ(1U, scheduler.getNumChecks());
+    EXPECT_EQ(0U, scheduler.getNumQueued());
+}
+
+TEST_F(CheckSchedulerTest, FreeSlotIsNotBusy) {
+    CheckScheduler scheduler;
+
+    errno = 0;
+    EXPECT_EQ(-1, scheduler.check(FSTYPE_UNRECOGNIZED, "/nonexistent", "sdcard", NULL, NULL, 0));
+    EXPECT_EQ(ENODATA, errno);
+    EXPECT_EQ(1U, scheduler.getNumChecks());
+    EXPECT_EQ(0U, scheduler.getNumBusy());
+}
+
+TEST_F(CheckSchedulerTest, CancelledCheckDoesNotRun) {
+    CheckScheduler scheduler;
+    ToolRunner runner;
+
+    scheduler.cancel(&runner);
+    errno = 0;
+    EXPECT_EQ(-1, scheduler.check(FSTYPE_FAT, "/nonexistent", "sdcard", &runner));
+    EXPECT_EQ(ECANCELED, errno);
+    EXPECT_EQ(0, scheduler.getNumRunning());
+    EXPECT_EQ(0U, scheduler.getNumChecks());
+}
+
+}
@@ -0,0 +1,94 @@
+/*
+ * Which volumes a sysfs DEVPATH is routed to.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_TAG "DevpathIndex_test"
+#include <utils/Log.h>
+#include "../DevpathIndex.h"
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+/* Never dereferenced by the index */
+#define VOL(n) (reinterpret_cast<Volume *>((n) * 16))
+
+class DevpathIndexTest : public testing::Test {
+protected:
+    DevpathIndex mIndex;
+    DevpathIndex::Match mMatches[DevpathIndex::MAX_MATCHES];
+
+    int lookup(const char *devpath) {
+        return mIndex.lookup(devpath, mMatches, DevpathIndex::MAX_MATCHES);
+    }
+};
+
+TEST_F(DevpathIndexTest, PrefixFindsItsVolume) {
+    ASSERT_EQ(0, mIndex.add("/devices/platform/tcc-ehci/usb1/1-1", VOL(1), 1));
+    ASSERT_EQ(0, mIndex.add("/devices/platform/tcc-sdhc.2/mmc_host/mmc1", VOL(2), 1));
+    mIndex.setOrder(VOL(1), 0);
+    mIndex.setOrder(VOL(2), 1);
+
+    ASSERT_EQ(1, lookup("/devices/platform/tcc-ehci/usb1/1-1/1-1:1.0/host0/target0:0:0/"
+            "0:0:0:0/block/sda/sda1"));
+    EXPECT_EQ(VOL(1), mMatches[0].volume);
+    EXPECT_EQ(1, mMatches[0].pathIndex);
+
+    ASSERT_EQ(1, lookup("/devices/platform/tcc-sdhc.2/mmc_host/mmc1/mmc1:aaaa/block/mmcblk1"));
+    EXPECT_EQ(VOL(2), mMatches[0].volume);
+
+    EXPECT_EQ(0, lookup("/devices/platform/tcc-ehci/usb2/2-1/block/sdb"));
+    EXPECT_EQ(0, lookup("/devices/platform/tcc-ehci/usb1"));
+    EXPECT_EQ(0, lookup(NULL));
+}
+
+TEST_F(DevpathIndexTest, AliasesGiveOneMatchWithTheFirstPath) {
+    mIndex.add("/devices/platform/tcc-ehci/usb1/1-1/1-1.2", VOL(1), 2);
+    mIndex.add("/devices/platform/tcc-ehci/usb1/1-1", VOL(1), 1);
+    mIndex.setOrder(VOL(1), 0);
+
+    ASSERT_EQ(1, lookup("/devices/platform/tcc-ehci/usb1/1-1/1-1.2/block/sda"));
+    EXPECT_EQ(VOL(1), mMatches[0].volume);
+    EXPECT_EQ(1, mMatches[0].pathIndex);
+    EXPECT_EQ(2, mIndex.getNumPaths());
+}
+
+TEST_F(DevpathIndexTest, SharedPrefixSortedByVolumeOrder) {
+    mIndex.add("/devices/platform/tcc-ehci/usb1", VOL(1), 1);
+    mIndex.add("/devices/platform/tcc-ehci/usb1/1-1", VOL(2), 3);
+    mIndex.add("/devices/platform/tcc-ehci", VOL(3), 1);
+    mIndex.setOrder(VOL(1), 2);
+    mIndex.setOrder(VOL(2), 0);
+    /* VOL(3) was never added to VolumeManager */
+
+    ASSERT_EQ(2, lookup("/devices/platform/tcc-ehci/usb1/1-1/block/sda"));
+    EXPECT_EQ(VOL(2), mMatches[0].volume);
+    EXPECT_EQ(3, mMatches[0].pathIndex);
+    EXPECT_EQ(VOL(1), mMatches[1].volume);
+
+    EXPECT_EQ(1, mIndex.lookup("/devices/platform/tcc-ehci/usb1/1-1/block/sda", mMatches, 1));
+    EXPECT_EQ(VOL(2), mMatches[0].volume);
+}
+
+TEST_F(DevpathIndexTest, RemovedPathsNoLongerMatch) {
+    mIndex.add("/devices/platform/tcc-ehci/usb1", VOL(1), 1);
+    mIndex.add("/devices/platform/tcc-ohci/usb2", VOL(1), 2);
+    mIndex.add("/devices/platform/tcc-ehci/usb1", VOL(2), 1);
+    mIndex.setOrder(VOL(1), 0);
+    mIndex.setOrder(VOL(2), 1);
+
+    EXPECT_EQ(0, mIndex.remove("/devices/platform/tcc-ehci/usb1", VOL(1)));
+    EXPECT_EQ(-1, mIndex.remove("/devices/platform/tcc-ehci/usb1", VOL(1)));
+    ASSERT_EQ(1, lookup("/devices/platform/tcc-ehci/usb1/1-1/block/sda"));
+    EXPECT_EQ(VOL(2), mMatches[0].volume);
+
+    mIndex.removeVolume(VOL(1));
+    EXPECT_EQ(0, lookup("/devices/platform/tcc-ohci/usb2/2-1/block/sdb"));
+    EXPECT_EQ(1, mIndex.getNumPaths());
+}
+
+}
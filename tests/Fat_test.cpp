@@ -0,0 +1,115 @@
+/*
+ * How checker output becomes progress, the default deadlines, and
+ * fsck_msdos rechecks against a scripted stand-in.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#define LOG_TAG "Fat_test"
+#include <utils/Log.h>
+#include "../Filesystems.h"
+#include "../Fat.h"
+#include "../ToolRunner.h"
+#include "TempDir.h"
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+TEST(CheckProgressTest, Percentages) {
+    EXPECT_EQ(45, Filesystems::parsePercent("Checking files... 45%"));
+    EXPECT_EQ(12, Filesystems::parsePercent("12.7% done"));
+    EXPECT_EQ(100, Filesystems::parsePercent("[####] 100%"));
+    /* The last one counts */
+    EXPECT_EQ(5, Filesystems::parsePercent("pass 2: 30% (used 5% of the log)"));
+    EXPECT_EQ(-1, Filesystems::parsePercent("no numbers here"));
+    EXPECT_EQ(-1, Filesystems::parsePercent("%d formatted badly"));
+    EXPECT_EQ(-1, Filesystems::parsePercent("250%"));
+    EXPECT_EQ(7, Filesystems::parsePercent("7% then a stray %"));
+}
+
+TEST(CheckProgressTest, FsckMsdosPhases) {
+    EXPECT_EQ(0, Filesystems::checkProgress(FSTYPE_FAT, "** Phase 1 - Read FAT"));
+    EXPECT_EQ(50, Filesystems::checkProgress(FSTYPE_FAT, "** Phase 3 - Checking Directories"));
+    EXPECT_EQ(75, Filesystems::checkProgress(FSTYPE_FAT, "** Phase 4 - Checking for Lost Files"));
+    EXPECT_EQ(-1, Filesystems::checkProgress(FSTYPE_FAT, "** /dev/block/vold/8:1"));
+    EXPECT_EQ(-1, Filesystems::checkProgress(FSTYPE_EXFAT, "** Phase 3 - Checking Directories"));
+}
+
+TEST(CheckProgressTest, DefaultDeadlines) {
+    EXPECT_EQ(180 * 1000, Filesystems::checkDeadline(FSTYPE_FAT));
+    EXPECT_EQ(0, Filesystems::checkDeadline(FSTYPE_HFSPLUS));
+    EXPECT_EQ(0, Filesystems::checkDeadline(FSTYPE_UNRECOGNIZED));
+}
+
+/* A stand-in for fsck_msdos that exits 4 (modified) 'repairs' times, then 0 */
+class FatCheckTest : public testing::Test {
+protected:
+    TempDir mDir;
+    char mFsck[300];
+    char mCount[300];
+
+    virtual void SetUp() {
+        ASSERT_TRUE(mDir.create("fatcheck")) << strerror(errno);
+        snprintf(mFsck, sizeof(mFsck), "%s/fsck_msdos", mDir.path());
+        snprintf(mCount, sizeof(mCount), "%s/count", mDir.path());
+    }
+
+    void writeFsck(int repairs) {
+        FILE *fp = fopen(mFsck, "w");
+        ASSERT_TRUE(fp != NULL);
+        fprintf(fp, "#!/system/bin/sh\n"
+                "n=$(($(cat %s 2>/dev/null || echo 0) + 1))\n"
+                "echo $n > %s\n"
+                "echo '** Phase 1 - Read FAT'\n"
+                "[ $n -le %d ] && exit 4\n"
+                "exit 0\n", mCount, mCount, repairs);
+        fclose(fp);
+        ASSERT_EQ(0, chmod(mFsck, 0700));
+    }
+
+    int passes() {
+        int n = 0;
+        FILE *fp = fopen(mCount, "r");
+        if (fp) {
+            fscanf(fp, "%d", &n);
+            fclose(fp);
+        }
+        return n;
+    }
+};
+
+TEST_F(FatCheckTest, RechecksAfterRepair) {
+    ToolRunner runner;
+    bool modified = false;
+
+    writeFsck(2);
+    runner.setTimeout(10 * 1000);
+    EXPECT_EQ(0, Fat::runCheck(mFsck, "/dev/block/vold/8:1", &runner, &modified));
+    EXPECT_EQ(3, passes());
+    EXPECT_TRUE(modified);
+}
+
+TEST_F(FatCheckTest, CleanCheckModifiesNothing) {
+    bool modified = false;
+
+    writeFsck(0);
+    EXPECT_EQ(0, Fat::runCheck(mFsck, "/dev/block/vold/8:1", NULL, &modified));
+    EXPECT_EQ(1, passes());
+    EXPECT_FALSE(modified);
+}
+
+TEST_F(FatCheckTest, GivesUpAfterTooManyRechecks) {
+    writeFsck(100);
+    errno = 0;
+    EXPECT_EQ(-1, Fat::runCheck(mFsck, "/dev/block/vold/8:1", NULL));
+    EXPECT_EQ(EIO, errno);
+    EXPECT_EQ(1 + Fat::MAX_RECHECKS, passes());
+}
+
+}
@@ -0,0 +1,702 @@
+/*
+ * Synthetic images for each filesystem vold mounts, checked against the
+ * UUID/LABEL values blkid reports for the same images.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#define LOG_TAG "FsProbe_test"
+#include <utils/Log.h>
+#include "../FsProbe.h"
+#include "TempDir.h"
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+    put32(p, v);
+    put32(p + 4, v >> 32);
+}
+
+static void putBe16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void putBe32(uint8_t *p, uint32_t v) {
+    putBe16(p, v >> 16);
+    putBe16(p + 2, v);
+}
+
+static void putUtf16(uint8_t *p, const char *s, bool bigEndian) {
+    for (; *s; s++, p += 2) {
+        if (bigEndian)
+            putBe16(p, *s);
+        else
+            put16(p, *s);
+    }
+}
+
+class FsProbeTest : public testing::Test {
+protected:
+    TempDir mDir;
+    char mPath[300];
+    int mFd;
+
+    virtual void SetUp() {
+        mFd = -1;
+        ASSERT_TRUE(mDir.create("fsprobe")) << strerror(errno);
+        snprintf(mPath, sizeof(mPath), "%s/image", mDir.path());
+        mFd = open(mPath, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        ASSERT_GE(mFd, 0) << strerror(errno);
+    }
+
+    virtual void TearDown() {
+        if (mFd >= 0)
+            close(mFd);
+    }
+
+    /* Images are sparse: only the structures the probe looks at are written */
+    void resize(off_t size) {
+        ASSERT_EQ(0, ftruncate(mFd, size));
+    }
+
+    void write(off_t offset, const uint8_t *buf, size_t len) {
+        ASSERT_EQ((ssize_t) len, pwrite(mFd, buf, len, offset));
+    }
+
+    void probe(FsProbeResult *result) {
+        ASSERT_EQ(0, FsProbe::probeMetadata(mPath, result));
+    }
+};
+
+static void fatBootSector(uint8_t *b, bool fat32) {
+    memset(b, 0, 512);
+    b[0] = 0xeb;
+    b[1] = fat32 ? 0x58 : 0x3c;
+    b[2] = 0x90;
+    memcpy(b + 3, "MSDOS5.0", 8);
+    put16(b + 0x0b, 512);
+    b[0x15] = 0xf8;
+    b[510] = 0x55;
+    b[511] = 0xaa;
+}
+
+TEST_F(FsProbeTest, Fat16RootDirectoryLabel) {
+    uint8_t b[512];
+
+    resize(16 * 1024 * 1024);
+    fatBootSector(b, false);
+    b[0x0d] = 4;                /* sectors per cluster */
+    put16(b + 0x0e, 1);         /* reserved */
+    b[0x10] = 2;                /* fats */
+    put16(b + 0x11, 512);       /* root entries */
+    put16(b + 0x13, 32768);     /* sectors */
+    put16(b + 0x16, 32);        /* fat length */
+    b[0x26] = 0x29;
+    put32(b + 0x27, 0x1234abcd);
+    memcpy(b + 0x2b, "BOOTLABEL  ", 11);
+    memcpy(b + 0x36, "FAT16   ", 8);
+    write(0, b, 512);
+
+    memset(b, 0, 512);
+    put32(b, 0xfffffff8);
+    write(512, b, 4);
+    write(33 * 512, b, 4);
+
+    /* A deleted label and a long name entry come before the real label */
+    memset(b, 0, 512);
+    memcpy(b, "\xe5OLDLABEL  ", 11);
+    b[11] = 0x08;
+    memcpy(b + 32, "AFILE      ", 11);
+    b[32 + 11] = 0x0f;
+    memcpy(b + 64, "ROOT LABEL ", 11);
+    b[64 + 11] = 0x08;
+    write(65 * 512, b, 512);
+
+    FsProbeResult r;
+    probe(&r);
+    EXPECT_EQ(FSTYPE_FAT, r.type);
+    EXPECT_STREQ("1234-ABCD", r.uuid);
+    EXPECT_STREQ("ROOT LABEL", r.label);
+    EXPECT_EQ((int32_t) 0x1234abcd, r.id);
+    EXPECT_EQ(16ULL * 1024 * 1024, r.size);
+
+    FatBootInfo fat;
+    ASSERT_EQ(0, readFatBootInfo(mPath, &fat));
+    EXPECT_EQ(16, fat.fatBits);
+    EXPECT_EQ(16ULL * 1024 * 1024, fat.size);
+    EXPECT_EQ((int32_t) 0x1234abcd, fat.id);
+    EXPECT_STREQ("ROOT LABEL", fat.label);
+    EXPECT_EQ(FSSTATE_CLEAN, r.state);
+
+    /* Mounted and never cleanly unmounted: clean shutdown bit cleared */
+    put16(b, 0x7fff);
+    write(512 + 2, b, 2);
+    probe(&r);
+    EXPECT_EQ(FSSTATE_DIRTY, r.state);
+}
+
+TEST_F(FsProbeTest, Fat32LabelInChainedRootCluster) {
+    uint8_t b[512];
+    const uint32_t fatLength = 544;
+    const off_t fatStart = 32 * 512;
+    const off_t dataStart = (32 + 2 * fatLength) * 512;
+
+    resize(69632 * 512);
+    fatBootSector(b, true);
+    b[0x0d] = 1;
+    put16(b + 0x0e, 32);
+    b[0x10] = 2;
+    put32(b + 0x20, 69632);
+    put32(b + 0x24, fatLength);
+    put32(b + 0x2c, 2);         /* root cluster */
+    put16(b + 0x30, 1);
+    put16(b + 0x32, 6);
+    b[0x40] = 0x80;
+    b[0x42] = 0x29;
+    put32(b + 0x43, 0xdeadbeef);
+    memcpy(b + 0x47, "NO NAME    ", 11);
+    memcpy(b + 0x52, "FAT32   ", 8);
+    write(0, b, 512);
+
+    /* Root directory is clusters 2 -> 5, the label is in the second one */
+    memset(b, 0, 512);
+    put32(b + 0, 0x0ffffff8);
+    put32(b + 4, 0x0fffffff);
+    put32(b + 8, 5);
+    put32(b + 20, 0x0fffffff);
+    write(fatStart, b, 512);
+    write(fatStart + fatLength * 512, b, 512);
+
+    memset(b, 0, 512);
+    for (int i = 0; i < 16; i++) {
+        snprintf((char *) b + i * 32, 12, "FILE%04dTXT", i);
+        b[i * 32 + 11] = 0x20;
+    }
+    write(dataStart, b, 512);
+
+    memset(b, 0, 512);
+    memcpy(b, "CHAINED    ", 11);
+    b[11] = 0x08;
+    write(dataStart + 3 * 512, b, 512);
+
+    FsProbeResult r;
+    probe(&r);
+    EXPECT_EQ(FSTYPE_FAT, r.type);
+    EXPECT_STREQ("DEAD-BEEF", r.uuid);
+    EXPECT_STREQ("CHAINED", r.label);
+
+    FatBootInfo fat;
+    ASSERT_EQ(0, readFatBootInfo(mPath, &fat));
+    EXPECT_EQ(32, fat.fatBits);
+    EXPECT_EQ(69632ULL * 512, fat.size);
+    EXPECT_EQ((int32_t) 0xdeadbeef, fat.id);
+    EXPECT_STREQ("CHAINED", fat.label);
+    EXPECT_EQ(FSSTATE_CLEAN, r.state);
+}
+
+/*
+ * A 10000 entry root directory with the label behind the last file, the
+ * worst case for the scan. Prints how long the lookup takes; only the
+ * result is checked.
+ */
+TEST_F(FsProbeTest, Fat32LargeRootDirectoryScan) {
+    const int numFiles = 10000;
+    const uint32_t spc = 8;
+    const uint32_t fatLength = 544;
+    const off_t fatStart = 32 * 512;
+    const off_t dataStart = (32 + 2 * fatLength) * 512;
+    const size_t clusterSize = spc * 512;
+    const uint32_t numClusters = ((numFiles + 1) * 32 + clusterSize - 1) / clusterSize;
+    uint8_t b[512];
+
+    resize(69632 * 512);
+    fatBootSector(b, true);
+    b[0x0d] = spc;
+    put16(b + 0x0e, 32);
+    b[0x10] = 2;
+    put32(b + 0x20, 69632);
+    put32(b + 0x24, fatLength);
+    put32(b + 0x2c, 2);
+    put16(b + 0x30, 1);
+    put16(b + 0x32, 6);
+    b[0x40] = 0x80;
+    b[0x42] = 0x29;
+    put32(b + 0x43, 0x00c0ffee);
+    memcpy(b + 0x47, "BOOTLABEL  ", 11);
+    memcpy(b + 0x52, "FAT32   ", 8);
+    write(0, b, 512);
+
+    /* Root directory is one contiguous chain starting at cluster 2 */
+    uint8_t *fat = (uint8_t *) calloc(fatLength, 512);
+    ASSERT_TRUE(fat != NULL);
+    put32(fat + 0, 0x0ffffff8);
+    put32(fat + 4, 0x0fffffff);
+    for (uint32_t c = 2; c < 2 + numClusters; c++)
+        put32(fat + c * 4, c + 1 < 2 + numClusters ? c + 1 : 0x0fffffff);
+    write(fatStart, fat, fatLength * 512);
+    write(fatStart + fatLength * 512, fat, fatLength * 512);
+    free(fat);
+
+    uint8_t *dir = (uint8_t *) calloc(numClusters, clusterSize);
+    ASSERT_TRUE(dir != NULL);
+    for (int i = 0; i < numFiles; i++) {
+        snprintf((char *) dir + i * 32, 12, "F%07dTXT", i);
+        dir[i * 32 + 11] = 0x20;
+    }
+    memcpy(dir + numFiles * 32, "LAST LABEL ", 11);
+    dir[numFiles * 32 + 11] = 0x08;
+    write(dataStart, dir, numClusters * clusterSize);
+    free(dir);
+
+    const int iterations = 20;
+    struct timespec start, end;
+    char label[12];
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < iterations; i++) {
+        label[0] = '\0';
+        ASSERT_EQ(0, fatRootLabel(mPath, label, sizeof(label)));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    EXPECT_STREQ("LAST LABEL", label);
+
+    int64_t us = (int64_t) (end.tv_sec - start.tv_sec) * 1000000 +
+            (end.tv_nsec - start.tv_nsec) / 1000;
+    printf("root label scan: %d entries, %lld us per lookup\n", numFiles,
+            (long long) (us / iterations));
+
+    FsProbeResult r;
+    probe(&r);
+    EXPECT_EQ(FSTYPE_FAT, r.type);
+    EXPECT_STREQ("LAST LABEL", r.label);
+}
+
+TEST_F(FsProbeTest, FatNoNameLabel) {
+    uint8_t b[512];
+
+    resize(16 * 1024 * 1024);
+    fatBootSector(b, false);
+    b[0x0d] = 4;
+    put16(b + 0x0e, 1);
+    b[0x10] = 2;
+    put16(b + 0x11, 512);
+    put16(b + 0x13, 32768);
+    put16(b + 0x16, 32);
+    b[0x26] = 0x29;
+    put32(b + 0x27, 0x00010002);
+    memcpy(b + 0x2b, "NO NAME    ", 11);
+    memcpy(b + 0x36, "FAT16   ", 8);
+    write(0, b, 512);
+
+    FsProbeResult r;
+    probe(&r);
+    EXPECT_EQ(FSTYPE_FAT, r.type);
+    EXPECT_STREQ("0001-0002", r.uuid);
+    EXPECT_STREQ("", r.label);
+}
+
+TEST_F(FsProbeTest, FatWithoutTypeString) {
+    uint8_t b[512];
+
+    resize(1440 * 1024);
+    fatBootSector(b, false);
+    b[0x0d] = 1;
+    put16(b + 0x0e, 1);
+    b[0x10] = 2;
+    put16(b + 0x11, 224);
+    put16(b + 0x13, 2880);
+    b[0x15] = 0xf0;
+    put16(b + 0x16, 9);
+    b[0x26] = 0x28;             /* serial only, no label or type string */
+    put32(b + 0x27, 0x0badf00d);
+    write(0, b, 512);
+
+    FsProbeResult r;
+    probe(&r);
+    EXPECT_EQ(FSTYPE_FAT, r.type);
+    EXPECT_EQ(1440ULL * 1024, r.size);
+    EXPECT_STREQ("0BAD-F00D", r.uuid);
+    EXPECT_STREQ("", r.label);
+}
+
+/* Accepted on the type string alone: no serial to report, no boot label */
+TEST_F(FsProbeTest, Fat32TypeStringWithoutBootSignature) {
+    uint8_t b[512];
+
+    resize(69632 * 512);
+    fatBootSector(b, true);
+    b[0x0d] = 1;
+    put16(b + 0x0e, 32);
+    b[0x10] = 2;
+    put32(b + 0x20, 69632);
+    put32(b + 0x24, 544);
+    put32(b + 0x2c, 2);
+    memset(b + 0x43, 0xa5, 0x52 - 0x43);   /* stale serial/label bytes */
+    memcpy(b + 0x52, "FAT32   ", 8);
+    write(0, b, 512);
+
+    FatBootInfo fat;
+    ASSERT_EQ(0, readFatBootInfo(mPath, &fat));
+    EXPECT_EQ(32, fat.fatBits);
+    EXPECT_EQ(-1, fat.id);
+    EXPECT_STREQ("", fat.label);
+}
+
+TEST_F(FsProbeTest, FatTypeStringWithBrokenBpb) {
+    static const struct {
+        int offset;
+        uint8_t value;
+    } corruptions[] = {
+        { 0x00, 0x00 },         /* no jump */
+        { 0x0c, 0x03 },         /* 768 bytes per sector */
+        { 0x0d, 0x03 },         /* 3 sectors per cluster */
+        { 0x0e, 0x00 },         /* no reserved sectors */
+        { 0x10, 0x00 },         /* no FATs */
+        { 0x15, 0x12 },         /* bad media byte */
+        { 0x26, 0x00 },         /* no extended signature (type string kept) */
+    };
+
+    resize(16 * 1024 * 1024);
+    for (size_t i = 0; i < sizeof(corruptions) / sizeof(corruptions[0]); i++) {
+        uint8_t b[512];
+
+        fatBootSector(b, false);
+        b[0x0d] = 4;
+        put16(b + 0x0e, 1);
+        b[0x10] = 2;
+        put16(b + 0x11, 512);
+        put16(b + 0x13, 32768);
+        put16(b + 0x16, 32);
+        b[0x26] = 0x29;
+        memcpy(b + 0x36, "FAT16   ", 8);
+        b[corruptions[i].offset] = corruptions[i].value;
+        write(0, b, 512);
+
+        FsProbeResult r;
+        probe(&r);
+        if (corruptions[i].offset == 0x26) {
+            EXPECT_EQ(FSTYPE_FAT, r.type) << "type string alone is enough";
+        } else {
+            EXPECT_EQ(FSTYPE_UNRECOGNIZED, r.type) << "corruption at " << corruptions[i].offset;
+        }
+    }
+}
+
+static void exFatBootRegion(uint8_t *b) {
+    memset(b, 0, 12 * 512);
+    b[0] = 0xeb;
+    b[1] = 0x76;
+    b[2] = 0x90;
+    memcpy(b + 3, "EXFAT   ", 8);
+    put64(b + 0x48, 65536);     /* volume length */
+    put32(b + 0x50, 128);       /* fat offset */
+    put32(b + 0x54, 128);       /* fat length */
+    put32(b + 0x58, 256);       /* cluster heap offset */
+    put32(b + 0x5c, 8160);      /* cluster count */
+    put32(b + 0x60, 4);         /* root cluster */
+    put32(b + 0x64, 0xcafe0042);
+    put16(b + 0x68, 0x0100);
+    b[0x6c] = 9;
+    b[0x6d] = 3;
+    b[0x6e] = 1;
+    b[0x6f] = 0x80;
+    b[510] = 0x55;
+    b[511] = 0xaa;
+    /* Boot code in the extended sectors, so the checksum covers real data */
+    for (int i = 512; i < 11 * 512; i++) {
+        b[i] = i * 7;
+    }
+
+    /* Boot checksum over sectors 0-10, repeated through sector 11 */
+    uint32_t sum = 0;
+    for (int i = 0; i < 11 * 512; i++) {
+        if (i == 106 || i == 107 || i == 112)
+            continue;
+        sum = ((sum << 31) | (sum >> 1)) + b[i];
+    }
+    for (int i = 0; i < 512; i += 4) {
+        put32(b + 11 * 512 + i, sum);
+    }
+}
+
+TEST_F(FsProbeTest, ExFatLabelEntry) {
+    uint8_t b[12 * 512];
+
+    resize(32 * 1024 * 1024);
+    exFatBootRegion(b);
+    write(0, b, sizeof(b));
+
+    memset(b, 0, 512);
+    put32(b + 0, 0xfffffff8);
+    put32(b + 4, 0xffffffff);
+    put32(b + 16, 0xffffffff);
+    write(128 * 512, b, 512);
+
+    memset(b, 0, 512);
+    b[0] = 0x83;
+    b[1] = 6;
+    putUtf16(b + 2, "Camera", false);
+    write(256 * 512 + 2 * 4096, b, 512);
+
+    FsProbeResult r;
+    probe(&r);
+    EXPECT_EQ(FSTYPE_EXFAT, r.type);
+    EXPECT_STREQ("CAFE-0042", r.uuid);
+    EXPECT_STREQ("Camera", r.label);
+    EXPECT_EQ(32ULL * 1024 * 1024, r.size);
+    EXPECT_EQ(FSSTATE_CLEAN, r.state);
+
+    /* What getExFatInfo() reports, with the boot checksum verified */
+    ASSERT_EQ(0, FsProbe::probeExFatVolume(mPath, &r));
+    EXPECT_EQ(FSTYPE_EXFAT, r.type);
+    EXPECT_EQ((int32_t) 0xcafe0042, r.id);
+    EXPECT_STREQ("Camera", r.label);
+    EXPECT_EQ(32ULL * 1024 * 1024, r.size);
+}
+
+TEST_F(FsProbeTest, ExFatBootChecksum) {
+    uint8_t b[12 * 512];
+    FsProbeResult r;
+
+    resize(32 * 1024 * 1024);
+    exFatBootRegion(b);
+    uint32_t stored = b[11 * 512] | (b[11 * 512 + 1] << 8) |
+            (b[11 * 512 + 2] << 16) | ((uint32_t) b[11 * 512 + 3] << 24);
+    EXPECT_EQ(stored, FsProbe::exFatBootChecksum(b, 512));
+
+    /* Volume flags and percent in use are not covered */
+    b[106] = 0x02;
+    b[112] = 50;
+    write(0, b, sizeof(b));
+    EXPECT_EQ(0, FsProbe::probeExFatVolume(mPath, &r));
+    EXPECT_EQ(FSSTATE_DIRTY, r.state);
+
+    /* Anything else in the main boot region is */
+    b[7 * 512 + 100] ^= 0x01;
+    write(0, b, sizeof(b));
+    EXPECT_EQ(-1, FsProbe::probeExFatVolume(mPath, &r));
+    EXPECT_EQ(EINVAL, errno);
+}
+
+TEST_F(FsProbeTest, NtfsVolumeName) {
+    uint8_t b[1024];
+    const off_t mft = 4 * 4096;
+
+    resize(16 * 1024 * 1024);
+    memset(b, 0, 512);
+    b[0] = 0xeb;
+    b[1] = 0x52;
+    b[2] = 0x90;
+    memcpy(b + 3, "NTFS    ", 8);
+    put16(b + 0x0b, 512);
+    b[0x0d] = 8;
+    b[0x15] = 0xf8;
+    put64(b + 0x28, 32767);
+    put64(b + 0x30, 4);
+    put64(b + 0x38, 2);
+    b[0x40] = 0xf6;             /* 2^10 byte records */
+    b[0x44] = 1;
+    put64(b + 0x48, 0x0123456789abcdefULL);
+    b[510] = 0x55;
+    b[511] = 0xaa;
+    write(0, b, 512);
+
+    memset(b, 0, sizeof(b));
+    memcpy(b, "FILE", 4);
+    put16(b + 0x04, 0x30);
+    put16(b + 0x06, 3);
+    put16(b + 0x14, 0x38);
+    put32(b + 0x18, 0x40);      /* bytes in use */
+    put32(b + 0x1c, 1024);      /* bytes allocated */
+    put32(b + 0x38, 0xffffffff);
+    write(mft, b, sizeof(b));
+
+    /* $Volume: protected sector tails hold the sequence number */
+    put16(b + 0x30, 0x0001);
+    put16(b + 510, 0x0001);
+    put16(b + 1022, 0x0001);
+    put32(b + 0x38, 0x60);
+    put32(b + 0x3c, 0x30);
+    put32(b + 0x38 + 0x10, 16);
+    put16(b + 0x38 + 0x14, 0x18);
+    putUtf16(b + 0x38 + 0x18, "Music HD", false);
+    /* $VOLUME_INFORMATION: NTFS 3.1, flags 0 */
+    put32(b + 0x68, 0x70);
+    put32(b + 0x6c, 0x28);
+    put32(b + 0x68 + 0x10, 12);
+    put16(b + 0x68 + 0x14, 0x18);
+    b[0x68 + 0x18 + 8] = 3;
+    b[0x68 + 0x18 + 9] = 1;
+    put32(b + 0x90, 0xffffffff);
+    put32(b + 0x18, 0x98);
+    write(mft + 3 * 1024, b, sizeof(b));
+
+    FsProbeResult r;
+    probe(&r);
+    EXPECT_EQ(FSTYPE_NTFS, r.type);
+    EXPECT_STREQ("0123456789ABCDEF", r.uuid);
+    EXPECT_STREQ("Music HD", r.label);
+    EXPECT_EQ(32767ULL * 512, r.size);
+    EXPECT_EQ(FSSTATE_CLEAN, r.state);
+
+    /* Volume dirty flag */
+    put16(b + 0x68 + 0x18 + 0x0a, 0x0001);
+    write(mft + 3 * 1024, b, sizeof(b));
+    probe(&r);
+    EXPECT_EQ(FSSTATE_DIRTY, r.state);
+}
+
+static void ntfsBootSector(uint8_t *b, uint16_t bps, uint8_t spc, uint8_t record) {
+    memset(b, 0, 512);
+    b[0] = 0xeb;
+    b[1] = 0x52;
+    b[2] = 0x90;
+    memcpy(b + 3, "NTFS    ", 8);
+    put16(b + 0x0b, bps);
+    b[0x0d] = spc;
+    b[0x15] = 0xf8;
+    put64(b + 0x28, 1000);
+    put64(b + 0x30, 4);
+    b[0x40] = record;
+    b[510] = 0x55;
+    b[511] = 0xaa;
+}
+
+TEST_F(FsProbeTest, NtfsBootGeometry) {
+    uint8_t b[512];
+    FsProbeResult r;
+
+    /* 4K sectors: the size uses all of the sector size, not its high byte */
+    ntfsBootSector(b, 4096, 1, 0xf4);
+    FsProbe::probeBuffer(b, sizeof(b), &r);
+    EXPECT_EQ(FSTYPE_NTFS, r.type);
+    EXPECT_EQ(1000ULL * 4096, r.size);
+
+    /* Large cluster encoding (2^8 sectors); a record of one such cluster is too big */
+    ntfsBootSector(b, 512, 0xf8, 0xf6);
+    FsProbe::probeBuffer(b, sizeof(b), &r);
+    EXPECT_EQ(FSTYPE_NTFS, r.type);
+    ntfsBootSector(b, 512, 0xf8, 1);
+    FsProbe::probeBuffer(b, sizeof(b), &r);
+    EXPECT_EQ(FSTYPE_UNRECOGNIZED, r.type);
+
+    ntfsBootSector(b, 768, 8, 0xf6);
+    FsProbe::probeBuffer(b, sizeof(b), &r);
+    EXPECT_EQ(FSTYPE_UNRECOGNIZED, r.type);
+
+    ntfsBootSector(b, 512, 3, 0xf6);
+    FsProbe::probeBuffer(b, sizeof(b), &r);
+    EXPECT_EQ(FSTYPE_UNRECOGNIZED, r.type);
+
+    ntfsBootSector(b, 512, 8, 0);
+    FsProbe::probeBuffer(b, sizeof(b), &r);
+    EXPECT_EQ(FSTYPE_UNRECOGNIZED, r.type);
+}
+
+TEST_F(FsProbeTest, HfsPlusCatalogName) {
+    uint8_t b[4096];
+
+    resize(16 * 1024 * 1024);
+    memset(b, 0, 512);
+    memcpy(b, "H+\x00\x04", 4);
+    putBe32(b + 40, 4096);
+    putBe32(b + 44, 4096);
+    putBe32(b + 80 + 24, 0x11223344);
+    putBe32(b + 80 + 28, 0x55667788);
+    putBe32(b + 0x110 + 12, 4);
+    putBe32(b + 0x110 + 16, 2);
+    putBe32(b + 0x110 + 20, 4);
+    write(1024, b, 512);
+
+    memset(b, 0, sizeof(b));
+    b[8] = 1;
+    putBe16(b + 10, 3);
+    putBe16(b + 14, 1);
+    putBe32(b + 16, 1);
+    putBe32(b + 20, 1);
+    putBe32(b + 24, 1);
+    putBe32(b + 28, 1);
+    putBe16(b + 32, 4096);
+    write(2 * 4096, b, sizeof(b));
+
+    memset(b, 0, sizeof(b));
+    b[8] = 0xff;
+    b[9] = 1;
+    putBe16(b + 10, 1);
+    putBe16(b + 14, 6 + 2 * 7);
+    putBe32(b + 16, 1);
+    putBe16(b + 20, 7);
+    putUtf16(b + 22, "Mac USB", true);
+    putBe16(b + 4094, 14);
+    write(3 * 4096, b, sizeof(b));
+
+    FsProbeResult r;
+    probe(&r);
+    EXPECT_EQ(FSTYPE_HFSPLUS, r.type);
+    EXPECT_STREQ("Mac USB", r.label);
+    EXPECT_STREQ("881fbbd4-30bd-30ca-89ec-803702808889", r.uuid);
+}
+
+TEST_F(FsProbeTest, Iso9660PrimaryDescriptor) {
+    uint8_t b[2048];
+
+    resize(1024 * 1024);
+    memset(b, 0, sizeof(b));
+    b[0] = 1;
+    memcpy(b + 1, "CD001", 5);
+    b[6] = 1;
+    memset(b + 40, ' ', 32);
+    memcpy(b + 40, "AUDIO_DISC", 10);
+    put32(b + 80, 512);
+    put16(b + 128, 2048);
+    memcpy(b + 813, "2014010203040506", 16);
+    memcpy(b + 830, "2014010203040506", 16);
+    write(16 * 2048, b, sizeof(b));
+
+    memset(b, 0, sizeof(b));
+    b[0] = 255;
+    memcpy(b + 1, "CD001", 5);
+    b[6] = 1;
+    write(17 * 2048, b, sizeof(b));
+
+    FsProbeResult r;
+    probe(&r);
+    EXPECT_EQ(FSTYPE_ISO9660, r.type);
+    EXPECT_STREQ("2014-01-02-03-04-05-06", r.uuid);
+    EXPECT_STREQ("AUDIO_DISC", r.label);
+    EXPECT_EQ(1024ULL * 1024, r.size);
+}
+
+TEST_F(FsProbeTest, UnformattedMedia) {
+    uint8_t b[512];
+
+    resize(1024 * 1024);
+    memset(b, 0xa5, sizeof(b));
+    write(0, b, sizeof(b));
+
+    FsProbeResult r;
+    probe(&r);
+    EXPECT_EQ(FSTYPE_UNRECOGNIZED, r.type);
+    EXPECT_STREQ("", r.uuid);
+    EXPECT_STREQ("", r.label);
+}
+
+}
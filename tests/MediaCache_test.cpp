@@ -0,0 +1,179 @@
+/*
+ * Fingerprinting, persistence and LRU eviction of the media cache.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define LOG_TAG "MediaCache_test"
+#include <utils/Log.h>
+#include "../MediaCache.h"
+#include "TempDir.h"
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+class MediaCacheTest : public testing::Test {
+protected:
+    TempDir mDir;
+    char mCachePath[300];
+    char mImage[300];
+
+    virtual void SetUp() {
+        ASSERT_TRUE(mDir.create("mediacache")) << strerror(errno);
+        snprintf(mCachePath, sizeof(mCachePath), "%s/vold/media_cache", mDir.path());
+        snprintf(mImage, sizeof(mImage), "%s/image", mDir.path());
+        writeFat16(0xffff);
+    }
+
+    /* FAT16 boot sector and the first FAT sector, FAT[1] as given */
+    void writeFat16(uint16_t fat1) {
+        uint8_t b[1024];
+
+        memset(b, 0, sizeof(b));
+        b[0] = 0xeb;
+        b[1] = 0x3c;
+        b[2] = 0x90;
+        memcpy(b + 3, "MSDOS5.0", 8);
+        b[0x0b] = 0x00;             /* 512 bytes per sector */
+        b[0x0c] = 0x02;
+        b[0x0d] = 4;
+        b[0x0e] = 1;                /* reserved */
+        b[0x10] = 2;
+        b[0x12] = 0x02;             /* 512 root entries */
+        b[0x13] = 0x00;             /* 32768 sectors */
+        b[0x14] = 0x80;
+        b[0x15] = 0xf8;
+        b[0x16] = 32;               /* fat length */
+        b[0x26] = 0x29;
+        b[0x27] = 0x78;
+        b[0x28] = 0x56;
+        b[0x29] = 0x34;
+        b[0x2a] = 0x12;
+        memcpy(b + 0x2b, "CACHED     FAT16   ", 19);
+        b[510] = 0x55;
+        b[511] = 0xaa;
+        b[512] = 0xf8;
+        b[513] = 0xff;
+        b[514] = fat1;
+        b[515] = fat1 >> 8;
+
+        int fd = open(mImage, O_WRONLY | O_CREAT, 0600);
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(0, ftruncate(fd, 16 * 1024 * 1024));
+        ASSERT_EQ((ssize_t) sizeof(b), pwrite(fd, b, sizeof(b), 0));
+        close(fd);
+    }
+};
+
+TEST_F(MediaCacheTest, FingerprintFollowsDirtyState) {
+    MediaCache::Fingerprint clean, dirty, again;
+
+    ASSERT_EQ(0, MediaCache::fingerprint(mImage, &clean));
+    EXPECT_EQ((uint32_t) FSTYPE_FAT, clean.type);
+    EXPECT_EQ(0x12345678, clean.id);
+    EXPECT_EQ(16ULL * 1024 * 1024, clean.size);
+
+    /* Mounted elsewhere and pulled: clean shutdown bit cleared */
+    writeFat16(0x7fff);
+    ASSERT_EQ(0, MediaCache::fingerprint(mImage, &dirty));
+    EXPECT_NE(0, memcmp(&clean, &dirty, sizeof(clean)));
+
+    writeFat16(0xffff);
+    ASSERT_EQ(0, MediaCache::fingerprint(mImage, &again));
+    EXPECT_EQ(0, memcmp(&clean, &again, sizeof(clean)));
+
+    /* Not FAT or exFAT */
+    int fd = open(mImage, O_WRONLY);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(1, pwrite(fd, "\0", 1, 0));
+    close(fd);
+    EXPECT_EQ(-1, MediaCache::fingerprint(mImage, &again));
+}
+
+struct ShallowProbe {
+    MediaCache::Fingerprint fp;
+    int                     rc;
+};
+
+static bool fingerprintAndStop(void *cookie, int fd, const uint8_t *buf, size_t len,
+        FsProbeResult *result) {
+    ShallowProbe *probe = (ShallowProbe *) cookie;
+
+    probe->rc = MediaCache::fingerprint(fd, buf, len, result, &probe->fp);
+    return true;
+}
+
+/* What a probe cache miss does: one probe gives the fingerprint and can stop there */
+TEST_F(MediaCacheTest, FingerprintFromProbeWindow) {
+    MediaCache::Fingerprint fp;
+    ShallowProbe probe;
+    FsProbeResult result;
+
+    ASSERT_EQ(0, MediaCache::fingerprint(mImage, &fp));
+    probe.rc = -1;
+    ASSERT_EQ(0, FsProbe::probeMetadata(mImage, &result, fingerprintAndStop, &probe));
+    ASSERT_EQ(0, probe.rc);
+    EXPECT_EQ(0, memcmp(&fp, &probe.fp, sizeof(fp)));
+    /* Stopped before the deep probe: no FAT[1] state */
+    EXPECT_EQ(FSSTATE_UNKNOWN, result.state);
+}
+
+TEST_F(MediaCacheTest, CheckedMediaSurvivesRestart) {
+    MediaCache::Fingerprint fp;
+    FsProbeResult result;
+    bool checked;
+
+    ASSERT_EQ(0, MediaCache::fingerprint(mImage, &fp));
+    {
+        MediaCache cache(mCachePath);
+        EXPECT_FALSE(cache.lookup(&fp, &result, &checked));
+        cache.markChecked(mImage);
+        ASSERT_TRUE(cache.lookup(&fp, &result, &checked));
+        EXPECT_TRUE(checked);
+        EXPECT_EQ(1U, cache.getNumHits());
+        EXPECT_EQ(1U, cache.getNumMisses());
+    }
+
+    MediaCache cache(mCachePath);
+    ASSERT_TRUE(cache.lookup(&fp, &result, &checked));
+    EXPECT_TRUE(checked);
+    EXPECT_EQ(FSTYPE_FAT, result.type);
+    EXPECT_STREQ("1234-5678", result.uuid);
+    EXPECT_STREQ("CACHED", result.label);
+}
+
+TEST_F(MediaCacheTest, LeastRecentlyUsedIsEvicted) {
+    MediaCache cache(mCachePath);
+    MediaCache::Fingerprint fp;
+    FsProbeResult result;
+    bool checked;
+
+    memset(&fp, 0, sizeof(fp));
+    memset(&result, 0, sizeof(result));
+    for (int i = 0; i < MediaCache::MAX_ENTRIES; i++) {
+        fp.id = i;
+        cache.record(&fp, &result);
+    }
+
+    /* Touch the oldest, so the second oldest goes first */
+    fp.id = 0;
+    EXPECT_TRUE(cache.lookup(&fp, &result, &checked));
+    EXPECT_FALSE(checked);
+    fp.id = MediaCache::MAX_ENTRIES;
+    cache.record(&fp, &result);
+
+    EXPECT_EQ((int) MediaCache::MAX_ENTRIES, cache.getNumEntries());
+    EXPECT_EQ(1U, cache.getNumEvicted());
+    fp.id = 0;
+    EXPECT_TRUE(cache.lookup(&fp, &result, &checked));
+    fp.id = 1;
+    EXPECT_FALSE(cache.lookup(&fp, &result, &checked));
+}
+
+}
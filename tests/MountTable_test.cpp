@@ -0,0 +1,109 @@
+/*
+ * Parsing and lookups of the mount table, against a fake mountinfo file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#define LOG_TAG "MountTable_test"
+#include <utils/Log.h>
+#include "../MountTable.h"
+#include "TempDir.h"
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+class MountTableTest : public testing::Test {
+protected:
+    TempDir mDir;
+    char mPath[300];
+
+    virtual void SetUp() {
+        ASSERT_TRUE(mDir.create("mounttable")) << strerror(errno);
+        snprintf(mPath, sizeof(mPath), "%s/mountinfo", mDir.path());
+        write("");
+    }
+
+    void write(const char *contents) {
+        FILE *fp = fopen(mPath, "w");
+        ASSERT_TRUE(fp != NULL);
+        fputs(contents, fp);
+        fclose(fp);
+    }
+
+    static void collect(void *cookie, const char *source, const char *mountPoint) {
+        char *out = (char *) cookie;
+        strcat(out, source);
+        strcat(out, "@");
+        strcat(out, mountPoint);
+        strcat(out, ";");
+    }
+};
+
+TEST_F(MountTableTest, ParsesOptionalFieldsAndEscapes) {
+    write("15 1 0:3 / /proc rw,relatime - proc proc rw\n"
+          "20 1 179:2 / /system ro,relatime shared:1 master:2 - ext4 /dev/block/mmcblk0p2 ro\n"
+          "30 1 8:1 / /storage/usb\\040disk rw - vfat /dev/block/vold/8:1 rw\n");
+    MountTable table(mPath);
+    char source[64];
+
+    EXPECT_TRUE(table.isMounted("/proc"));
+    EXPECT_TRUE(table.isMounted("/storage/usb disk"));
+    EXPECT_FALSE(table.isMounted("/storage/usb\\040disk"));
+    EXPECT_FALSE(table.isMounted("/storage"));
+    ASSERT_EQ(0, table.getSource("/system", source, sizeof(source)));
+    EXPECT_STREQ("/dev/block/mmcblk0p2", source);
+    EXPECT_EQ(-1, table.getSource("/data", source, sizeof(source)));
+    EXPECT_EQ(3, table.getNumMounts());
+    EXPECT_EQ(1U, table.getNumRefreshes());
+}
+
+TEST_F(MountTableTest, ForEachUnderMatchesWholeComponents) {
+    write("40 1 7:0 / /mnt/obb/abc ro - vfat /dev/block/loop0 ro\n"
+          "41 1 7:1 / /mnt/obbx/def ro - vfat /dev/block/loop1 ro\n"
+          "42 1 0:9 / /mnt/obb rw - tmpfs tmpfs rw\n");
+    MountTable table(mPath);
+    char out[256] = "";
+
+    table.forEachUnder("/mnt/obb", collect, out);
+    EXPECT_STREQ("/dev/block/loop0@/mnt/obb/abc;", out);
+}
+
+TEST_F(MountTableTest, RereadsOnlyWhenInvalidated) {
+    write("50 1 8:1 / /mnt/a rw - vfat /dev/block/vold/8:1 rw\n");
+    MountTable table(mPath);
+
+    EXPECT_TRUE(table.isMounted("/mnt/a"));
+
+    /* A regular file never raises POLLPRI: the old contents stand */
+    write("51 1 8:2 / /mnt/b rw - vfat /dev/block/vold/8:2 rw\n");
+    EXPECT_TRUE(table.isMounted("/mnt/a"));
+    EXPECT_FALSE(table.isMounted("/mnt/b"));
+
+    table.invalidate();
+    EXPECT_FALSE(table.isMounted("/mnt/a"));
+    EXPECT_TRUE(table.isMounted("/mnt/b"));
+    EXPECT_EQ(2U, table.getNumRefreshes());
+}
+
+TEST_F(MountTableTest, WaitForIsBounded) {
+    write("60 1 8:1 / /mnt/a rw - vfat /dev/block/vold/8:1 rw\n");
+    MountTable table(mPath);
+
+    EXPECT_EQ(0, table.waitFor("/mnt/a", true, 0));
+    EXPECT_EQ(0, table.waitFor("/mnt/b", false, 0));
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    EXPECT_EQ(-1, table.waitFor("/mnt/b", true, 50));
+    EXPECT_EQ(ETIMEDOUT, errno);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    EXPECT_GE((end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000, 50);
+}
+
+}
@@ -0,0 +1,143 @@
+/*
+ * Finding the processes that hold files under a set of directories.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define LOG_TAG "OpenFileScanner_test"
+#include <utils/Log.h>
+#include "../OpenFileScanner.h"
+#include "TempDir.h"
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+class OpenFileScannerTest : public testing::Test {
+protected:
+    TempDir mDir;
+    char mA[300];
+    char mB[300];
+
+    virtual void SetUp() {
+        ASSERT_TRUE(mDir.create("openfiles")) << strerror(errno);
+        snprintf(mA, sizeof(mA), "%s/a", mDir.path());
+        snprintf(mB, sizeof(mB), "%s/b", mDir.path());
+        mkdir(mA, 0700);
+        mkdir(mB, 0700);
+    }
+
+    int openIn(const char *dir) {
+        char path[400];
+        snprintf(path, sizeof(path), "%s/file", dir);
+        return open(path, O_RDWR | O_CREAT, 0600);
+    }
+};
+
+TEST_F(OpenFileScannerTest, FindsHoldersOfAnyPath) {
+    OpenFileScanner scanner;
+    scanner.addPath(mA);
+    scanner.addPath(mB);
+
+    EXPECT_EQ(0, scanner.scan());
+
+    int fd = openIn(mB);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(1, scanner.scan());
+    EXPECT_TRUE(scanner.isHolder(getpid()));
+
+    /* Our own holder is re-checked, found gone, and /proc walked again */
+    close(fd);
+    unsigned int full = OpenFileScanner::getNumFullScans();
+    EXPECT_EQ(0, scanner.scan());
+    EXPECT_EQ(full + 1, OpenFileScanner::getNumFullScans());
+}
+
+static void *scanThread(void *arg) {
+    return (void *) (long) ((OpenFileScanner *) arg)->scan();
+}
+
+TEST_F(OpenFileScannerTest, SharedBetweenThreads) {
+    OpenFileScanner scanner;
+    EXPECT_TRUE(scanner.addPath(mA));
+    EXPECT_TRUE(scanner.addPath(mA));
+
+    int fd = openIn(mA);
+    ASSERT_GE(fd, 0);
+
+    /* One walks /proc, the other finds the holder already there */
+    unsigned int full = OpenFileScanner::getNumFullScans();
+    unsigned int reused = OpenFileScanner::getNumReusedScans();
+    pthread_t threads[2];
+    for (int i = 0; i < 2; i++)
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, scanThread, &scanner));
+    for (int i = 0; i < 2; i++) {
+        void *found;
+        pthread_join(threads[i], &found);
+        EXPECT_EQ(1, (long) found);
+    }
+    EXPECT_EQ(full + 1, OpenFileScanner::getNumFullScans());
+    EXPECT_EQ(reused + 1, OpenFileScanner::getNumReusedScans());
+    close(fd);
+}
+
+TEST_F(OpenFileScannerTest, DoesNotMatchSiblingPrefix) {
+    char other[400];
+    snprintf(other, sizeof(other), "%s/ab", mDir.path());
+    mkdir(other, 0700);
+
+    int fd = openIn(other);
+    ASSERT_GE(fd, 0);
+
+    OpenFileScanner scanner;
+    scanner.addPath(mA);
+    EXPECT_EQ(0, scanner.scan());
+
+    close(fd);
+}
+
+TEST_F(OpenFileScannerTest, ReusesHoldersAndKillsThem) {
+    int ready[2];
+    ASSERT_EQ(0, pipe(ready));
+
+    pid_t child = fork();
+    ASSERT_GE(child, 0);
+    if (child == 0) {
+        close(ready[0]);
+        int fd = openIn(mA);
+        write(ready[1], &fd, sizeof(fd));
+        for (;;)
+            pause();
+    }
+    close(ready[1]);
+    int fd;
+    ASSERT_EQ((ssize_t) sizeof(fd), read(ready[0], &fd, sizeof(fd)));
+    close(ready[0]);
+
+    OpenFileScanner scanner;
+    scanner.addPath(mA);
+    ASSERT_EQ(1, scanner.scan());
+    EXPECT_TRUE(scanner.isHolder(child));
+
+    unsigned int reused = OpenFileScanner::getNumReusedScans();
+    EXPECT_EQ(1, scanner.scan());
+    EXPECT_EQ(reused + 1, OpenFileScanner::getNumReusedScans());
+
+    scanner.signalHolders(2);
+    int status;
+    ASSERT_EQ(child, waitpid(child, &status, 0));
+    EXPECT_TRUE(WIFSIGNALED(status));
+    EXPECT_EQ(SIGKILL, WTERMSIG(status));
+    EXPECT_EQ(0, scanner.scan());
+}
+
+}
@@ -0,0 +1,74 @@
+#ifndef _TEMP_DIR_H
+#define _TEMP_DIR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace android {
+
+/*
+ * A scratch directory for one test, "<name>_XXXXXX" under $TMPDIR (or
+ * /data/local/tmp on the device). It goes away with everything in it
+ * when the TempDir does, so fixtures need no TearDown() of their own.
+ */
+class TempDir {
+public:
+    TempDir() { mPath[0] = '\0'; }
+    ~TempDir() { remove(); }
+
+    /* false, with errno set, if it cannot be made */
+    bool create(const char *name) {
+        const char *dir = getenv("TMPDIR");
+
+        remove();
+        snprintf(mPath, sizeof(mPath), "%s/%s_XXXXXX", dir ? dir : "/data/local/tmp", name);
+        if (!mkdtemp(mPath)) {
+            mPath[0] = '\0';
+            return false;
+        }
+        return true;
+    }
+
+    const char *path() { return mPath; }
+
+    void remove() {
+        if (mPath[0])
+            removeTree(mPath);
+        mPath[0] = '\0';
+    }
+
+private:
+    char mPath[256];
+
+    static void removeTree(const char *path) {
+        struct stat st;
+
+        if (lstat(path, &st))
+            return;
+        if (S_ISDIR(st.st_mode)) {
+            DIR *d = opendir(path);
+            if (d) {
+                struct dirent *de;
+                while ((de = readdir(d)) != NULL) {
+                    char child[512];
+                    if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+                        continue;
+                    snprintf(child, sizeof(child), "%s/%s", path, de->d_name);
+                    removeTree(child);
+                }
+                closedir(d);
+            }
+            rmdir(path);
+        } else {
+            unlink(path);
+        }
+    }
+};
+
+}
+
+#endif
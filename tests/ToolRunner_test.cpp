@@ -0,0 +1,171 @@
+/*
+ * Output capture, exit status, timeout and cancellation of ToolRunner.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+
+#define LOG_TAG "ToolRunner_test"
+#include <utils/Log.h>
+#include "../ToolRunner.h"
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+struct Lines {
+    int  count;
+    char last[64];
+};
+
+static void collect(void *cookie, const char *line) {
+    Lines *lines = reinterpret_cast<Lines *>(cookie);
+    lines->count++;
+    strlcpy(lines->last, line, sizeof(lines->last));
+}
+
+TEST(ToolRunnerTest, CapturesOutputAndStatus) {
+    const char *args[] = { "sh", "-c", "echo one; echo two >&2; printf '50%%\\r60%%'; exit 3" };
+    ToolRunner runner;
+    Lines lines;
+    char out[64];
+    int status;
+
+    memset(&lines, 0, sizeof(lines));
+    runner.setLineCallback(collect, &lines);
+    ASSERT_EQ(0, runner.run(3, args, &status));
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(3, WEXITSTATUS(status));
+    EXPECT_EQ(4, lines.count);
+    EXPECT_STREQ("60%", lines.last);
+    runner.getOutput(out, sizeof(out));
+    EXPECT_STREQ("one\ntwo\n50%\r60%", out);
+
+    /* Only the tail is kept */
+    runner.getOutput(out, 4);
+    EXPECT_STREQ("60%", out);
+}
+
+TEST(ToolRunnerTest, MissingTool) {
+    const char *args[] = { "/nonexistent/tool" };
+    ToolRunner runner;
+    int status;
+
+    EXPECT_EQ(-1, runner.run(1, args, &status));
+    EXPECT_EQ(ENOENT, errno);
+}
+
+TEST(ToolRunnerTest, TimeoutKills) {
+    const char *args[] = { "sleep", "10" };
+    ToolRunner runner;
+    int status;
+    unsigned int killed = ToolRunner::getNumKilled();
+
+    runner.setTimeout(200);
+    EXPECT_EQ(-1, runner.run(2, args, &status));
+    EXPECT_EQ(ETIMEDOUT, errno);
+    EXPECT_TRUE(WIFSIGNALED(status));
+    EXPECT_LT(runner.getWallMs(), 5000);
+    EXPECT_EQ(killed + 1, ToolRunner::getNumKilled());
+}
+
+/* A reader slower than the tool, so its output never runs dry */
+static void slowLine(void *cookie, const char *line) {
+    (void) cookie;
+    (void) line;
+    usleep(200);
+}
+
+TEST(ToolRunnerTest, TimeoutKillsNonstopWriter) {
+    /* Like fsck_msdos printing errors for every cluster of a broken card */
+    const char *args[] = { "sh", "-c", "while :; do echo 'Cluster 1234 out of range'; done" };
+    ToolRunner runner;
+    int status;
+
+    runner.setTimeout(500);
+    runner.setLineCallback(slowLine, NULL);
+    EXPECT_EQ(-1, runner.run(3, args, &status));
+    EXPECT_EQ(ETIMEDOUT, errno);
+    EXPECT_TRUE(WIFSIGNALED(status));
+    EXPECT_LT(runner.getWallMs(), 5000);
+}
+
+TEST(ToolRunnerTest, GrandchildWritingNonstop) {
+    const char *args[] = { "sh", "-c", "(while :; do echo spam; done) & exit 0" };
+    ToolRunner runner;
+    int status;
+
+    runner.setLineCallback(slowLine, NULL);
+    ASSERT_EQ(0, runner.run(3, args, &status));
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(0, WEXITSTATUS(status));
+    EXPECT_LT(runner.getWallMs(), 5000);
+}
+
+TEST(ToolRunnerTest, TimeoutCoversAllRuns) {
+    const char *first[] = { "sleep", "0.3" };
+    const char *second[] = { "sleep", "10" };
+    ToolRunner runner;
+    int status;
+
+    runner.setTimeout(500);
+    EXPECT_EQ(0, runner.run(2, first, &status));
+    EXPECT_EQ(-1, runner.run(2, second, &status));
+    EXPECT_EQ(ETIMEDOUT, errno);
+    EXPECT_LT(runner.getWallMs(), 400);
+    EXPECT_EQ(-1, runner.run(2, first, &status));
+    EXPECT_EQ(ETIMEDOUT, errno);
+}
+
+/* The background sleep keeps the output pipe open after sh has exited */
+TEST(ToolRunnerTest, GrandchildHoldingOutput) {
+    const char *args[] = { "sh", "-c", "sleep 12 & echo done" };
+    ToolRunner runner;
+    char out[64];
+    int status;
+
+    ASSERT_EQ(0, runner.run(3, args, &status));
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(0, WEXITSTATUS(status));
+    EXPECT_LT(runner.getWallMs(), 2000);
+    runner.getOutput(out, sizeof(out));
+    EXPECT_STREQ("done\n", out);
+}
+
+static void *cancelLater(void *arg) {
+    usleep(200 * 1000);
+    ToolRunner::cancelByArg((const char *) arg);
+    return NULL;
+}
+
+TEST(ToolRunnerTest, CancelByArg) {
+    const char *args[] = { "sleep", "11" };
+    ToolRunner runner;
+    pthread_t thread;
+    int status;
+
+    ASSERT_EQ(0, pthread_create(&thread, NULL, cancelLater, (void *) "11"));
+    EXPECT_EQ(-1, runner.run(2, args, &status));
+    EXPECT_EQ(ECANCELED, errno);
+    pthread_join(thread, NULL);
+    EXPECT_EQ(0, ToolRunner::cancelByArg("11"));
+}
+
+TEST(ToolRunnerTest, CancelBeforeRunSticks) {
+    const char *args[] = { "true" };
+    ToolRunner runner;
+    int status;
+
+    runner.cancel();
+    EXPECT_EQ(-1, runner.run(1, args, &status));
+    EXPECT_EQ(ECANCELED, errno);
+    EXPECT_EQ(-1, runner.run(1, args, &status));
+    EXPECT_EQ(ECANCELED, errno);
+}
+
+}
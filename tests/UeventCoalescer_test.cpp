@@ -0,0 +1,123 @@
+/*
+ * How a disk's batch of block uevents is folded before delivery.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_TAG "UeventCoalescer_test"
+#include <utils/Log.h>
+#include "../UeventCoalescer.h"
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+class UeventCoalescerTest : public testing::Test {
+protected:
+    UeventCoalescer *mCoalescer;
+    UeventCoalescer::EventCollection mEvents;
+
+    virtual void SetUp() {
+        mCoalescer = new UeventCoalescer(NULL);
+    }
+
+    virtual void TearDown() {
+        UeventCoalescer::EventCollection::iterator it;
+        for (it = mEvents.begin(); it != mEvents.end(); ++it) {
+            delete *it;
+        }
+        mEvents.clear();
+        delete mCoalescer;
+    }
+
+    void post(int action, int partn) {
+        BlockUevent *evt = new BlockUevent();
+
+        memset(evt, 0, sizeof(*evt));
+        evt->action = action;
+        evt->major = 8;
+        evt->minor = partn;
+        evt->partn = partn ? partn : -1;
+        evt->nparts = partn ? -1 : 2;
+        if (partn) {
+            evt->devtype = BlockUevent::DevType_Partition;
+            snprintf(evt->devpath, sizeof(evt->devpath), "/devices/usb1/block/sda/sda%d", partn);
+        } else {
+            evt->devtype = BlockUevent::DevType_Disk;
+            strcpy(evt->devpath, "/devices/usb1/block/sda");
+        }
+        mEvents.push_back(evt);
+    }
+
+    /* "a0 a1 r0" - action and partition number of what is left */
+    void folded(char *buf, size_t size) {
+        size_t len = 0;
+
+        mCoalescer->fold(&mEvents);
+        buf[0] = '\0';
+        UeventCoalescer::EventCollection::iterator it;
+        for (it = mEvents.begin(); it != mEvents.end(); ++it) {
+            const BlockUevent *evt = *it;
+            char action = evt->action == NetlinkEvent::NlActionAdd ? 'a' :
+                    evt->action == NetlinkEvent::NlActionRemove ? 'r' : 'c';
+            len += snprintf(buf + len, size - len, "%s%c%d", len ? " " : "", action,
+                    evt->isDisk() ? 0 : evt->partn);
+        }
+    }
+};
+
+TEST_F(UeventCoalescerTest, DiskWithPartitionsPassesThrough) {
+    char out[64];
+
+    post(NetlinkEvent::NlActionAdd, 0);
+    post(NetlinkEvent::NlActionAdd, 1);
+    post(NetlinkEvent::NlActionAdd, 2);
+    folded(out, sizeof(out));
+    EXPECT_STREQ("a0 a1 a2", out);
+    EXPECT_EQ(0U, mCoalescer->getNumCancelled());
+}
+
+TEST_F(UeventCoalescerTest, FlakyConnectorIsProbedOnce) {
+    char out[64];
+
+    post(NetlinkEvent::NlActionAdd, 0);
+    post(NetlinkEvent::NlActionAdd, 1);
+    post(NetlinkEvent::NlActionRemove, 1);
+    post(NetlinkEvent::NlActionRemove, 0);
+    post(NetlinkEvent::NlActionAdd, 0);
+    post(NetlinkEvent::NlActionAdd, 1);
+    folded(out, sizeof(out));
+    /* Removes always go through; only the last add is probed */
+    EXPECT_STREQ("r1 r0 a0 a1", out);
+    EXPECT_EQ(2U, mCoalescer->getNumCancelled());
+}
+
+TEST_F(UeventCoalescerTest, PartitionRemoveDropsOnlyThatPartition) {
+    char out[64];
+
+    post(NetlinkEvent::NlActionAdd, 0);
+    post(NetlinkEvent::NlActionAdd, 1);
+    post(NetlinkEvent::NlActionAdd, 2);
+    post(NetlinkEvent::NlActionRemove, 2);
+    folded(out, sizeof(out));
+    EXPECT_STREQ("a0 a1 r2", out);
+    EXPECT_EQ(1U, mCoalescer->getNumCancelled());
+}
+
+TEST_F(UeventCoalescerTest, BackToBackDiskChangesCollapse) {
+    char out[64];
+
+    post(NetlinkEvent::NlActionChange, 0);
+    post(NetlinkEvent::NlActionChange, 0);
+    post(NetlinkEvent::NlActionChange, 0);
+    post(NetlinkEvent::NlActionAdd, 1);
+    post(NetlinkEvent::NlActionChange, 0);
+    folded(out, sizeof(out));
+    /* Only changes with nothing in between */
+    EXPECT_STREQ("c0 a1 c0", out);
+    EXPECT_EQ(2U, mCoalescer->getNumCancelled());
+}
+
+}
@@ -0,0 +1,122 @@
+/*
+ * Backoff, deadline and escalation of the unmount retry loop. A path
+ * component too long to name makes umount2() fail without touching any
+ * real mount.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define LOG_TAG "UnmountPolicy_test"
+#include <utils/Log.h>
+#include <cutils/properties.h>
+#include "../UnmountPolicy.h"
+#include "TempDir.h"
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+static int64_t nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+class UnmountPolicyTest : public testing::Test {
+protected:
+    char mBusy[NAME_MAX + 3];
+
+    virtual void SetUp() {
+        memset(mBusy, 'x', sizeof(mBusy) - 1);
+        mBusy[0] = '/';
+        mBusy[sizeof(mBusy) - 1] = '\0';
+    }
+};
+
+/* init refuses longer names, so a setting that does not fit is dead */
+TEST_F(UnmountPolicyTest, SettingKeysFitPropertyNames) {
+    static const char *types[] = { "usb", "sd", "nfs", NULL };
+    static const char *names[] = { "backoff_ms", "max_ms", "timeout_ms" };
+    char key[PROPERTY_KEY_MAX];
+
+    for (unsigned int t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+        for (unsigned int n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+            EXPECT_EQ(0, UnmountPolicy::settingKey(key, sizeof(key), types[t], names[n]))
+                    << (types[t] ? types[t] : "*") << "." << names[n];
+            EXPECT_LT(strlen(key), (size_t) PROPERTY_KEY_MAX);
+        }
+    }
+    EXPECT_EQ(-1, UnmountPolicy::settingKey(key, sizeof(key), "usb", "max_backoff_ms"));
+    EXPECT_EQ(ENAMETOOLONG, errno);
+}
+
+TEST_F(UnmountPolicyTest, NotMountedIsDone) {
+    UnmountPolicy policy("usb", false);
+    unsigned int attempts = UnmountPolicy::getNumAttempts();
+
+    EXPECT_EQ(0, policy.unmount("/nonexistent/vold/mount"));
+    EXPECT_EQ(attempts + 1, UnmountPolicy::getNumAttempts());
+}
+
+TEST_F(UnmountPolicyTest, BacksOffUntilDeadline) {
+    UnmountPolicy policy("usb", false);
+    unsigned int givenUp = UnmountPolicy::getNumGivenUp();
+    int64_t start = nowMs();
+
+    policy.setDeadline(start + 200);
+    EXPECT_EQ(-1, policy.unmount(mBusy));
+    EXPECT_EQ(EBUSY, errno);
+    int64_t took = nowMs() - start;
+    EXPECT_GE(took, 200);
+    EXPECT_LT(took, 1000);
+    EXPECT_EQ(givenUp + 1, UnmountPolicy::getNumGivenUp());
+
+    /* 20, 40, 80 ms and what is left: five attempts, not two hundred */
+    char last[512];
+    UnmountPolicy::describeLast(last, sizeof(last));
+    EXPECT_TRUE(strstr(last, "gave up: 5 attempts") != NULL) << last;
+}
+
+TEST_F(UnmountPolicyTest, ForcedUnmountSignalsHoldersAtOnce) {
+    TempDir tmp;
+    ASSERT_TRUE(tmp.create("unmount")) << strerror(errno);
+    const char *dir = tmp.path();
+
+    int ready[2];
+    ASSERT_EQ(0, pipe(ready));
+    pid_t child = fork();
+    ASSERT_GE(child, 0);
+    if (child == 0) {
+        chdir(dir);
+        write(ready[1], "x", 1);
+        for (;;)
+            pause();
+    }
+    close(ready[1]);
+    char c;
+    ASSERT_EQ(1, read(ready[0], &c, 1));
+    close(ready[0]);
+
+    UnmountPolicy policy("usb", true);
+    unsigned int term = UnmountPolicy::getNumTerm();
+    policy.addPath(dir);
+    policy.setDeadline(nowMs() + 100);
+    EXPECT_EQ(-1, policy.unmount(mBusy));
+    EXPECT_GE(UnmountPolicy::getNumTerm(), term + 1);
+
+    int status;
+    ASSERT_EQ(child, waitpid(child, &status, 0));
+    EXPECT_TRUE(WIFSIGNALED(status));
+}
+
+}
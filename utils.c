@@ -28,179 +28,22 @@
 
 #include <linux/iso_fs.h>
 #include "utils.h"
+#include "VolumeManager.h"
 #ifdef FUNCTION_STORAGE_TUXERA_PATCH    
 #include "ExFat.h"
 #endif
 
-#define FAT32_ROOT_ENTRY_COUNT 0
-#define FAT16_ROOT_ENTRY_COUNT 512
 #define FAT_LABEL_SIZE 11
 
-#define BYTES_PER_SECTOR_POS 0x0B
-#define TOTAL_SECTOR16_POS 0x13
-#define TOTAL_SECTOR32_POS 0x20
-
 typedef unsigned short u16;
 typedef unsigned int u32;
 typedef unsigned char u8;
 
-#define READ_AT(var, offset) pread64(fd, &var, sizeof(var), offset)
-#define CLUSTER_START(cluster) (data_start + ((cluster - 2) * cluster_size))
-
 #define PAGE_SIZE        (1UL << PAGE_SHIFT)
 #define PAGE_MASK        (~(PAGE_SIZE-1))
 #define PAGE_ALIGN(_x) (((_x)+PAGE_SIZE-1)&PAGE_MASK)
 #define PAGE(_x)     (_x & PAGE_MASK)
 
-static char *
-readRootEntryLabel(const char *dev) {
-    u16 fat16_length;
-    u32 fat32_length, root_cluster;
-    u16 dir_entries;
-    u16 sector_size;
-    u8 fats, sector_per_cluster;
-    u32 cluster_size;
-    u16 reserved;
-    int fd;
-    long long root_start, data_start;
-    u32 i;
-    u8 *first_fat, *second_fat;
-    u32 clusters;
-    u16 sectors16;
-    u32 sectors;
-
-    fd = open(dev, O_RDONLY);
-    if (fd < 0) {
-        return NULL;
-    }
-
-    READ_AT(sector_size, 11);
-    READ_AT(sector_per_cluster, 13);
-    READ_AT(reserved, 14);
-    READ_AT(fats, 16);
-    READ_AT(dir_entries, 17);
-    READ_AT(sectors16, 19);
-    if (sectors16 == 0) {
-        READ_AT(sectors, 32);
-    } else {
-        sectors = sectors16;
-    }
-
-    READ_AT(fat16_length, 22);
-    READ_AT(fat32_length, 36);
-
-    SLOGV("fat16_len = %d fat32_len = %d", fat16_length, fat32_length);
-    SLOGV("sector_size = %d sectors = %d", sector_size, sectors);
-    SLOGV("reserved = %d", reserved);
-
-#define check_size(size) ((size) == 0 || (((size) & ((size) -1)) != 0))
-    if (check_size(sector_size)) {
-        SLOGW("no valid sector size: %d", sector_size);
-        close(fd);
-        return NULL;
-    }
-
-    int fat_length = fat16_length ? fat16_length : fat32_length;
-    cluster_size = sector_size * sector_per_cluster;
-    root_start = (reserved + fats * fat_length) * sector_size;
-    data_start = root_start + ((dir_entries << 5) + sector_size - 1)/sector_size * sector_size;
-    long long data_size = sectors * (long long)sector_size - data_start;
-    clusters = data_size / cluster_size;
-    u32 num_cluster = clusters + 2;
-    int fat_start = reserved * sector_size;
-    int fat_size = num_cluster * 4;
-
-    SLOGV("cluster_size = %d", cluster_size);
-    SLOGV("data_start = %lld data_size = %lld", data_start, data_size);
-    SLOGV("root_start = %lld", root_start);
-    SLOGV("first_fat_start = %d fat_size = %d", fat_start, fat_size);
-    SLOGI("aligned first_fat_start = %d fat_size = %d", PAGE(fat_start), PAGE_ALIGN(fat_size));
-
-    if (fat16_length == 0 && fat32_length != 0) {
-        // fat32
-        if (READ_AT(root_cluster, 36 + 8) < 0) goto read_fail;
-        if (root_cluster) {
-            u32 cluster;
-            SLOGD("root_cluster = %d, num_cluster=%d", root_cluster, num_cluster);
-            for (cluster=root_cluster; cluster != 0 && cluster < num_cluster; ) {
-                long long offset = CLUSTER_START(cluster);
-                SLOGV("cluster = %d %lld", cluster, offset);
-                for (i=0; i*32<cluster_size; i++, offset += 32) {
-                    u8 attr;
-                    if (READ_AT(attr, offset + 11) < 0) goto read_fail;
-                    SLOGV("attr = %02X", attr);
-                    if (attr == 0x08) {
-                        // volume label
-                        u8 name[8];
-                        u8 ext[3], label[16];
-                        if (READ_AT(ext, offset + 8) < 0) goto read_fail;
-                        if (READ_AT(name, offset) < 0) goto read_fail;
-                        if (name[0] == 0xE5 || name[0] == 0) continue;
-                        sprintf((char *)label, "%.8s%.3s", name, ext);
-                        close(fd);
-                        return strdup((char *)label);
-                    }
-                }
-                offset = fat_start + cluster * sizeof(u32);
-                if (READ_AT(cluster, offset) < 0) goto read_fail;
-                cluster = cluster & 0xFFFFFF;
-                SLOGV("next cluster=%u", cluster);
-            }
-        }
-    }
-    close(fd);
-    return NULL;
-read_fail:
-    SLOGW("fd read fail. path=%s", dev);
-    close(fd);
-    return NULL;
-}
-
-static int32_t getFatId(const char *fsPath) {
-    FILE *fp = fopen(fsPath, "r");
-    if(fp == NULL) {
-        SLOGE("getFatId: cannot open device: %s %s", fsPath, strerror(errno));
-        return -1;
-    }
-    uint16_t fat_type;
-    if (fseek(fp, 0x11, SEEK_SET) < 0) goto seek_fail;
-    if (fread(&fat_type, 1, 2, fp) != 2) goto read_fail;
-    SLOGD("fat_type=%u", fat_type);
-    int32_t id;
-    if (fat_type == FAT16_ROOT_ENTRY_COUNT) {
-        if (fseek(fp, 0x27, SEEK_SET) < 0) goto seek_fail;
-        if (fread(&id, 1, 4, fp) != 4) goto read_fail;
-    } else if (fat_type == FAT32_ROOT_ENTRY_COUNT) {
-        if (fseek(fp, 0x43, SEEK_SET) < 0) goto seek_fail;
-        if (fread(&id, 1, 4, fp) != 4) goto read_fail;
-    } else {
-        SLOGW("%s::Not surpported filesystem=%s", __func__, fsPath);
-        id = -1;
-    }
-    SLOGD("getFatId() id=%d", id);
-    fclose(fp);
-    return id;
-seek_fail:
-    SLOGE("fseek fail. path=%s", fsPath);
-    fclose(fp);
-    return -1;
-read_fail:
-    SLOGE("fread fail. path=%s", fsPath);
-    fclose(fp);
-    return -1;
-}
-
-static void
-__rtrim(char *src) {
-    char *out = src;
-    int len = strlen(out);
-    int i;
-    for (i=len-1; i>=0; i--) {
-        if (out[i] != ' ') break;
-    }
-    out[i+1] = '\0';
-}
-
 static void
 __replace(char *src, char s, char r) {
     int len = strlen(src);
@@ -212,121 +55,53 @@ __replace(char *src, char s, char r) {
     }
 }
 
-static void getFatLabel(const char *fsPath, char *label) {
-    FILE *fp = fopen(fsPath, "r");
-    if (fp == NULL) {
-        SLOGE("getFatLabel: cannot open device: %s %s", fsPath, strerror(errno));
-        label[0] = '\0';
-        return;
-    }
-    char *rootEntryLabel = readRootEntryLabel(fsPath);
-    SLOGI("rootEntryLabel[%s]", rootEntryLabel);
-    if (rootEntryLabel) {
-        strncpy(label, rootEntryLabel, FAT_LABEL_SIZE);
-        free(rootEntryLabel);
-    } else {
-        uint16_t fat_type;
-        if (fseek(fp, 0x11, SEEK_SET) < 0) goto seek_fail;
-        if (fread(&fat_type, 1, 2, fp) != 2) goto read_fail;
-        SLOGI("fat_type=%d", fat_type);
-        if (fat_type == FAT16_ROOT_ENTRY_COUNT) {
-            if (fseek(fp, 0x2b, SEEK_SET) < 0) goto seek_fail;
-            if (fread(label, 1, FAT_LABEL_SIZE, fp) != FAT_LABEL_SIZE) goto read_fail;
-        } else if (fat_type == FAT32_ROOT_ENTRY_COUNT) {
-            if (fseek(fp, 0x47, SEEK_SET) < 0) goto seek_fail;
-            if (fread(label, 1, FAT_LABEL_SIZE, fp) != FAT_LABEL_SIZE) goto read_fail;
-        } else {
-            SLOGW("%s::Not surpported filesystem=%s", __func__, fsPath);
-        }
+/*
+ * The vold probe cache reads each partition once per insert; the readers
+ * below are only used when it does not recognise the filesystem.
+ */
+static int getCachedInfo(const char *devPath, FsProbeResult *probe) {
+    if (vold_probeDevice(devPath, probe) != 0 || probe->type == FSTYPE_UNRECOGNIZED) {
+        return -1;
     }
-    label[FAT_LABEL_SIZE] = 0;
-    __rtrim(label);
-    __replace(label, ' ', '_');
-    fclose(fp);
-    // FIXME
-    SLOGI("label=[%s]", label);
-    return;
-seek_fail:
-    SLOGE("fseek fail. path=%s", fsPath);
-    fclose(fp);
-    label[0] = '\0';
-    return;
-read_fail:
-    SLOGE("fread fail. path=%s", fsPath);
-    fclose(fp);
-    label[0] = '\0';
-    return;
+    return 0;
 }
 
-static uint64_t getFatSize(const char *fsPath) {
-    FILE *fp = fopen(fsPath, "r");
-    if (fp == NULL) {
-        SLOGE("getFatSize: cannot open device: %s %s", fsPath, strerror(errno));
-        return 0;
-    }
-    uint16_t fat_type;
-    uint64_t bytes;
-    if (fseek(fp, 0x11, SEEK_SET) < 0) goto seek_fail;
-    if (fread(&fat_type, 1, 2, fp) != 2) goto read_fail;
-
-    if (fat_type == FAT16_ROOT_ENTRY_COUNT ||
-            fat_type == FAT32_ROOT_ENTRY_COUNT) {
-        uint16_t sectors16;
-        if (fseek(fp, TOTAL_SECTOR16_POS, SEEK_SET) < 0) goto seek_fail;
-        if (fread(&sectors16, 1, 2, fp) != 2) goto read_fail;
-        SLOGW("%s::total_sector16=%u", fsPath, sectors16);
-
-        uint32_t sectors;
-        if (sectors16 != 0) {
-            sectors = (uint32_t)sectors16;
-        } else {
-            uint32_t sectors32;
-            if (fseek(fp, TOTAL_SECTOR32_POS, SEEK_SET) < 0) goto seek_fail;
-            if (fread(&sectors32, 1, 4, fp) != 4) goto read_fail;
-            SLOGW("%s::total_sector32=%u", fsPath, sectors32);
-            sectors = sectors32;
+/* Label as the framework has always seen it: truncated, spaces as '_' */
+static void copyLabel(char *label, size_t labelSize, const char *src) {
+    size_t n = strlen(src);
+    if (n >= labelSize) {
+        /* don't cut a UTF-8 sequence in half */
+        n = labelSize - 1;
+        while (n > 0 && ((unsigned char) src[n] & 0xc0) == 0x80) {
+            n--;
         }
-
-        uint16_t bytes_per_sector;
-        if (fseek(fp, BYTES_PER_SECTOR_POS, SEEK_SET) < 0) goto seek_fail;
-        if (fread(&bytes_per_sector, 1, 2, fp) != 2) goto read_fail;
-        SLOGW("%s::bytes_per_sector=%d", fsPath, bytes_per_sector);
-
-        bytes = (uint64_t)sectors * bytes_per_sector;
-        SLOGW("%s::volume size bytes=%lld", fsPath, bytes);
-    } else {
-        bytes = 0;
-        SLOGW("fat_type=%d", fat_type);
-        SLOGW("%s::Not surpported filesystem=%s", __func__, fsPath);
     }
-    fclose(fp);
-    return bytes;
-seek_fail:
-    SLOGE("fseek fail. path=%s", fsPath);
-    fclose(fp);
-    return 0;
-read_fail:
-    SLOGE("fread fail. path=%s", fsPath);
-    fclose(fp);
-    return 0;
+    memcpy(label, src, n);
+    label[n] = '\0';
+    __replace(label, ' ', '_');
 }
 
-static int getFatInfo(const char *fsPath, char *label, int32_t *id) {
-    uint64_t size = getFatSize(fsPath);
-    if (size == 0) {
+/* Fallback when the probe cache could not read the partition */
+static int getFatInfo(const char *fsPath, char *label, size_t labelSize, int32_t *id) {
+    FatBootInfo fat;
+
+    if (readFatBootInfo(fsPath, &fat) != 0 || fat.id == -1) {
         *id = -1;
         label[0] = '\0';
         return -1;
     }
+    *id = fat.id;
+    copyLabel(label, labelSize, fat.label);
+    return 0;
+}
 
-    *id = getFatId(fsPath);
-    if (*id == -1) {
-        label[0] = '\0';
-        return -1;
-    }
+static uint64_t getFatSize(const char *fsPath) {
+    FatBootInfo fat;
 
-    getFatLabel(fsPath, label);
-    return 0;
+    if (readFatBootInfo(fsPath, &fat) != 0) {
+        return 0;
+    }
+    return fat.size;
 }
 
 //+NATIVE_PLATFORM
@@ -371,6 +146,14 @@ int getIsoInfo(const char *fsPath, char *label, int32_t *id) {
         label[0] = '\0';
         return -1;
     }
+    FsProbeResult probe;
+    if (getCachedInfo(fsPath, &probe) == 0 && probe.type == FSTYPE_ISO9660) {
+        *id = probe.id;
+        // FIXME
+        label[0] = '\0';
+        return 0;
+    }
+
     struct iso_primary_descriptor ipd;
     if (getIsoDescriptor(fsPath, &ipd) != 0) {
         *id = -1;
@@ -518,7 +301,26 @@ int getVolumeInfo(const char *mntPnt, const char *devPath, char *label, int32_t
     }
 	#endif                  
 	//-NATIVE_PLATFORM
-    int rc = getFatInfo(devPath, label, id);
+    FsProbeResult probe;
+    if (getCachedInfo(devPath, &probe) == 0) {
+        *id = probe.id;
+        //+NATIVE_PLATFORM
+        #ifdef FUNCTION_STORAGE_TUXERA_PATCH    
+        copyLabel(label, labelSize, probe.label);
+        #else
+        copyLabel(label, FAT_LABEL_SIZE + 1, probe.label);
+        #endif
+        //-NATIVE_PLATFORM
+        return 0;
+    }
+
+    //+NATIVE_PLATFORM
+    #ifdef FUNCTION_STORAGE_TUXERA_PATCH    
+    int rc = getFatInfo(devPath, label, labelSize, id);
+    #else
+    int rc = getFatInfo(devPath, label, FAT_LABEL_SIZE + 1, id);
+    #endif
+    //-NATIVE_PLATFORM
 
     //+NATIVE_PLATFORM
     #ifdef FUNCTION_STORAGE_TUXERA_PATCH    
@@ -540,6 +342,7 @@ int getVolumeInfo(const char *mntPnt, const char *devPath, char *label, int32_t
         rc = getNtfsInfo(devPath, label, &ntfs_id);
         if (rc != -1) {
             *id = ((ntfs_id >> 32) & 0xffffffff);
+            __replace(label, ' ', '_');
         }
     }
     return rc;
@@ -555,6 +358,11 @@ uint64_t getVolumeSize(const char *mntPnt, const char *devPath) {
 	#endif					
     //-NATIVE_PLATFORM
 
+    FsProbeResult probe;
+    if (getCachedInfo(devPath, &probe) == 0 && probe.size != 0) {
+        return probe.size;
+    }
+
     uint64_t size = getFatSize(devPath);
 
     //+NATIVE_PLATFORM
@@ -616,7 +424,7 @@ int main(int argc, char **argv) {
     char *dev = argv[1];
     char label[13];
     uint32_t id;
-    getFatInfo(dev, label, &id);
+    getFatInfo(dev, label, sizeof(label), &id);
     printf("size = %llu\n", getFatSize(dev));
 }
 #endif